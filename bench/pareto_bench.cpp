@@ -0,0 +1,203 @@
+// Accuracy against cost of the force methods: runs each method across its
+// accuracy knobs on one set of initial conditions, measures the relative
+// force error of every body against a double precision direct sum with the
+// same softening, and prints the configurations as a table with the Pareto
+// optimal ones marked.
+//
+//   pareto_bench [--ic catalog.csv | --n 20000] [--thetas 0.1,0.2,...] [--softenings 0,0.01]
+//                [--repeats 3] [--threads 0] [--budget 1e-3] [--csv pareto.csv]
+//
+// The knobs are the method and the Barnes-Hut opening angle, swept per
+// softening length. The tree is monopole only and there is no mesh method,
+// so there is no expansion order or mesh size to sweep. Time is the fastest
+// of the repeats of one force pass, tree build included. The GPU method
+// fuses its force pass into the step and cannot be timed on its own, its
+// forces are the same single precision direct sum as cpu_pp.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "catalog_loader.hpp"
+#include "gadget_io.hpp"
+#include "plummer.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+struct Config {
+  gravitysim::SimulationMethod method;
+  float theta = 0.0f;
+  float softening = 0.0f;
+};
+
+struct Measurement {
+  Config config;
+  double seconds = 0.0;
+  double rms_error = 0.0;
+  double p99_error = 0.0;
+  double max_error = 0.0;
+  bool pareto = false;
+};
+
+const char *method_name(gravitysim::SimulationMethod method) {
+  return method == gravitysim::SimulationMethod::CPU_BARNES_HUT ? "barnes_hut" : "cpu_pp";
+}
+
+std::vector<double> parse_list(const std::string &text) {
+  std::vector<double> values;
+  std::stringstream stream(text);
+  for (std::string item; std::getline(stream, item, ',');) values.push_back(std::stod(item));
+  return values;
+}
+
+Measurement measure(gravitysim::Simulation &simulation, const Config &config,
+                    const std::vector<gravitysim::dvec3> &exact, size_t repeats) {
+  simulation.switch_method(config.method);
+  simulation.set_theta(config.theta);
+  simulation.set_softening(config.softening);
+
+  Measurement m;
+  m.config = config;
+  m.seconds = INFINITY;
+  std::vector<gravitysim::vec3f> accs;
+  for (size_t r = 0; r < repeats; r++) {
+    auto start = std::chrono::steady_clock::now();
+    simulation.get_accelerations(accs);
+    m.seconds = std::min(m.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  std::vector<double> errors(accs.size());
+  double sum2 = 0.0;
+  for (size_t i = 0; i < accs.size(); i++) {
+    gravitysim::dvec3 diff = {accs[i].x - exact[i].x, accs[i].y - exact[i].y, accs[i].z - exact[i].z};
+    double norm = std::sqrt(gravitysim::dot(exact[i], exact[i]));
+    errors[i] = norm > 0.0 ? std::sqrt(gravitysim::dot(diff, diff)) / norm : 0.0;
+    sum2 += errors[i] * errors[i];
+  }
+  m.rms_error = std::sqrt(sum2 / std::max<size_t>(1, errors.size()));
+  std::sort(errors.begin(), errors.end());
+  if (!errors.empty()) {
+    m.p99_error = errors[std::min(errors.size() - 1, static_cast<size_t>(0.99 * errors.size()))];
+    m.max_error = errors.back();
+  }
+  return m;
+}
+
+// marks the measurements no other one beats on time, RMS and 99th percentile error at once
+void mark_pareto(std::vector<Measurement> &measurements) {
+  for (auto &a : measurements) {
+    a.pareto = std::none_of(measurements.begin(), measurements.end(), [&](const Measurement &b) {
+      bool no_worse = b.seconds <= a.seconds && b.rms_error <= a.rms_error && b.p99_error <= a.p99_error;
+      bool better = b.seconds < a.seconds || b.rms_error < a.rms_error || b.p99_error < a.p99_error;
+      return no_worse && better;
+    });
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string ic, csv;
+  size_t n = 20000, repeats = 3, threads = 0;
+  std::vector<double> thetas = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 1.0, 1.2};
+  std::vector<double> softenings = {0.0};
+  double budget = 0.0;
+  for (int a = 1; a + 1 < argc; a += 2) {
+    std::string key = argv[a], value = argv[a + 1];
+    if (key == "--ic") ic = value;
+    else if (key == "--n") n = static_cast<size_t>(std::stod(value));
+    else if (key == "--thetas") thetas = parse_list(value);
+    else if (key == "--softenings") softenings = parse_list(value);
+    else if (key == "--repeats") repeats = std::max<size_t>(1, std::stoul(value));
+    else if (key == "--threads") threads = std::stoul(value);
+    else if (key == "--budget") budget = std::stod(value);
+    else if (key == "--csv") csv = value;
+    else {
+      std::cerr << "unknown option " << key << "\n";
+      return 2;
+    }
+  }
+
+  gravitysim::InitialConditions ics;
+  bool loaded = true;
+  if (ic.empty()) {
+    ics = make_plummer(n, 12345);
+  } else if (ic.ends_with(".csv") || ic.ends_with(".txt")) {
+    loaded = gravitysim::load_catalog(ic, ics);
+  } else {
+    loaded = gravitysim::read_gadget(ic, ics);
+  }
+  if (!loaded || ics.masses.empty()) {
+    std::cerr << "cannot read initial conditions from " << ic << "\n";
+    return 2;
+  }
+  gravitysim::Simulation simulation(std::move(ics.masses), std::move(ics.positions), std::move(ics.vels), 1e-3f);
+  simulation.set_threads(threads);
+  simulation.set_G(1.0f);
+
+  std::ofstream csv_file;
+  if (!csv.empty()) {
+    csv_file.open(csv, std::ios::trunc);
+    csv_file << "softening,method,theta,seconds,rms_error,p99_error,max_error,pareto\n";
+  }
+
+  int status = 0;
+  for (double softening : softenings) {
+    simulation.set_softening(static_cast<float>(softening));
+    std::vector<gravitysim::dvec3> exact;
+    simulation.get_exact_accelerations(exact);
+
+    std::vector<Measurement> measurements;
+    measurements.push_back(measure(simulation, {gravitysim::SimulationMethod::CPU_PARTICLE_PARTICLE, 0.0f,
+                                                static_cast<float>(softening)}, exact, repeats));
+    for (double theta : thetas) {
+      measurements.push_back(measure(simulation, {gravitysim::SimulationMethod::CPU_BARNES_HUT,
+                                                  static_cast<float>(theta), static_cast<float>(softening)},
+                                     exact, repeats));
+    }
+    mark_pareto(measurements);
+    std::sort(measurements.begin(), measurements.end(),
+              [](const Measurement &a, const Measurement &b) { return a.seconds < b.seconds; });
+
+    std::cout << "softening " << softening << ", " << simulation.get_num_bodies() << " bodies\n";
+    std::cout << std::left << std::setw(12) << "method" << std::setw(8) << "theta" << std::setw(12) << "ms"
+              << std::setw(12) << "rms err" << std::setw(12) << "p99 err" << std::setw(12) << "max err"
+              << "pareto\n";
+    for (const auto &m : measurements) {
+      bool tree = m.config.method == gravitysim::SimulationMethod::CPU_BARNES_HUT;
+      std::cout << std::setw(12) << method_name(m.config.method) << std::setw(8)
+                << (tree ? std::to_string(m.config.theta).substr(0, 4) : "-") << std::setw(12) << std::setprecision(4)
+                << 1e3 * m.seconds << std::setw(12) << m.rms_error << std::setw(12) << m.p99_error << std::setw(12)
+                << m.max_error << (m.pareto ? "*" : "") << "\n";
+      if (csv_file.is_open()) {
+        csv_file << softening << "," << method_name(m.config.method) << "," << m.config.theta << "," << m.seconds
+                 << "," << m.rms_error << "," << m.p99_error << "," << m.max_error << "," << m.pareto << "\n";
+      }
+    }
+
+    if (budget > 0.0) {
+      // sorted by time, so the first within budget is the cheapest
+      auto cheapest = std::find_if(measurements.begin(), measurements.end(),
+                                   [&](const Measurement &m) { return m.p99_error <= budget; });
+      if (cheapest == measurements.end()) {
+        std::cout << "no configuration has a 99th percentile error within " << budget << "\n";
+        status = 1;
+      } else {
+        std::cout << "cheapest within " << budget << ": " << method_name(cheapest->config.method);
+        if (cheapest->config.method == gravitysim::SimulationMethod::CPU_BARNES_HUT) {
+          std::cout << " theta " << cheapest->config.theta;
+        }
+        std::cout << ", " << 1e3 * cheapest->seconds << " ms\n";
+      }
+    }
+    std::cout << "\n";
+  }
+  return status;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cmath>
+#include <numbers>
+#include <random>
+
+#include "catalog_loader.hpp"
+
+// initial conditions shared by the benchmarks
+
+// Plummer sphere with G = M = a = 1, sampled as in Aarseth, Henon and Wielen (1974)
+inline gravitysim::InitialConditions make_plummer(size_t n, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  auto direction = [&](double length) {
+    double z = 2.0 * uniform(rng) - 1.0, phi = 2.0 * std::numbers::pi * uniform(rng);
+    double s = std::sqrt(1.0 - z * z);
+    return DirectX::XMFLOAT3{float(length * s * std::cos(phi)), float(length * s * std::sin(phi)), float(length * z)};
+  };
+
+  gravitysim::InitialConditions ics;
+  ics.masses.assign(n, 1.0f / n);
+  ics.positions.resize(n);
+  ics.vels.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    // cut the tail at 99% of the mass so no body starts far outside
+    double r = 1.0 / std::sqrt(std::pow(0.99 * uniform(rng) + 1e-9, -2.0 / 3.0) - 1.0);
+    double q, g;
+    do {
+      q = uniform(rng);
+      g = 0.1 * uniform(rng);
+    } while (g > q * q * std::pow(1.0 - q * q, 3.5));
+    ics.positions[i] = direction(r);
+    ics.vels[i] = direction(q * std::sqrt(2.0) * std::pow(1.0 + r * r, -0.25));
+  }
+  return ics;
+}
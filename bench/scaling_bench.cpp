@@ -0,0 +1,346 @@
+// Scaling study: sweeps body count, thread count and force method, and
+// reports throughput, step latency, memory and energy error as JSON.
+// Memory is the peak RSS of the process so far and the peak bytes of each
+// tracked subsystem during the run.
+//
+//   scaling_bench [--n 1000,10000,...] [--threads 1,2,4,...] [--methods cpu_pp,barnes_hut,gpu_pp]
+//                 [--steps 10] [--max-seconds 20] [--energy-max-n 20000]
+//                 [--out scaling.json] [--baseline old.json] [--tolerance 0.1]
+//
+// Interactions per second count the n * n_massive pairs a direct sum would
+// evaluate, so Barnes-Hut reports the direct-sum work it replaced and the
+// methods compare on one scale. Configurations predicted to take longer than
+// --max-seconds per step from the previous N are skipped, so one sweep can
+// span 1e3 to 1e7 bodies. Energy is only checked up to --energy-max-n bodies
+// as get_PE is a direct sum. With --baseline, entries slower than the
+// baseline by more than the tolerance are flagged and the exit status is 1.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory_tracker.hpp"
+#include "plummer.hpp"
+#include "simulation.hpp"
+
+namespace {
+
+struct Options {
+  std::vector<size_t> ns = {1000, 10000, 100000, 1000000, 10000000};
+  std::vector<size_t> threads;
+  std::vector<std::string> methods = {"cpu_pp", "barnes_hut"};
+  size_t steps = 10;
+  double max_seconds = 20.0;
+  size_t energy_max_n = 20000;
+  std::string out = "scaling.json";
+  std::string baseline;
+  double tolerance = 0.1;
+};
+
+struct Result {
+  std::string method;
+  size_t n = 0;
+  size_t threads = 0;
+  size_t steps = 0;
+  double interactions_per_second = 0.0;
+  double p50_ms = 0.0;
+  double p90_ms = 0.0;
+  double p99_ms = 0.0;
+  uint64_t peak_rss_bytes = 0;
+  std::optional<double> energy_error;
+  std::array<size_t, gravitysim::NUM_MEMORY_SUBSYSTEMS> subsystem_peak_bytes{};
+  size_t tracked_peak_bytes = 0;
+};
+
+uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+std::string host_name() {
+#ifdef _WIN32
+  char name[MAX_COMPUTERNAME_LENGTH + 1];
+  DWORD size = sizeof(name);
+  return GetComputerNameA(name, &size) ? std::string(name, size) : "unknown";
+#else
+  char name[256] = {};
+  return gethostname(name, sizeof(name) - 1) == 0 ? std::string(name) : "unknown";
+#endif
+}
+
+std::string cpu_model() {
+#ifdef __linux__
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  for (std::string line; std::getline(cpuinfo, line);) {
+    if (line.rfind("model name", 0) == 0) return line.substr(line.find(':') + 2);
+  }
+#endif
+  return "unknown";
+}
+
+std::string compiler() {
+#if defined(__clang__)
+  return "clang " __clang_version__;
+#elif defined(__GNUC__)
+  return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+  return "msvc " + std::to_string(_MSC_VER);
+#else
+  return "unknown";
+#endif
+}
+
+std::string json_string(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    if (static_cast<unsigned char>(c) >= 0x20) out += c;
+  }
+  return out + "\"";
+}
+
+double percentile(std::vector<double> sorted, double p) {
+  std::sort(sorted.begin(), sorted.end());
+  size_t index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+bool method_from_name(const std::string &name, gravitysim::SimulationMethod &method) {
+  if (name == "cpu_pp") method = gravitysim::SimulationMethod::CPU_PARTICLE_PARTICLE;
+  else if (name == "gpu_pp") method = gravitysim::SimulationMethod::GPU_PARTICLE_PARTICLE;
+  else if (name == "barnes_hut") method = gravitysim::SimulationMethod::CPU_BARNES_HUT;
+  else return false;
+  return true;
+}
+
+Result run(const std::string &method_name, size_t n, size_t threads, const Options &options) {
+  gravitysim::SimulationMethod method;
+  method_from_name(method_name, method);
+  gravitysim::InitialConditions ics = make_plummer(n, 12345);
+  gravitysim::reset_memory_peaks();
+  gravitysim::Simulation simulation(std::move(ics.masses), std::move(ics.positions), std::move(ics.vels), 1e-3f);
+  simulation.set_threads(threads);
+  simulation.set_G(1.0f);
+  simulation.set_softening(0.01f);
+  simulation.set_integrator(gravitysim::Integrator::LEAPFROG);
+  simulation.switch_method(method);
+
+  bool check_energy = n <= options.energy_max_n;
+  double initial_energy = check_energy ? double(simulation.get_KE()) + simulation.get_PE() : 0.0;
+
+  // one untimed step pays for first-touch allocations
+  simulation.step();
+  std::vector<double> step_seconds;
+  double total = 0.0;
+  while (step_seconds.size() < options.steps && (step_seconds.empty() || total < options.max_seconds)) {
+    auto start = std::chrono::steady_clock::now();
+    simulation.step();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    step_seconds.push_back(seconds);
+    total += seconds;
+  }
+
+  Result result;
+  result.method = method_name;
+  result.n = n;
+  result.threads = threads;
+  result.steps = step_seconds.size();
+  // leapfrog evaluates the forces once per substep, ten substeps per step
+  double pairs = double(n) * double(simulation.get_num_massive()) * 10.0 * step_seconds.size();
+  result.interactions_per_second = pairs / total;
+  result.p50_ms = 1e3 * percentile(step_seconds, 0.50);
+  result.p90_ms = 1e3 * percentile(step_seconds, 0.90);
+  result.p99_ms = 1e3 * percentile(step_seconds, 0.99);
+  result.peak_rss_bytes = peak_rss_bytes();
+  for (size_t s = 0; s < gravitysim::NUM_MEMORY_SUBSYSTEMS; s++) {
+    result.subsystem_peak_bytes[s] = gravitysim::memory_usage(static_cast<gravitysim::MemorySubsystem>(s)).peak;
+  }
+  result.tracked_peak_bytes = gravitysim::total_memory_usage().peak;
+  if (check_energy) {
+    double energy = double(simulation.get_KE()) + simulation.get_PE();
+    result.energy_error = std::abs((energy - initial_energy) / initial_energy);
+  }
+  return result;
+}
+
+void write_json(std::ostream &out, const std::vector<Result> &results) {
+  std::time_t now = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+  out << std::setprecision(9);
+  out << "{\n  \"host\": {\"name\": " << json_string(host_name()) << ", \"cpu\": " << json_string(cpu_model())
+      << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"compiler\": "
+      << json_string(compiler()) << ", \"date\": " << json_string(date) << "},\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    // one result per line, which is what read_baseline expects
+    out << "    {\"method\": " << json_string(r.method) << ", \"n\": " << r.n << ", \"threads\": " << r.threads
+        << ", \"steps\": " << r.steps << ", \"interactions_per_second\": " << r.interactions_per_second
+        << ", \"step_ms_p50\": " << r.p50_ms << ", \"step_ms_p90\": " << r.p90_ms << ", \"step_ms_p99\": " << r.p99_ms
+        << ", \"peak_rss_bytes\": " << r.peak_rss_bytes << ", \"energy_error\": ";
+    if (r.energy_error) out << *r.energy_error;
+    else out << "null";
+    out << ", \"tracked_peak_bytes\": " << r.tracked_peak_bytes << ", \"subsystem_peak_bytes\": {";
+    for (size_t s = 0; s < gravitysim::NUM_MEMORY_SUBSYSTEMS; s++) {
+      out << (s > 0 ? ", " : "")
+          << json_string(gravitysim::memory_subsystem_name(static_cast<gravitysim::MemorySubsystem>(s))) << ": "
+          << r.subsystem_peak_bytes[s];
+    }
+    out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+// value of "key": in a result line, as text
+std::string field(const std::string &line, const std::string &key) {
+  size_t at = line.find("\"" + key + "\":");
+  if (at == std::string::npos) return {};
+  at = line.find_first_not_of(' ', at + key.size() + 3);
+  size_t end = line.find_first_of(",}", at);
+  std::string value = line.substr(at, end - at);
+  if (!value.empty() && value.front() == '"') value = value.substr(1, value.size() - 2);
+  return value;
+}
+
+// interactions per second of each method, n and threads in a file written by write_json
+std::map<std::string, double> read_baseline(const std::string &path) {
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  for (std::string line; std::getline(file, line);) {
+    std::string rate = field(line, "interactions_per_second");
+    if (rate.empty()) continue;
+    baseline[field(line, "method") + "/" + field(line, "n") + "/" + field(line, "threads")] = std::stod(rate);
+  }
+  return baseline;
+}
+
+template <class T, class Parse>
+std::vector<T> parse_list(const std::string &text, Parse parse) {
+  std::vector<T> values;
+  std::stringstream stream(text);
+  for (std::string item; std::getline(stream, item, ',');) values.push_back(parse(item));
+  return values;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (size_t t = 1; t <= std::max(1u, std::thread::hardware_concurrency()); t *= 2) options.threads.push_back(t);
+
+  for (int a = 1; a + 1 < argc; a += 2) {
+    std::string key = argv[a], value = argv[a + 1];
+    auto to_size = [](const std::string &s) { return static_cast<size_t>(std::stod(s)); };
+    if (key == "--n") options.ns = parse_list<size_t>(value, to_size);
+    else if (key == "--threads") options.threads = parse_list<size_t>(value, to_size);
+    else if (key == "--methods") options.methods = parse_list<std::string>(value, [](const std::string &s) { return s; });
+    else if (key == "--steps") options.steps = std::max<size_t>(1, to_size(value));
+    else if (key == "--max-seconds") options.max_seconds = std::stod(value);
+    else if (key == "--energy-max-n") options.energy_max_n = to_size(value);
+    else if (key == "--out") options.out = value;
+    else if (key == "--baseline") options.baseline = value;
+    else if (key == "--tolerance") options.tolerance = std::stod(value);
+    else {
+      std::cerr << "unknown option " << key << "\n";
+      return 2;
+    }
+  }
+  gravitysim::SimulationMethod unused;
+  for (const auto &method : options.methods) {
+    if (!method_from_name(method, unused)) {
+      std::cerr << "unknown method " << method << "\n";
+      return 2;
+    }
+    if (unused == gravitysim::SimulationMethod::GPU_PARTICLE_PARTICLE && !gravitysim::gpu_method_available()) {
+      std::cerr << "gpu_pp needs a build with CUDA\n";
+      return 2;
+    }
+  }
+  std::sort(options.ns.begin(), options.ns.end());
+
+  std::vector<Result> results;
+  for (const auto &method : options.methods) {
+    for (size_t threads : options.threads) {
+      std::optional<Result> previous;
+      for (size_t n : options.ns) {
+        // predict from the last N how long a step would take here
+        if (previous) {
+          double ratio = double(n) / previous->n;
+          double growth = method == "barnes_hut" ? ratio * std::log2(double(n)) / std::log2(double(previous->n))
+                                                 : ratio * ratio;
+          if (previous->p50_ms * 1e-3 * growth > options.max_seconds) {
+            std::cerr << "skipping " << method << " n=" << n << " threads=" << threads << ", predicted step over "
+                      << options.max_seconds << " s\n";
+            continue;
+          }
+        }
+        Result result = run(method, n, threads, options);
+        std::cerr << method << " n=" << n << " threads=" << threads << ": " << result.interactions_per_second / 1e9
+                  << " G interactions/s, p50 " << result.p50_ms << " ms\n";
+        results.push_back(result);
+        previous = result;
+      }
+    }
+  }
+
+  std::ofstream out(options.out, std::ios::trunc);
+  write_json(out, results);
+  if (!out) {
+    std::cerr << "cannot write " << options.out << "\n";
+    return 2;
+  }
+
+  if (options.baseline.empty()) return 0;
+  std::map<std::string, double> baseline = read_baseline(options.baseline);
+  size_t regressions = 0, compared = 0;
+  std::cout << std::left << std::setw(12) << "method" << std::setw(10) << "n" << std::setw(9) << "threads"
+            << std::setw(12) << "vs baseline" << "\n";
+  for (const Result &r : results) {
+    auto it = baseline.find(r.method + "/" + std::to_string(r.n) + "/" + std::to_string(r.threads));
+    if (it == baseline.end() || it->second <= 0.0) continue;
+    double ratio = r.interactions_per_second / it->second;
+    bool regressed = ratio < 1.0 - options.tolerance;
+    compared++;
+    regressions += regressed;
+    std::cout << std::setw(12) << r.method << std::setw(10) << r.n << std::setw(9) << r.threads << std::fixed
+              << std::setprecision(3) << ratio << (regressed ? "  REGRESSION" : "") << "\n";
+    std::cout.unsetf(std::ios::fixed);
+  }
+  std::cout << compared << " compared with " << options.baseline << ", " << regressions << " regressed by more than "
+            << 100.0 * options.tolerance << "%\n";
+  return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "memory_tracker.hpp"
+
+namespace gravitysim {
+
+// Bump allocator for scratch memory that lives at most one step. Allocation
+// is an atomic add on a single block, so threads can allocate concurrently,
+// and nothing is freed individually. When a step needs more than the block
+// holds, the extra comes from overflow blocks, and the next reset replaces
+// everything with one block big enough for the whole step, so after the first
+// few steps a step makes no calls to the system allocator. Blocks are counted
+// as MemorySubsystem::SCRATCH.
+class Arena {
+  std::unique_ptr<std::byte[]> block;
+  size_t capacity = 0;
+  std::atomic<size_t> offset = 0;
+
+  // allocations that did not fit in block since the last reset
+  std::mutex overflow_mutex;
+  std::vector<std::unique_ptr<std::byte[]>> overflow;
+  size_t overflow_bytes = 0;
+
+  // most bytes requested between two resets
+  size_t high_water = 0;
+
+  void *allocate_overflow(size_t bytes, size_t align);
+
+public:
+  explicit Arena(size_t initial_capacity = 0);
+  ~Arena();
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // bytes aligned to align, a power of two, valid until the next reset
+  inline void *allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    size_t padded = bytes + align - 1;
+    size_t begin = offset.fetch_add(padded, std::memory_order_relaxed);
+    if (begin + padded > capacity) return allocate_overflow(bytes, align);
+    auto address = reinterpret_cast<uintptr_t>(block.get()) + begin;
+    return reinterpret_cast<void *>((address + align - 1) & ~(uintptr_t(align) - 1));
+  }
+
+  // n default initialized elements
+  template <class T>
+  std::span<T> allocate_array(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena memory is never destroyed");
+    T *p = static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+    for (size_t i = 0; i < n; i++) new (p + i) T;
+    return {p, n};
+  }
+
+  // frees everything, growing the block to the most any step has used
+  void reset();
+
+  inline size_t used() const { return offset.load(std::memory_order_relaxed); }
+  inline size_t get_capacity() const { return capacity; }
+  inline size_t get_high_water() const { return high_water; }
+
+  // rewinds the arena to where it was when the scope was opened, so
+  // scratch that is repeated within a step reuses the same memory
+  // only for use by one thread while nothing else allocates
+  class Scope {
+    Arena &arena;
+    size_t mark;
+
+  public:
+    explicit Scope(Arena &arena) : arena(arena), mark(arena.used()) {}
+    ~Scope() {
+      if (arena.used() <= arena.capacity) arena.offset.store(mark, std::memory_order_relaxed);
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+  };
+};
+
+} // namespace gravitysim
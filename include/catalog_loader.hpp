@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "simulation.hpp"
+#include "thread_pool.hpp"
+
+namespace gravitysim {
+
+// bodies in the form the Simulation constructor takes them
+struct InitialConditions {
+  std::vector<float> masses;
+  std::vector<vec3f> positions;
+  std::vector<vec3f> vels;
+};
+
+// Text catalogs with one body per line: mass, x, y, z, vx, vy, vz, separated
+// by commas, semicolons or whitespace. Blank lines, lines starting with '#'
+// and a header on the first line are skipped, and columns past the seventh
+// are ignored. The text is split at newlines into pieces parsed concurrently
+// with std::from_chars: a first pass counts the rows of each piece so the
+// second can write every body straight into its final slot.
+
+// parses a catalog held in memory, on failure error_line is set to the first
+// malformed line (1-based) and ics is left empty
+bool parse_catalog(std::string_view text, InitialConditions &ics, size_t *error_line = nullptr,
+                   ThreadPool &pool = default_thread_pool());
+// maps the file into memory and parses it, error_line is 0 if the file could not be opened
+bool load_catalog(const std::string &path, InitialConditions &ics, size_t *error_line = nullptr,
+                  ThreadPool &pool = default_thread_pool());
+
+} // namespace gravitysim
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "DirectXMath.h"
+
+namespace gravitysim {
+
+// Many independent systems of the same body count stepped together. Systems
+// are packed four to an XMVECTOR, so each SIMD lane follows a different system
+// and the pairwise loop over a system's few bodies runs at full lane width.
+// Each group of four systems is stored contiguously as body-major x, y, z
+// lanes, and groups are stepped in parallel.
+class Ensemble {
+public:
+  static constexpr size_t LANES = 4;
+
+private:
+  size_t num_systems = 0;
+  size_t num_bodies = 0;
+  size_t num_groups = 0;
+  float time_step = 1.0f;
+  float G = 6.6743e-11f;
+
+  // lane k of element (g * num_bodies + b) * 3 + c is component c of body b in system g * LANES + k
+  std::vector<DirectX::XMVECTOR> positions;
+  std::vector<DirectX::XMVECTOR> vels;
+  std::vector<DirectX::XMVECTOR> accs;
+  // lane k of element g * num_bodies + b is the mass of body b in system g * LANES + k
+  std::vector<DirectX::XMVECTOR> masses;
+
+  inline size_t component(size_t system, size_t body, size_t c) const {
+    return ((system / LANES * num_bodies) + body) * 3 + c;
+  }
+
+  // accelerations of every body in group g
+  void calc_accs(size_t g);
+
+public:
+  Ensemble(size_t num_systems, size_t num_bodies, float time_step);
+
+  void set_G(float G);
+  void set_body(size_t system, size_t body, float mass, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 vel);
+
+  DirectX::XMFLOAT3 get_position(size_t system, size_t body) const;
+  DirectX::XMFLOAT3 get_vel(size_t system, size_t body) const;
+  // kinetic plus potential energy of one system
+  double get_energy(size_t system) const;
+  inline size_t get_num_systems() const { return num_systems; }
+  inline size_t get_num_bodies() const { return num_bodies; }
+
+  // advances every system by num_steps leapfrog steps of time_step
+  void step(size_t num_steps = 1);
+};
+
+} // namespace gravitysim
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+namespace gravitysim {
+
+// Timeline of begin and end events per thread, written out as Chrome trace
+// event JSON for chrome://tracing or Perfetto. Every thread records into its
+// own buffer without locking, the buffers are read on demand while recording
+// goes on. Names and categories are stored as pointers, so they must be string
+// literals or otherwise outlive the trace. Buffers are kept until exit.
+
+// turns recording on or off for every thread, off by default
+void set_tracing(bool enabled);
+bool tracing_enabled();
+
+void trace_begin(const char *name, const char *category);
+void trace_end(const char *name, const char *category);
+// names the calling thread in the trace, unnamed threads show up as "thread k"
+void set_trace_thread_name(const std::string &name);
+
+// drops the events recorded so far
+void clear_trace();
+// events recorded since the last clear, events still open have no end yet
+void write_chrome_trace(std::ostream &out);
+bool write_chrome_trace(const std::string &path);
+
+// records a begin and end event around its lifetime if tracing was on when it started
+class TraceScope {
+  const char *name;
+  const char *category;
+  bool active;
+
+public:
+  inline TraceScope(const char *name, const char *category)
+      : name(name), category(category), active(tracing_enabled()) {
+    if (active) trace_begin(name, category);
+  }
+  inline ~TraceScope() {
+    if (active) trace_end(name, category);
+  }
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+};
+
+} // namespace gravitysim
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "integrators.hpp"
+
+namespace gravitysim {
+
+// Tabulated Ewald correction for a periodic unit box. The periodic
+// acceleration towards a unit mass at separation d (minimum image, each
+// component in [-0.5, 0.5]) is d / |d|^3 + correction(d), where the correction
+// sums the real and reciprocal space terms of every other image plus the
+// neutralizing background (Hernquist, Bouchet & Suto 1991). The correction is
+// odd in each component, so only the positive octant is stored.
+class EwaldTable {
+public:
+  // grid cells per axis over [0, 0.5]
+  static constexpr uint32_t CELLS = 32;
+
+private:
+  // (CELLS + 1)^3 samples, x fastest
+  std::vector<DirectX::XMFLOAT3> table;
+
+  inline const DirectX::XMFLOAT3 &at(uint32_t x, uint32_t y, uint32_t z) const {
+    return table[(z * (CELLS + 1) + y) * (CELLS + 1) + x];
+  }
+
+public:
+  // fills the table in double precision, only needed once
+  void build();
+  inline bool empty() const { return table.empty(); }
+
+  // trilinear interpolation of the correction at a minimum image separation in unit box lengths
+  DirectX::XMVECTOR correction(DirectX::FXMVECTOR d) const;
+};
+
+// correction at separation d in a unit box from the full Ewald sums in double precision
+dvec3 ewald_correction(const dvec3 &d);
+
+} // namespace gravitysim
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+
+#include "DirectXMath.h"
+#include "thread_pool.hpp"
+
+namespace gravitysim {
+
+// Analytic potentials evaluated per body in place of live particles. Each
+// policy provides acc(r) and potential(r) at a position r relative to its
+// center, with G folded into its mu or velocity parameters.
+
+// Kepler potential of a point mass, -mu / r
+struct PointMassPotential {
+  float mu = 1.0f;
+  DirectX::XMFLOAT3 center = {0.0f, 0.0f, 0.0f};
+
+  inline DirectX::XMVECTOR acc(DirectX::FXMVECTOR r) const {
+    float r2 = DirectX::XMVectorGetX(DirectX::XMVector3Dot(r, r));
+    return (-mu / (r2 * std::sqrt(r2))) * r;
+  }
+  inline float potential(DirectX::FXMVECTOR r) const {
+    return -mu / DirectX::XMVectorGetX(DirectX::XMVector3Length(r));
+  }
+};
+
+// Navarro-Frenk-White halo, -mu ln(1 + r / scale_radius) / r
+// mu = 4 pi G rho_0 scale_radius^3
+struct NFWPotential {
+  float mu = 1.0f;
+  float scale_radius = 1.0f;
+  DirectX::XMFLOAT3 center = {0.0f, 0.0f, 0.0f};
+
+  inline DirectX::XMVECTOR acc(DirectX::FXMVECTOR r) const {
+    float dist = DirectX::XMVectorGetX(DirectX::XMVector3Length(r));
+    float enclosed = std::log1p(dist / scale_radius) - dist / (dist + scale_radius);
+    return (-mu * enclosed / (dist * dist * dist)) * r;
+  }
+  inline float potential(DirectX::FXMVECTOR r) const {
+    float dist = DirectX::XMVectorGetX(DirectX::XMVector3Length(r));
+    return -mu * std::log1p(dist / scale_radius) / dist;
+  }
+};
+
+// Miyamoto-Nagai disk in the xy plane, -mu / sqrt(R^2 + (a + sqrt(z^2 + b^2))^2)
+struct MiyamotoNagaiPotential {
+  float mu = 1.0f;
+  // scale length and scale height
+  float a = 1.0f;
+  float b = 0.1f;
+  DirectX::XMFLOAT3 center = {0.0f, 0.0f, 0.0f};
+
+  inline DirectX::XMVECTOR acc(DirectX::FXMVECTOR r) const {
+    DirectX::XMFLOAT3 p;
+    DirectX::XMStoreFloat3(&p, r);
+    float zeta = std::sqrt(p.z * p.z + b * b);
+    float az = a + zeta;
+    float d2 = p.x * p.x + p.y * p.y + az * az;
+    float scale = -mu / (d2 * std::sqrt(d2));
+    return scale * DirectX::XMVectorSet(p.x, p.y, p.z * az / zeta, 0.0f);
+  }
+  inline float potential(DirectX::FXMVECTOR r) const {
+    DirectX::XMFLOAT3 p;
+    DirectX::XMStoreFloat3(&p, r);
+    float az = a + std::sqrt(p.z * p.z + b * b);
+    return -mu / std::sqrt(p.x * p.x + p.y * p.y + az * az);
+  }
+};
+
+// logarithmic halo flattened along z, v0^2 / 2 ln(core_radius^2 + x^2 + y^2 + z^2 / q^2)
+// v0 is the asymptotic circular velocity
+struct LogarithmicPotential {
+  float v0 = 1.0f;
+  float core_radius = 1.0f;
+  float q = 1.0f;
+  DirectX::XMFLOAT3 center = {0.0f, 0.0f, 0.0f};
+
+  inline DirectX::XMVECTOR acc(DirectX::FXMVECTOR r) const {
+    DirectX::XMVECTOR flattened = r * DirectX::XMVectorSet(1.0f, 1.0f, 1.0f / (q * q), 0.0f);
+    float m2 = core_radius * core_radius + DirectX::XMVectorGetX(DirectX::XMVector3Dot(r, flattened));
+    return (-v0 * v0 / m2) * flattened;
+  }
+  inline float potential(DirectX::FXMVECTOR r) const {
+    DirectX::XMVECTOR flattened = r * DirectX::XMVectorSet(1.0f, 1.0f, 1.0f / (q * q), 0.0f);
+    float m2 = core_radius * core_radius + DirectX::XMVectorGetX(DirectX::XMVector3Dot(r, flattened));
+    return 0.5f * v0 * v0 * std::log(m2);
+  }
+};
+
+// type erased so a simulation can hold any mix of potentials, the per body
+// loop is instantiated for each policy so its acc() inlines
+class ExternalField {
+public:
+  virtual ~ExternalField() = default;
+  // adds the field's acceleration at each position to accs
+  virtual void add_accs(std::span<const DirectX::XMVECTOR> positions, std::span<DirectX::XMVECTOR> accs,
+                        ThreadPool &pool) const = 0;
+  // sum of mass * potential over the bodies
+  virtual float potential_energy(std::span<const DirectX::XMFLOAT3> positions, std::span<const float> masses) const = 0;
+};
+
+template <class Potential>
+class ExternalPotentialField : public ExternalField {
+  Potential potential;
+
+public:
+  explicit ExternalPotentialField(const Potential &potential) : potential(potential) {}
+
+  void add_accs(std::span<const DirectX::XMVECTOR> positions, std::span<DirectX::XMVECTOR> accs,
+                ThreadPool &pool) const override {
+    DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&potential.center);
+    pool.for_each(accs.begin(), accs.end(),
+      [&](DirectX::XMVECTOR &acc) {
+        size_t i = &acc - accs.data();
+        acc += potential.acc(positions[i] - center);
+      }
+    );
+  }
+
+  float potential_energy(std::span<const DirectX::XMFLOAT3> positions, std::span<const float> masses) const override {
+    DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&potential.center);
+    float energy = 0.0f;
+    for (size_t i = 0; i < positions.size(); i++) {
+      energy += masses[i] * potential.potential(DirectX::XMLoadFloat3(&positions[i]) - center);
+    }
+    return energy;
+  }
+};
+
+} // namespace gravitysim
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "catalog_loader.hpp"
+#include "simulation.hpp"
+
+namespace gravitysim {
+
+constexpr size_t GADGET_TYPES = 6;
+
+// the 256 byte HEAD block of a GADGET snapshot
+struct GadgetHeader {
+  std::array<uint32_t, GADGET_TYPES> npart = {};
+  // mass of every particle of a type, 0 if the masses are in the MASS block
+  std::array<double, GADGET_TYPES> mass = {};
+  double time = 0.0;
+  double redshift = 0.0;
+  int32_t flag_sfr = 0;
+  int32_t flag_feedback = 0;
+  std::array<uint32_t, GADGET_TYPES> npart_total = {};
+  int32_t flag_cooling = 0;
+  int32_t num_files = 1;
+  double box_size = 0.0;
+  double omega0 = 0.0;
+  double omega_lambda = 0.0;
+  double hubble_param = 1.0;
+  int32_t flag_stellarage = 0;
+  int32_t flag_metals = 0;
+  std::array<uint32_t, GADGET_TYPES> npart_total_high_word = {};
+  int32_t flag_entropy_instead_u = 0;
+};
+
+// GADGET format-2 snapshots, where every block is preceded by a small block
+// holding its four character label, as written by GADGET-2/3, SWIFT and
+// most IC generators. Only single-file snapshots are read. The POS, VEL, ID
+// and MASS blocks are read, anything else (gas properties and so on) is
+// skipped. Blocks are streamed straight into the InitialConditions arrays,
+// single or double precision values and 32 or 64 bit ids are told apart by
+// the block size. Values are copied as they are, without unit conversion.
+
+// reads the particle types set in type_mask (bit t for type t) as bodies,
+// ordered by type as in the file
+bool read_gadget(const std::string &path, InitialConditions &ics, std::vector<uint32_t> *ids = nullptr,
+                 GadgetHeader *header = nullptr, uint32_t type_mask = (1 << GADGET_TYPES) - 1);
+
+// writes every body as particles of one type, type 1 being dark matter, with
+// a MASS block unless all masses are equal
+bool write_gadget(const std::string &path, Simulation &simulation, double time = 0.0, uint32_t type = 1);
+
+} // namespace gravitysim
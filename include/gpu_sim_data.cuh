@@ -1,12 +1,58 @@
 #pragma once
 
+#include "memory_tracker.hpp"
+
+#ifdef GRAVITYSIM_NO_CUDA
+
+// built without CUDA, the GPU method runs on the host over the same layout
+struct float3 {
+  float x, y, z;
+};
+
+template <class T>
+using TrackedDeviceVector = gravitysim::TrackedVector<T, gravitysim::MemorySubsystem::GPU_MIRROR>;
+
+#else
+
 #include <cuda_runtime.h>
 #include <thrust/device_vector.h>
 
+// device allocator that counts its bytes as MemorySubsystem::GPU_MIRROR
+template <class T>
+struct TrackedDeviceAllocator : thrust::device_allocator<T> {
+  using base = thrust::device_allocator<T>;
+  using pointer = typename base::pointer;
+  using size_type = typename base::size_type;
+
+  template <class U>
+  struct rebind {
+    using other = TrackedDeviceAllocator<U>;
+  };
+
+  TrackedDeviceAllocator() = default;
+  template <class U>
+  TrackedDeviceAllocator(const TrackedDeviceAllocator<U> &) {}
+
+  pointer allocate(size_type n) {
+    pointer p = base::allocate(n);
+    gravitysim::track_allocation(gravitysim::MemorySubsystem::GPU_MIRROR, n * sizeof(T));
+    return p;
+  }
+  void deallocate(pointer p, size_type n) {
+    gravitysim::track_deallocation(gravitysim::MemorySubsystem::GPU_MIRROR, n * sizeof(T));
+    base::deallocate(p, n);
+  }
+};
+
+template <class T>
+using TrackedDeviceVector = thrust::device_vector<T, TrackedDeviceAllocator<T>>;
+
+#endif
+
 // holds data for gpu simulation
 struct GPUSimData {
-  thrust::device_vector<float> mus;
-  thrust::device_vector<float3> positions;
-  thrust::device_vector<float3> vels;
-  thrust::device_vector<float3> accs;
+  TrackedDeviceVector<float> mus;
+  TrackedDeviceVector<float3> positions;
+  TrackedDeviceVector<float3> vels;
+  TrackedDeviceVector<float3> accs;
 };
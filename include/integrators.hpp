@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "memory_tracker.hpp"
+
+namespace gravitysim {
+
+// state the integrators keep between steps, counted as MemorySubsystem::INTEGRATOR
+template <class T>
+using IntegratorArray = TrackedVector<T, MemorySubsystem::INTEGRATOR>;
+
+// time integration scheme used by the CPU simulation methods
+enum class Integrator : int {
+  // first order, kick then drift
+  EULER_CROMER,
+  // fourth order predictor-corrector using accelerations and jerks
+  HERMITE,
+  // second order symplectic drift-kick-drift
+  LEAPFROG,
+  // fourth order symplectic, leapfrog composed as a triple jump
+  YOSHIDA4,
+  // sixth order symplectic, seven leapfrog stages
+  YOSHIDA6,
+  // Kepler drifts about the most massive body with interaction kicks,
+  // in democratic heliocentric coordinates
+  WISDOM_HOLMAN,
+  // 15th order Gauss-Radau with adaptive substeps, time_step is only the output interval
+  IAS15,
+};
+
+// Symplectic schemes built by composing leapfrog substeps of weights[k] * dt.
+// Adjacent half drifts of consecutive substeps are merged, so a scheme with s
+// weights costs s force evaluations and s + 1 drifts per step.
+template <class Scheme>
+struct Composition {
+  static constexpr size_t stages = Scheme::weights.size();
+
+  static constexpr std::array<float, stages> kicks = [] {
+    std::array<float, stages> k{};
+    for (size_t i = 0; i < stages; i++) k[i] = static_cast<float>(Scheme::weights[i]);
+    return k;
+  }();
+
+  static constexpr std::array<float, stages + 1> drifts = [] {
+    std::array<float, stages + 1> d{};
+    for (size_t i = 0; i <= stages; i++) {
+      double before = i > 0 ? Scheme::weights[i - 1] : 0.0;
+      double after = i < stages ? Scheme::weights[i] : 0.0;
+      d[i] = static_cast<float>((before + after) / 2.0);
+    }
+    return d;
+  }();
+};
+
+struct LeapfrogScheme {
+  static constexpr std::array<double, 1> weights = {1.0};
+};
+
+// Yoshida 1990 triple jump, the same coefficients as Forest-Ruth
+struct Yoshida4Scheme {
+  static constexpr double w1 = 1.3512071919596578;  // 1 / (2 - 2^(1/3))
+  static constexpr double w0 = -1.7024143839193153; // -2^(1/3) / (2 - 2^(1/3))
+  static constexpr std::array<double, 3> weights = {w1, w0, w1};
+};
+
+// Yoshida 1990 solution A
+struct Yoshida6Scheme {
+  static constexpr double w1 = -1.17767998417887;
+  static constexpr double w2 = 0.235573213359357;
+  static constexpr double w3 = 0.784513610477560;
+  static constexpr double w0 = 1.0 - 2.0 * (w1 + w2 + w3);
+  static constexpr std::array<double, 7> weights = {w3, w2, w1, w0, w1, w2, w3};
+};
+
+// state carried between Hermite steps
+struct HermiteData {
+  // jerk (time derivative of acceleration) of each body
+  IntegratorArray<DirectX::XMVECTOR> jerks;
+
+  // state at the start of the step, needed by the corrector
+  IntegratorArray<DirectX::XMVECTOR> old_positions;
+  IntegratorArray<DirectX::XMVECTOR> old_vels;
+  // swapped with the accs of the SIMD mirror every step, so counted with it
+  TrackedVector<DirectX::XMVECTOR, MemorySubsystem::SIMD_MIRROR> old_accs;
+  IntegratorArray<DirectX::XMVECTOR> old_jerks;
+
+  // accs and jerks match the current positions and vels
+  bool valid = false;
+};
+
+// double precision vector for integrators that need more than float
+struct dvec3 {
+  double x, y, z;
+
+  inline dvec3 &operator+=(const dvec3 &o) { x += o.x; y += o.y; z += o.z; return *this; }
+  inline dvec3 &operator-=(const dvec3 &o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+};
+
+inline dvec3 operator+(dvec3 a, const dvec3 &b) { return a += b; }
+inline dvec3 operator-(dvec3 a, const dvec3 &b) { return a -= b; }
+inline dvec3 operator*(double s, const dvec3 &a) { return {s * a.x, s * a.y, s * a.z}; }
+inline double dot(const dvec3 &a, const dvec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+// state carried between Wisdom-Holman steps, in double precision
+struct WisdomHolmanData {
+  // most massive body, the Kepler drifts are about it
+  size_t central = 0;
+
+  // heliocentric positions and barycentric velocities, unused for the central body
+  IntegratorArray<dvec3> positions;
+  IntegratorArray<dvec3> vels;
+
+  dvec3 com_position;
+  dvec3 com_vel;
+
+  // positions and vels match simd_data
+  bool valid = false;
+};
+
+// state carried between IAS15 substeps, in double precision
+struct IAS15Data {
+  // relative error tolerance of the b6 coefficient
+  double epsilon = 1e-9;
+  // substep to try next, chosen by the error estimate
+  double dt = 0.0;
+  // last accepted substep, 0 before the first one
+  double dt_last = 0.0;
+
+  // state at the start of the substep, with compensated summation residuals
+  IntegratorArray<dvec3> positions;
+  IntegratorArray<dvec3> vels;
+  IntegratorArray<dvec3> comp_positions;
+  IntegratorArray<dvec3> comp_vels;
+
+  // accelerations at the start of the substep and at the current node
+  IntegratorArray<dvec3> accs0;
+  IntegratorArray<dvec3> accs;
+  // positions predicted at the current node
+  IntegratorArray<dvec3> predicted;
+
+  // divided differences, polynomial coefficients and their predictions
+  std::array<IntegratorArray<dvec3>, 7> g;
+  std::array<IntegratorArray<dvec3>, 7> b;
+  std::array<IntegratorArray<dvec3>, 7> e;
+
+  // positions and vels match simd_data
+  bool valid = false;
+};
+
+// advances r and v along a Kepler orbit about a fixed mu for dt,
+// using universal variables so any eccentricity works
+void kepler_drift(double mu, dvec3 &r, dvec3 &v, double dt);
+
+} // namespace gravitysim
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace gravitysim {
+
+// owners of tracked memory, summed over every Simulation in the process
+enum class MemorySubsystem : int {
+  // per-body arrays of Simulation: masses, mus, ids, radii and the AoS kinematics
+  BODIES,
+  SIMD_MIRROR,
+  // device memory of the GPU method
+  GPU_MIRROR,
+  // octree and collision spatial hash
+  TREE,
+  // state kept between steps by the Hermite, Wisdom-Holman and IAS15 integrators
+  INTEGRATOR,
+  // step arenas
+  SCRATCH,
+  // encode buffers of snapshot, GADGET and trajectory writers
+  OUTPUT,
+  COUNT,
+};
+
+constexpr size_t NUM_MEMORY_SUBSYSTEMS = static_cast<size_t>(MemorySubsystem::COUNT);
+
+struct MemoryUsage {
+  size_t current = 0;
+  size_t peak = 0;
+};
+
+const char *memory_subsystem_name(MemorySubsystem subsystem);
+
+// lock free, callable from any thread
+void track_allocation(MemorySubsystem subsystem, size_t bytes);
+void track_deallocation(MemorySubsystem subsystem, size_t bytes);
+
+MemoryUsage memory_usage(MemorySubsystem subsystem);
+// current bytes over every subsystem, and the most that was ever allocated at once
+MemoryUsage total_memory_usage();
+// starts every peak again from the current bytes, e.g. between benchmark runs
+void reset_memory_peaks();
+// current and peak MiB per subsystem and in total
+void write_memory_report(std::ostream &out);
+
+// std::allocator that counts its bytes against a subsystem
+template <class T, MemorySubsystem S>
+struct TrackedAllocator {
+  using value_type = T;
+
+  template <class U>
+  struct rebind {
+    using other = TrackedAllocator<U, S>;
+  };
+
+  TrackedAllocator() = default;
+  template <class U>
+  TrackedAllocator(const TrackedAllocator<U, S> &) {}
+
+  inline T *allocate(size_t n) {
+    T *p = std::allocator<T>().allocate(n);
+    track_allocation(S, n * sizeof(T));
+    return p;
+  }
+  inline void deallocate(T *p, size_t n) {
+    track_deallocation(S, n * sizeof(T));
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <class U>
+  bool operator==(const TrackedAllocator<U, S> &) const { return true; }
+};
+
+template <class T, MemorySubsystem S>
+using TrackedVector = std::vector<T, TrackedAllocator<T, S>>;
+
+// buffers of output writers, counted as MemorySubsystem::OUTPUT
+template <class T>
+using OutputArray = TrackedVector<T, MemorySubsystem::OUTPUT>;
+
+// element-wise comparison with untracked vectors
+template <class T, MemorySubsystem S>
+bool operator==(const TrackedVector<T, S> &a, const std::vector<T> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end());
+}
+
+} // namespace gravitysim
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "memory_tracker.hpp"
+#include "thread_pool.hpp"
+
+namespace gravitysim {
+
+// arrays of spatial indexes, counted as MemorySubsystem::TREE
+template <class T>
+using TreeArray = TrackedVector<T, MemorySubsystem::TREE>;
+
+struct OctreeNode {
+  // range [begin, end) of bodies in Morton order covered by this node
+  uint32_t begin = 0;
+  uint32_t end = 0;
+  // children are stored contiguously starting at first_child, leaves have none
+  uint32_t first_child = 0;
+  uint32_t num_children = 0;
+  uint32_t parent = 0;
+  uint32_t level = 0;
+
+  // geometric center and half width of the cell
+  DirectX::XMFLOAT3 center = {};
+  float half_width = 0.0f;
+
+  // center of mass and total mu (G * mass) of the bodies in the cell
+  DirectX::XMFLOAT3 com = {};
+  float mu = 0.0f;
+
+  inline bool is_leaf() const { return num_children == 0; }
+  inline uint32_t count() const { return end - begin; }
+};
+
+// Pointer-free octree stored as a flat array of nodes in breadth-first order.
+// Built from bodies sorted by Morton key: each level is emitted in parallel by
+// having every body compare its key prefix with its neighbour's, so a new node
+// starts wherever the prefixes differ (as in Karras 2012). Children of a node
+// are contiguous in the next level, so the tree walks with child offsets only.
+class LinearOctree {
+public:
+  // 21 bits per axis fit in a 63 bit Morton key
+  static constexpr uint32_t MAX_LEVEL = 21;
+
+private:
+  TreeArray<OctreeNode> nodes;
+  // nodes of level l are [level_offsets[l], level_offsets[l + 1])
+  TreeArray<uint32_t> level_offsets;
+
+  // Morton order: sorted_index[k] is the original index of the kth body
+  TreeArray<uint64_t> keys;
+  TreeArray<uint32_t> sorted_index;
+  TreeArray<DirectX::XMVECTOR> sorted_positions;
+  TreeArray<float> sorted_mus;
+
+  // scratch for the build
+  TreeArray<uint64_t> key_scratch;
+  TreeArray<uint32_t> index_scratch;
+  TreeArray<uint32_t> body_node;
+  TreeArray<uint32_t> node_starts;
+  TreeArray<std::array<uint32_t, 256>> chunk_counts;
+
+  uint32_t leaf_capacity = 8;
+  // pool of the current build
+  ThreadPool *pool = nullptr;
+
+  // stable parallel LSD radix sort of keys, carrying sorted_index along
+  void radix_sort();
+  void emit_levels(DirectX::XMFLOAT3 min_corner, float cell_size);
+  void compute_mass_moments();
+  // walk for point p, skipping the body at Morton index self
+  DirectX::XMVECTOR walk(DirectX::XMVECTOR p, uint32_t self, float theta, float softening2) const;
+
+public:
+  LinearOctree() = default;
+  explicit LinearOctree(uint32_t leaf_capacity);
+
+  // rebuilds the tree over the given bodies, reusing allocations from earlier builds
+  void build(std::span<const DirectX::XMVECTOR> positions, std::span<const float> mus,
+             ThreadPool &workers = default_thread_pool());
+
+  // acceleration on the body at Morton index s from a monopole tree walk
+  // nodes whose size / distance is below theta are not opened
+  // softening2 is the square of the Plummer softening length
+  DirectX::XMVECTOR calc_acc(uint32_t s, float theta, float softening2 = 0.0f) const;
+  // acceleration at a point that is not one of the tree's bodies
+  DirectX::XMVECTOR calc_acc_at(DirectX::XMVECTOR p, float theta, float softening2 = 0.0f) const;
+
+  inline const TreeArray<OctreeNode> &get_nodes() const { return nodes; }
+  inline const TreeArray<uint32_t> &get_level_offsets() const { return level_offsets; }
+  inline const TreeArray<uint64_t> &get_keys() const { return keys; }
+  inline const TreeArray<uint32_t> &get_sorted_index() const { return sorted_index; }
+  inline size_t size() const { return sorted_index.size(); }
+};
+
+// interleaves the low 21 bits of x, y, z into a 63 bit key
+uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z);
+
+} // namespace gravitysim
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "event_trace.hpp"
+
+namespace gravitysim {
+
+// parts of Simulation::step() that are timed, STEP is the whole step
+// the integrator bookkeeping of Hermite, Wisdom-Holman and IAS15 is not a phase of its own
+// and shows up as the rest of STEP
+enum class StepPhase : int {
+  STEP,
+  TREE_BUILD,
+  FORCES,
+  // kicks and drifts
+  INTEGRATION,
+  BOUNDARIES,
+  COLLISIONS,
+  // fused force and update passes of the GPU method, including the wait for them
+  GPU,
+  COUNT,
+};
+
+enum class HardwareCounter : int {
+  CYCLES,
+  INSTRUCTIONS,
+  L1D_MISSES,
+  LLC_MISSES,
+  BRANCH_MISSES,
+  // packed FP arithmetic instructions on Intel, retired SSE/AVX FLOPs on AMD
+  VECTOR_FP,
+  COUNT,
+};
+
+constexpr size_t NUM_STEP_PHASES = static_cast<size_t>(StepPhase::COUNT);
+constexpr size_t NUM_HARDWARE_COUNTERS = static_cast<size_t>(HardwareCounter::COUNT);
+
+using CounterValues = std::array<uint64_t, NUM_HARDWARE_COUNTERS>;
+
+const char *step_phase_name(StepPhase phase);
+
+// Counters of every thread of the process from perf_event_open, user space only,
+// so they work with the default perf_event_paranoid of 2. Each thread gets one
+// group so all of its counters are scheduled together, counts are scaled up
+// when the kernel multiplexes groups. Threads started after open() are not
+// counted. Linux only, on other platforms nothing is available.
+class HardwareCounters {
+  // group fds of each thread, -1 where a counter could not be opened
+  std::vector<std::array<int, NUM_HARDWARE_COUNTERS>> fds;
+  std::array<bool, NUM_HARDWARE_COUNTERS> available{};
+
+public:
+  HardwareCounters() = default;
+  HardwareCounters(const HardwareCounters &) = delete;
+  HardwareCounters &operator=(const HardwareCounters &) = delete;
+  ~HardwareCounters() { close(); }
+
+  // opens the counters on every thread currently in the process, false if none could be opened
+  bool open();
+  void close();
+  inline bool is_available(HardwareCounter counter) const { return available[static_cast<size_t>(counter)]; }
+  inline bool any_available() const { return !fds.empty(); }
+  // running totals summed over threads, 0 for counters that are not available
+  void read(CounterValues &values) const;
+};
+
+struct PhaseStats {
+  uint64_t calls = 0;
+  double seconds = 0.0;
+  CounterValues counts{};
+};
+
+// wall time and optionally hardware counters accumulated per phase of step()
+class PhaseProfiler {
+  HardwareCounters counters;
+  bool hardware_counters = false;
+  std::array<PhaseStats, NUM_STEP_PHASES> phases{};
+
+public:
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    CounterValues counts;
+  };
+
+  explicit PhaseProfiler(bool hardware_counters);
+
+  // reopens the counters so they cover the threads started since, e.g. a new pool
+  void attach_counters();
+  inline bool has_counters() const { return hardware_counters && counters.any_available(); }
+  inline bool is_available(HardwareCounter counter) const {
+    return has_counters() && counters.is_available(counter);
+  }
+
+  void sample(Sample &s) const;
+  // adds the time and counts since start to phase
+  void add(StepPhase phase, const Sample &start);
+  inline const PhaseStats &get(StepPhase phase) const { return phases[static_cast<size_t>(phase)]; }
+  void reset();
+
+  // one row per phase that ran plus the rest of STEP, counts next to wall time
+  void report(std::ostream &out) const;
+};
+
+// times its lifetime into a phase if profiler is not null, and traces it if tracing is on
+class PhaseScope {
+  PhaseProfiler *profiler;
+  StepPhase phase;
+  PhaseProfiler::Sample start;
+  TraceScope trace;
+
+public:
+  inline PhaseScope(PhaseProfiler *profiler, StepPhase phase)
+      : profiler(profiler), phase(phase), trace(step_phase_name(phase), "step") {
+    if (profiler) profiler->sample(start);
+  }
+  inline ~PhaseScope() {
+    if (profiler) profiler->add(phase, start);
+  }
+  PhaseScope(const PhaseScope &) = delete;
+  PhaseScope &operator=(const PhaseScope &) = delete;
+};
+
+} // namespace gravitysim
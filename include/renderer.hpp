@@ -15,6 +15,7 @@
 
 #include "camera.hpp"
 #include "simulation.hpp"
+#include "simulation_runner.hpp"
 
 
 namespace gravitysim {
@@ -61,10 +62,12 @@ public:
     float body_scale = 1.0f;
     // temporary
     SimulationMethod method = SimulationMethod::CPU_PARTICLE_PARTICLE;
+    Integrator integrator = Integrator::EULER_CROMER;
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
   };
 
-  void RenderFrame(Camera &camera, RenderOptions &opts, Simulation &sim);
+  // draws the snapshot, UI actions on the simulation are submitted to runner
+  void RenderFrame(Camera &camera, RenderOptions &opts, const Snapshot &snapshot, SimulationRunner &runner);
 };
 
   
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "integrators.hpp"
+#include "simulation.hpp"
+
+namespace gravitysim {
+
+enum class InitialConditionFormat : int {
+  // guessed from the file extension, .csv/.txt for catalogs and anything else for GADGET
+  AUTO,
+  CATALOG,
+  GADGET,
+};
+
+enum class OutputFormat : int {
+  NONE,
+  // one chunked columnar snapshot per output
+  SNAPSHOT,
+  // one GADGET file per output
+  GADGET,
+  // every output appended to one compressed trajectory file
+  TRAJECTORY,
+};
+
+// Settings of a batch run. Config files hold one key = value per line, '#'
+// starts a comment. Times are in simulation units, and a step is the ten
+// substeps of dt that Simulation::step() takes.
+struct RunConfig {
+  std::string ic;
+  InitialConditionFormat ic_format = InitialConditionFormat::AUTO;
+
+  SimulationMethod method = SimulationMethod::CPU_PARTICLE_PARTICLE;
+  Integrator integrator = Integrator::LEAPFROG;
+  float dt = 0.01f;
+  float softening = 0.0f;
+  float G = 6.6743e-11f;
+  float theta = 0.5f;
+  double end_time = 1.0;
+
+  // path prefix of the outputs, written every output_every steps and after the last
+  std::string output;
+  OutputFormat output_format = OutputFormat::NONE;
+  uint64_t output_every = 100;
+  double trajectory_precision = 1e-3;
+
+  // csv of step, time, energies and wall time, written every diagnostics_every steps
+  std::string diagnostics;
+  uint64_t diagnostics_every = 10;
+
+  // 0 uses every hardware thread
+  size_t threads = 0;
+  bool pin_threads = false;
+
+  // prints the time and hardware counters of every phase of step() after the run
+  bool profile = false;
+  // Chrome trace event JSON of the whole run, written at the end
+  std::string trace;
+  // prints the current and peak bytes of every memory subsystem after the run
+  bool memory = false;
+};
+
+// applies one key = value line, on failure error says why
+bool apply_run_config_line(std::string_view line, RunConfig &config, std::string &error);
+// applies every line of a config, error names the line that failed
+bool parse_run_config(std::string_view text, RunConfig &config, std::string &error);
+bool load_run_config(const std::string &path, RunConfig &config, std::string &error);
+// checks the keys against each other once every line is applied, on failure error says why
+bool validate_run_config(const RunConfig &config, std::string &error);
+
+} // namespace gravitysim
@@ -1,7 +1,18 @@
 #pragma once
 
+#include "ewald.hpp"
+#include "external_potentials.hpp"
+#include "arena.hpp"
 #include "gpu_sim_data.cuh"
+#include "integrators.hpp"
+#include "memory_tracker.hpp"
+#include "octree.hpp"
+#include "phase_profiler.hpp"
+#include "spatial_hash.hpp"
+#include "thread_pool.hpp"
+#include "vec3_view.hpp"
 
+#include <memory>
 #include <vector>
 
 #include "DirectXMath.h"
@@ -10,35 +21,96 @@ namespace gravitysim {
 
 using vec3f = DirectX::XMFLOAT3;
 
+// how removed bodies are taken out of the per-body arrays
+enum class RemovalOrder : int {
+  // shift the remaining bodies down, keeping their order
+  STABLE,
+  // fill each hole with the last body of its partition, O(1) per removal
+  SWAP_WITH_LAST,
+};
+
 enum class SimulationMethod : int {
   CPU_PARTICLE_PARTICLE,
   GPU_PARTICLE_PARTICLE,
+  CPU_BARNES_HUT,
 };
 
+// false when built without CUDA, GPU_PARTICLE_PARTICLE then runs its kernel on the host
+bool gpu_method_available();
+
+// per-body arrays of the host copy, counted as MemorySubsystem::BODIES
+template <class T>
+using BodyArray = TrackedVector<T, MemorySubsystem::BODIES>;
+using SIMDArray = TrackedVector<DirectX::XMVECTOR, MemorySubsystem::SIMD_MIRROR>;
+
 // store simulation data as SIMD XMVECTORS
 struct SIMDSimData {
-  std::vector<DirectX::XMVECTOR> positions;
-  std::vector<DirectX::XMVECTOR> vels;
-  std::vector<DirectX::XMVECTOR> accs;
+  SIMDArray positions;
+  SIMDArray vels;
+  SIMDArray accs;
 };
 
+// Bodies are stored massive first, then massless test particles. Test particles
+// feel the massive bodies but are skipped as sources, so the force passes are
+// num_massive x num_bodies. get_ids() maps bodies back to the constructor order.
 class Simulation {
-  size_t num_bodies;
+  size_t num_bodies = 0;
+  // bodies [0, num_massive) have mass, the rest are test particles
+  size_t num_massive = 0;
+
+  // stable id of each body, its index in the arrays passed to the constructor
+  // for initial bodies and assigned in order by add_body for later ones
+  BodyArray<uint32_t> ids;
+  uint32_t next_id = 0;
 
-  std::vector<float> masses;
+  BodyArray<float> masses;
   // mu = G * mass
-  std::vector<float> mus;
+  BodyArray<float> mus;
   // 1 / mu
-  std::vector<float> inv_mu;
+  BodyArray<float> inv_mu;
 
-  std::vector<vec3f> positions;
-  std::vector<vec3f> vels;
+  // AoS copies of the kinematics, only brought up to date when asked for
+  BodyArray<vec3f> positions;
+  BodyArray<vec3f> vels;
+  bool cpu_kinematics_current = true;
+  // collision radius of each body, empty if none were given
+  BodyArray<float> radii;
   
+  // runs every parallel stage, the shared default pool unless set_threads gave this simulation its own
+  ThreadPool *pool = &default_thread_pool();
+  std::unique_ptr<ThreadPool> own_pool;
+  // scratch that lives at most one step, reset at the start of step()
+  std::unique_ptr<Arena> step_arena = std::make_unique<Arena>();
+  // times the phases of step() when profiling is on, null otherwise
+  std::unique_ptr<PhaseProfiler> profiler;
+  // profiler while inside step(), so force passes asked for outside of it are not timed
+  PhaseProfiler *step_profiler = nullptr;
+
   SIMDSimData simd_data;
   GPUSimData gpu_data;
+  LinearOctree octree;
+  HermiteData hermite_data;
+  WisdomHolmanData wh_data;
+  IAS15Data ias15_data;
+
+  // merge overlapping bodies after every substep, CPU methods only
+  bool collisions = false;
+  SpatialHash spatial_hash;
+
+  // square of the Plummer softening length, 0 for point masses
+  float softening2 = 0.0f;
+
+  // side of the periodic box [0, box_size)^3, 0 for open boundaries
+  float box_size = 0.0f;
+  EwaldTable ewald;
+
+  // analytic fields added to the self-gravity of every CPU force pass built on calc_accs_cpu
+  std::vector<std::unique_ptr<ExternalField>> external_fields;
 
   float time_step = 1.0f;
   SimulationMethod method = SimulationMethod::CPU_PARTICLE_PARTICLE;
+  // only used by the CPU methods, the GPU method always uses Euler-Cromer
+  Integrator integrator = Integrator::EULER_CROMER;
   
   // to be implemented
   float dist_scale = 1.0f;
@@ -46,41 +118,164 @@ class Simulation {
   
   float G = 6.6743e-11f;
 
-  // steps simulation forward, updates data in simd_data
+  // Barnes-Hut opening angle, cells with size / distance < theta are not opened
+  float theta = 0.5f;
+
+  // calculates accelerations from simd_data positions into simd_data.accs
   void calc_accs_cpu_particle_particle();
-  // tries calculating forces, then scaling sum of forces; can cause precision errors
-  void calc_accs_cpu_particle_particle_halved();
   // steps simulation forward, updates data in gpu_data
   void calc_accs_gpu_particle_particle();
+  // calculates accelerations using an octree walk into simd_data.accs
+  void calc_accs_cpu_barnes_hut();
+  // direct sum over the minimum image plus the tabulated Ewald correction for the other images
+  void calc_accs_cpu_periodic();
+  // calculates accelerations with the current CPU method
+  void calc_accs_cpu();
+  // direct-sum accelerations in double precision, the force callback of IAS15
+  void calc_accs_cpu_particle_particle_double(std::span<const dvec3> positions, std::span<dvec3> accs);
+  // calculates accelerations and jerks in one direct-sum pass
+  void calc_accs_jerks_cpu_particle_particle();
+
+  // updates simd_data velocities then positions from simd_data.accs
+  void update_simd_kinematics();
+
+  // steps simd_data forward by time_step with the current integrator
+  void step_cpu();
+  void step_euler_cromer();
+  void step_hermite();
+  // leapfrog composition, Scheme provides the substep weights
+  template <class Scheme>
+  void step_composition();
+  void step_wisdom_holman();
+  // advances time_step with as many adaptive substeps as needed
+  void step_ias15();
+  // one predictor-corrector substep of dt, returns the suggested next substep
+  // the state is only advanced if the result is at least a quarter of dt
+  double ias15_substep(double dt);
+  // marks integrator state derived from simd_data as stale
+  void invalidate_integrator_state();
+  // moves simd_data positions back into the periodic box
+  void wrap_simd_positions();
+  // moves positions by vels * dt
+  void drift_simd(float dt);
+  // calculates accelerations and moves vels by accs * dt
+  void kick_simd(float dt);
   
+  // merges overlapping bodies in simd_data, conserving mass and momentum
+  void resolve_collisions();
+  // removes bodies whose keep flag is 0 from every per-body array, keeping the order
+  void compact_bodies(std::span<const uint8_t> keep);
+  // removes bodies whose keep flag is 0 by moving the last bodies of each partition into the holes
+  void swap_remove_bodies(std::span<const uint8_t> keep);
+  void remove_masked_bodies(std::span<const uint8_t> keep, RemovalOrder order);
+
+  // makes simd_data and the cpu arrays current before bodies are added or removed
+  void begin_body_edit();
+  // resynchronizes the cpu arrays and the active mirror after bodies were added or removed
+  void end_body_edit();
+
+  // calls f on every per-body array
+  template <class F>
+  void for_each_body_array(F &&f) {
+    f(masses);
+    f(mus);
+    f(inv_mu);
+    f(ids);
+    f(positions);
+    f(vels);
+    f(radii);
+    f(simd_data.positions);
+    f(simd_data.vels);
+    f(simd_data.accs);
+  }
+
   // moves data in positions and vels to simd_data, needed for calculating using SIMD
   void transfer_kinematics_to_simd();
   // moves data from simd_data to positions and vels, needed for synchronizing gpu data
   void transfer_simd_kinematics_to_cpu();
-  // moves positions from simd_data to positions, needed for rendering
-  void transfer_simd_positions_to_cpu();
+  // brings positions and vels up to date with the active mirror
+  void materialize_kinematics();
 
   void transfer_mus_to_gpu();
   // moves kinematics data to gpu_data, needed for calculating on gpu
   void transfer_kinematics_to_gpu();
   // moves kinematics data from gpu to cpu, needed for synchronizing with SIMD
   void transfer_gpu_kinematics_to_cpu();
-  // moves positions from gpu to cpu, needed for rendering
-  void transfer_gpu_positions_to_cpu();
   
 public:
   Simulation();
   Simulation(float time_step);
-  Simulation(std::vector<float> masses, std::vector<vec3f> positions, std::vector<vec3f> vels, float time_step);
+  Simulation(std::vector<float> masses, std::vector<vec3f> positions, std::vector<vec3f> vels, float time_step,
+             std::vector<float> radii = {});
 
   inline SimulationMethod get_method() { return method; }
-  inline const std::vector<float> &get_masses() { return masses; }
-  inline const std::vector<vec3f> &get_positions() { return positions; }
-  inline const std::vector<vec3f> &get_vels() { return vels; }
+  inline Integrator get_integrator() { return integrator; }
+  inline size_t get_num_massive() { return num_massive; }
+  inline const BodyArray<uint32_t> &get_ids() { return ids; }
+  inline const BodyArray<float> &get_masses() { return masses; }
+  // AoS positions and vels, copied from the active mirror on the first call after a step
+  inline const BodyArray<vec3f> &get_positions() { materialize_kinematics(); return positions; }
+  inline const BodyArray<vec3f> &get_vels() { materialize_kinematics(); return vels; }
+  // views over the native layout, no copy for the CPU methods
+  // the GPU method has no host copy to view, so these materialize the AoS arrays first
+  Vec3View view_positions();
+  Vec3View view_vels();
+  // device array of positions for interop, GPU method only
+  const float3 *get_gpu_positions();
+  inline const BodyArray<float> &get_radii() { return radii; }
+  inline size_t get_num_bodies() { return num_bodies; }
   
   float get_KE();
   float get_PE();
+  // accelerations at the current positions from the current method's force pass, without stepping
+  // the GPU method fuses its force pass into the step, so it gets the CPU direct sum
+  void get_accelerations(std::vector<vec3f> &accs);
+  // self-gravity from a double precision direct sum, the reference for force accuracy
+  void get_exact_accelerations(std::vector<dvec3> &accs);
   void set_G(float G);
+  void set_theta(float theta);
+  // false and unchanged if the integrator cannot run in the periodic box, see set_periodic_box
+  // Hermite always takes accelerations and jerks from its own unsoftened direct sum,
+  // under CPU_BARNES_HUT too
+  bool set_integrator(Integrator integrator);
+  // merge bodies that overlap, needs radii from the constructor
+  void set_collisions(bool enabled);
+  // gives this simulation its own pool of num_threads threads, 0 for every hardware thread
+  // pinned workers stay on cores 1 to num_threads - 1
+  void set_threads(size_t num_threads, bool pin_threads = false);
+  // Plummer softening length, forces go as r / (r^2 + softening^2)^(3/2)
+  // not seen by the Hermite and Wisdom-Holman integrators, which keep unsoftened forces
+  void set_softening(float softening);
+  // times every phase of step(), with hardware counters where the platform has them
+  // turning it off drops the accumulated times
+  void set_profiling(bool enabled, bool hardware_counters = true);
+  // null unless profiling is on
+  inline PhaseProfiler *get_profiler() { return profiler.get(); }
+  // relative error tolerance of the IAS15 integrator
+  void set_ias15_epsilon(double epsilon);
+  // periodic boundaries in a box [0, box_size)^3, 0 turns them off
+  // forces are periodic for the CPU methods. Only the Euler-Cromer, leapfrog and Yoshida
+  // integrators step on the wrapped positions directly, so with the others this returns
+  // false and leaves the boundaries as they were
+  bool set_periodic_box(float box_size);
+
+  // adds an analytic potential, e.g. a NFWPotential or MiyamotoNagaiPotential, felt by every body
+  // not seen by the Hermite, Wisdom-Holman and IAS15 integrators or the GPU method
+  template <class Potential>
+  void add_external_potential(const Potential &potential) {
+    external_fields.push_back(std::make_unique<ExternalPotentialField<Potential>>(potential));
+    invalidate_integrator_state();
+  }
+  void clear_external_potentials();
+
+  // adds a body and returns its id, massive bodies go to the end of the massive partition
+  uint32_t add_body(float mass, vec3f position, vec3f vel, float radius = 0.0f);
+  // removes the bodies with the given ids, returns the number removed
+  size_t remove_bodies(std::span<const uint32_t> ids, RemovalOrder order = RemovalOrder::STABLE);
+  // removes bodies farther than radius from the center of mass, returns the number removed
+  size_t remove_escapers(float radius, RemovalOrder order = RemovalOrder::STABLE);
+  // removes bodies with positive energy in the center of mass frame, returns the number removed
+  size_t remove_unbound(RemovalOrder order = RemovalOrder::STABLE);
 
   // sets simulation method and moves data
   void switch_method(SimulationMethod new_method);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "simulation.hpp"
+#include "triple_buffer.hpp"
+
+namespace gravitysim {
+
+// state of the simulation after a step, as handed to consumers
+struct Snapshot {
+  // steps taken when the snapshot was published
+  uint64_t step = 0;
+  std::vector<vec3f> positions;
+  std::vector<uint32_t> ids;
+  // from the last step the runner computed energy on, 0 when it does not
+  float KE = 0.0f;
+  float PE = 0.0f;
+};
+
+// one consumer's view of the published snapshots
+class SnapshotChannel {
+  friend class SimulationRunner;
+  TripleBuffer<Snapshot> buffer;
+
+public:
+  // newest snapshot, valid until the next read, never blocks
+  inline const Snapshot &read() { return buffer.read(); }
+  inline bool has_fresh() const { return buffer.has_fresh(); }
+};
+
+// Steps a Simulation on its own thread as fast as it goes and publishes a
+// snapshot after every step to each subscribed channel. The simulation is only
+// touched from that thread while the runner is started, so other threads
+// change it by submitting commands, which run between steps.
+class SimulationRunner {
+  Simulation &sim;
+  std::thread thread;
+
+  std::mutex command_mutex;
+  std::condition_variable command_ready;
+  std::vector<std::function<void(Simulation &)>> commands;
+
+  // channels are only touched on the simulation thread
+  std::vector<std::shared_ptr<SnapshotChannel>> channels;
+
+  std::atomic<bool> quit = false;
+  std::atomic<bool> running = false;
+  std::atomic<uint64_t> energy_interval = 0;
+  uint64_t steps = 0;
+  float KE = 0.0f, PE = 0.0f;
+
+  void run();
+  // runs the queued commands, waits for one if paused
+  void run_commands(bool wait);
+  void publish();
+
+public:
+  explicit SimulationRunner(Simulation &sim);
+  ~SimulationRunner();
+
+  SimulationRunner(const SimulationRunner &) = delete;
+  SimulationRunner &operator=(const SimulationRunner &) = delete;
+
+  // starts the simulation thread, paused until set_running(true)
+  void start();
+  // finishes the current step and joins the thread
+  void stop();
+
+  void set_running(bool running);
+  inline bool is_running() const { return running; }
+  // compute KE and PE every interval steps, 0 turns it off
+  // PE is O(n^2), more than a Barnes-Hut step at large n
+  inline void set_energy_interval(uint64_t interval) { energy_interval = interval; }
+
+  // queues f to run on the simulation thread between steps
+  void submit(std::function<void(Simulation &)> f);
+
+  // new channel that receives every snapshot from the next one on
+  std::shared_ptr<SnapshotChannel> subscribe();
+  void unsubscribe(const std::shared_ptr<SnapshotChannel> &channel);
+};
+
+} // namespace gravitysim
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "simulation.hpp"
+#include "thread_pool.hpp"
+#include "vec3_view.hpp"
+
+namespace gravitysim {
+
+// Columnar snapshots for outputs too big to read whole. Bodies are stored in
+// Morton order of their positions and split into fixed-size chunks, so each
+// chunk covers a compact region. Each field of a chunk is stored contiguously,
+// so a reader can load one field, or only the chunks whose bounding box meets a
+// query, with a single positional read per column chunk. The ids column gives
+// each stored body's place in the simulation. The footer indexes
+// every chunk with its offsets, checksums and statistics. All column chunks
+// have known sizes up front, so the writer computes the layout first and the
+// pool writes every chunk concurrently with pwrite.
+//
+// layout: header, columns, index, footer
+//   header:  "GSSNAP01"
+//   columns: per field, per chunk, the raw values
+//   index:   per chunk ChunkInfo
+//   footer:  step (u64), bodies (u64), chunk size (u32), chunk count (u64),
+//            index offset (u64), "GSSNPIDX"
+enum class SnapshotField : uint32_t {
+  POSITIONS,
+  VELOCITIES,
+  MASSES,
+  IDS,
+  COUNT
+};
+
+constexpr size_t NUM_SNAPSHOT_FIELDS = static_cast<size_t>(SnapshotField::COUNT);
+
+struct ChunkInfo {
+  // in stored (Morton) order
+  uint64_t first_body = 0;
+  uint64_t num_bodies = 0;
+  // byte offset and FNV-1a checksum of each field's column chunk
+  std::array<uint64_t, NUM_SNAPSHOT_FIELDS> offsets = {};
+  std::array<uint64_t, NUM_SNAPSHOT_FIELDS> checksums = {};
+  // bounding box of the positions
+  DirectX::XMFLOAT3 lo = {0, 0, 0};
+  DirectX::XMFLOAT3 hi = {0, 0, 0};
+  float max_speed = 0.0f;
+  float min_mass = 0.0f;
+  float max_mass = 0.0f;
+  uint32_t min_id = 0;
+  uint32_t max_id = 0;
+};
+
+// columns of one snapshot, all of the same length
+struct SnapshotColumns {
+  Vec3View positions;
+  Vec3View vels;
+  std::span<const float> masses;
+  std::span<const uint32_t> ids;
+};
+
+// writes a snapshot, returns false if the file could not be written
+bool write_snapshot_store(const std::string &path, uint64_t step, const SnapshotColumns &columns,
+                          uint32_t chunk_size = 1 << 16, ThreadPool &pool = default_thread_pool());
+bool write_snapshot_store(const std::string &path, uint64_t step, Simulation &simulation,
+                          uint32_t chunk_size = 1 << 16, ThreadPool &pool = default_thread_pool());
+
+class SnapshotStoreReader {
+  // platform file handle, -1 when closed
+  intptr_t handle = -1;
+  uint64_t step = 0;
+  uint64_t num_bodies = 0;
+  uint32_t chunk_size = 0;
+  std::vector<ChunkInfo> chunks;
+
+  bool read_at(uint64_t offset, void *data, size_t bytes) const;
+  // reads and verifies one column chunk into dst
+  bool read_chunk(size_t chunk, SnapshotField field, void *dst) const;
+  template <class T>
+  bool read_column(SnapshotField field, std::vector<T> &out, ThreadPool &pool) const;
+
+public:
+  SnapshotStoreReader() = default;
+  explicit SnapshotStoreReader(const std::string &path);
+  ~SnapshotStoreReader();
+
+  SnapshotStoreReader(const SnapshotStoreReader &) = delete;
+  SnapshotStoreReader &operator=(const SnapshotStoreReader &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+  inline bool is_open() const { return handle != -1; }
+
+  inline uint64_t get_step() const { return step; }
+  inline uint64_t get_num_bodies() const { return num_bodies; }
+  inline uint32_t get_chunk_size() const { return chunk_size; }
+  inline const std::vector<ChunkInfo> &get_chunks() const { return chunks; }
+
+  // whole columns in stored order, chunks are read concurrently and checked against their checksums
+  bool read_positions(std::vector<DirectX::XMFLOAT3> &out, ThreadPool &pool = default_thread_pool()) const;
+  bool read_vels(std::vector<DirectX::XMFLOAT3> &out, ThreadPool &pool = default_thread_pool()) const;
+  bool read_masses(std::vector<float> &out, ThreadPool &pool = default_thread_pool()) const;
+  bool read_ids(std::vector<uint32_t> &out, ThreadPool &pool = default_thread_pool()) const;
+
+  // chunks whose bounding box intersects [lo, hi]
+  std::vector<size_t> chunks_in_box(const DirectX::XMFLOAT3 &lo, const DirectX::XMFLOAT3 &hi) const;
+  // ids and positions of the bodies inside [lo, hi], reading only the chunks that can hold them
+  bool query_box(const DirectX::XMFLOAT3 &lo, const DirectX::XMFLOAT3 &hi, std::vector<uint32_t> &ids,
+                 std::vector<DirectX::XMFLOAT3> &positions) const;
+};
+
+} // namespace gravitysim
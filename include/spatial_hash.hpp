@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "octree.hpp"
+#include "thread_pool.hpp"
+
+namespace gravitysim {
+
+// Uniform grid hashed into a power of two table. Bodies are sorted by bucket,
+// so each bucket is a contiguous range of sorted_bodies. Different cells can
+// share a bucket, so queries return a superset of the bodies in the cells.
+// In a periodic box the cells tile the box and neighbours wrap around it.
+class SpatialHash {
+  float inv_cell_size = 1.0f;
+  uint32_t table_mask = 0;
+  // cells per side of the periodic box, 0 for open boundaries
+  int32_t periodic_cells = 0;
+
+  // bucket of each body
+  TreeArray<uint32_t> body_buckets;
+  // body indices sorted by bucket
+  TreeArray<uint32_t> sorted_bodies;
+  // merge buffer of the sort, kept so rebuilding allocates nothing
+  TreeArray<uint32_t> sort_scratch;
+  // range [bucket_begin[b], bucket_end[b]) of sorted_bodies in bucket b
+  TreeArray<uint32_t> bucket_begin;
+  TreeArray<uint32_t> bucket_end;
+
+  inline uint32_t bucket(int32_t x, int32_t y, int32_t z) const {
+    uint32_t h = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^
+                 static_cast<uint32_t>(z) * 83492791u;
+    return h & table_mask;
+  }
+
+  // far escapers and NaN land in the edge cells, which leaves room for the neighbour offsets
+  static inline int32_t clamp_cell(float c) {
+    constexpr float LIMIT = float(1 << 30);
+    return static_cast<int32_t>(c >= -LIMIT ? std::min(c, LIMIT) : -LIMIT);
+  }
+
+  inline int32_t wrap_cell(int32_t c) const {
+    if (periodic_cells == 0) return c;
+    c %= periodic_cells;
+    return c < 0 ? c + periodic_cells : c;
+  }
+
+  inline DirectX::XMINT3 cell(DirectX::FXMVECTOR p) const {
+    DirectX::XMFLOAT3 c;
+    DirectX::XMStoreFloat3(&c, DirectX::XMVectorFloor(DirectX::XMVectorScale(p, inv_cell_size)));
+    return {wrap_cell(clamp_cell(c.x)), wrap_cell(clamp_cell(c.y)), wrap_cell(clamp_cell(c.z))};
+  }
+
+public:
+  // rebuilds the table for the given positions, box_size > 0 for positions wrapped into [0, box_size)^3
+  void build(std::span<const DirectX::XMVECTOR> positions, float cell_size, float box_size = 0.0f,
+             ThreadPool &pool = default_thread_pool());
+
+  // calls f(j) for every body in the 27 cells around p
+  template <class F>
+  void for_each_neighbour(DirectX::FXMVECTOR p, F &&f) const {
+    if (sorted_bodies.empty()) return;
+    DirectX::XMINT3 c = cell(p);
+    for (int32_t dz = -1; dz <= 1; dz++) {
+      for (int32_t dy = -1; dy <= 1; dy++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+          uint32_t b = bucket(wrap_cell(c.x + dx), wrap_cell(c.y + dy), wrap_cell(c.z + dz));
+          for (uint32_t k = bucket_begin[b]; k < bucket_end[b]; k++) {
+            f(sorted_bodies[k]);
+          }
+        }
+      }
+    }
+  }
+};
+
+} // namespace gravitysim
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <array>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gravitysim {
+
+// Persistent pool for the parallel stages of a step. A parallel call splits its
+// range into chunks, pushes them onto the worker deques and helps run them
+// until all are done. Workers pop their own deque from the back and steal from
+// the front of the others, so a call made from inside a task is run by the
+// same worker first and nested calls cannot deadlock.
+class ThreadPool {
+  struct Task {
+    void (*run)(void *ctx, size_t begin, size_t end);
+    void *ctx;
+    size_t begin;
+    size_t end;
+    std::atomic<size_t> *pending;
+  };
+
+  // ring buffer that only grows, so pushes stop allocating once it is big enough
+  struct WorkQueue {
+    std::mutex mutex;
+    std::vector<Task> ring = std::vector<Task>(64);
+    size_t head = 0;
+    size_t count = 0;
+
+    void push_back(const Task &task);
+    inline Task pop_back() { return ring[(head + --count) % ring.size()]; }
+    inline Task pop_front() {
+      Task task = ring[head];
+      head = (head + 1) % ring.size();
+      count--;
+      return task;
+    }
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> threads;
+  // tasks pushed but not yet taken, workers sleep while this is 0
+  std::atomic<size_t> queued = 0;
+  std::atomic<bool> stop = false;
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+
+  void worker_loop(size_t index);
+  // takes a task from queue index, or steals one from any other queue
+  bool find_task(size_t index, Task &task);
+  // runs fn(ctx, begin, end) over num_chunks chunks of [0, n) and waits for all of them
+  void run_chunks(size_t n, size_t num_chunks, void (*fn)(void *, size_t, size_t), void *ctx);
+
+  template <class F>
+  static void call_range(void *ctx, size_t begin, size_t end) {
+    (*static_cast<F *>(ctx))(begin, end);
+  }
+
+  // a few chunks per thread leaves room to balance uneven work
+  // capped so per-chunk results fit in fixed arrays instead of allocations
+  static constexpr size_t MAX_CHUNKS = 256;
+  inline size_t default_chunks(size_t n) const { return std::min({n, 4 * size(), MAX_CHUNKS}); }
+
+public:
+  // num_threads counts the calling thread, 0 uses every hardware thread
+  // pin_threads binds worker k to core k + 1, leaving core 0 to the caller
+  explicit ThreadPool(size_t num_threads = 0, bool pin_threads = false);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // threads working on a parallel call, including the caller
+  inline size_t size() const { return threads.size() + 1; }
+
+  // calls f(begin, end) on disjoint chunks covering [0, n)
+  template <class F>
+  void parallel_for(size_t n, F &&f) {
+    run_chunks(n, default_chunks(n), &call_range<std::remove_reference_t<F>>, &f);
+  }
+
+  // calls f(x) for every element of a contiguous range
+  template <class It, class F>
+  void for_each(It first, It last, F &&f) {
+    parallel_for(static_cast<size_t>(last - first), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) f(first[i]);
+    });
+  }
+
+  // reduces transform(x) over a non-empty range, chunks are combined in order
+  template <class It, class T, class Reduce, class Transform>
+  T transform_reduce(It first, It last, T init, Reduce reduce, Transform transform) {
+    size_t n = static_cast<size_t>(last - first);
+    size_t num_chunks = default_chunks(n);
+    if (num_chunks == 0) return init;
+    size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    size_t num_partial = (n + chunk_size - 1) / chunk_size;
+    std::array<T, MAX_CHUNKS> partial;
+    parallel_for(num_partial, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++) {
+        T acc = transform(first[c * chunk_size]);
+        for (size_t i = c * chunk_size + 1; i < std::min(n, (c + 1) * chunk_size); i++) {
+          acc = reduce(acc, transform(first[i]));
+        }
+        partial[c] = acc;
+      }
+    });
+    for (size_t c = 0; c < num_partial; c++) init = reduce(init, partial[c]);
+    return init;
+  }
+
+  // inclusive prefix sum, out may be first
+  template <class It, class Out>
+  void inclusive_scan(It first, It last, Out out) {
+    using T = typename std::iterator_traits<It>::value_type;
+    size_t n = static_cast<size_t>(last - first);
+    size_t num_chunks = default_chunks(n);
+    if (num_chunks == 0) return;
+    size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    num_chunks = (n + chunk_size - 1) / chunk_size;
+
+    // scan each chunk, offset every chunk by the totals before it
+    std::array<T, MAX_CHUNKS> totals;
+    parallel_for(num_chunks, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++) {
+        size_t lo = c * chunk_size, hi = std::min(n, lo + chunk_size);
+        T sum = first[lo];
+        out[lo] = sum;
+        for (size_t i = lo + 1; i < hi; i++) out[i] = sum = sum + first[i];
+        totals[c] = sum;
+      }
+    });
+    for (size_t c = 1; c < num_chunks; c++) totals[c] = totals[c - 1] + totals[c];
+    parallel_for(num_chunks - 1, [&](size_t begin, size_t end) {
+      for (size_t c = begin + 1; c < end + 1; c++) {
+        for (size_t i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++) out[i] = out[i] + totals[c - 1];
+      }
+    });
+  }
+
+  // sorts chunks in parallel, then merges them pairwise in parallel rounds,
+  // ping-ponging between the range and scratch, which must hold last - first
+  // elements. Nothing is allocated, so callers keep scratch between calls.
+  template <class It, class ScratchIt, class Compare>
+  void sort(It first, It last, ScratchIt scratch, Compare comp) {
+    size_t n = static_cast<size_t>(last - first);
+    size_t num_chunks = std::bit_floor(std::max<size_t>(default_chunks(n / 1024), 1));
+    size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    auto bound = [&](size_t c) { return std::min(n, c * chunk_size); };
+    parallel_for(num_chunks, [&](size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++) std::sort(first + bound(c), first + bound(c + 1), comp);
+    });
+    // num_chunks is a power of two, so every round moves every element
+    auto merge_round = [&](auto from, auto to, size_t width) {
+      parallel_for(num_chunks / (2 * width), [&](size_t begin, size_t end) {
+        for (size_t m = begin; m < end; m++) {
+          size_t c = 2 * width * m;
+          std::merge(std::make_move_iterator(from + bound(c)), std::make_move_iterator(from + bound(c + width)),
+                     std::make_move_iterator(from + bound(c + width)),
+                     std::make_move_iterator(from + bound(c + 2 * width)), to + bound(c), comp);
+        }
+      });
+    };
+    bool in_scratch = false;
+    for (size_t width = 1; width < num_chunks; width *= 2) {
+      if (in_scratch) {
+        merge_round(scratch, first, width);
+      } else {
+        merge_round(first, scratch, width);
+      }
+      in_scratch = !in_scratch;
+    }
+    if (in_scratch) {
+      parallel_for(n, [&](size_t begin, size_t end) {
+        std::move(scratch + begin, scratch + end, first + begin);
+      });
+    }
+  }
+};
+
+// pool shared by everything that was not given one, sized to the hardware
+ThreadPool &default_thread_pool();
+
+} // namespace gravitysim
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "DirectXMath.h"
+#include "memory_tracker.hpp"
+#include "vec3_view.hpp"
+
+namespace gravitysim {
+
+// Compressed position trajectories. Positions are quantized to a fixed
+// precision on a grid anchored at the bounding box corner of the last
+// keyframe, so the reconstruction error is at most precision / 2 and does not
+// accumulate. Keyframes store bodies in Morton order, each delta coded against
+// its spatial neighbour, along with the permutation. Other frames store each
+// body's delta from the previous frame in the same order. Deltas are zigzag
+// varints, split into blocks that are entropy coded with an order-0 rANS coder
+// in parallel. A footer indexes every frame, so a reader can seek to any frame
+// by decoding forward from the keyframe before it.
+//
+// layout: header, frames, index, footer
+//   header:  "GSTRAJ01", precision (f64), keyframe interval (u32)
+//   frame:   "FRAM", flags (u32), step (u64), bodies (u64), origin (3 x f64),
+//            block count (u32), blocks
+//   block:   raw size (u32), coded size (u32), frequencies (256 x u16), coded bytes
+//   index:   per frame offset (u64), step (u64), flags (u32)
+//   footer:  frame count (u64), index offset (u64), "GSTRJIDX"
+class TrajectoryWriter {
+  std::ofstream file;
+  double precision = 1e-3;
+  uint32_t keyframe_interval = 64;
+
+  // Morton order of the current keyframe and the last frame's quantized positions in it
+  OutputArray<uint32_t> order;
+  OutputArray<std::array<int64_t, 3>> previous;
+  OutputArray<std::array<int64_t, 3>> current;
+  // merge buffer for sorting order
+  OutputArray<uint32_t> order_scratch;
+  std::array<double, 3> origin = {0.0, 0.0, 0.0};
+
+  struct IndexEntry {
+    uint64_t offset;
+    uint64_t step;
+    uint32_t flags;
+  };
+  OutputArray<IndexEntry> index;
+  OutputArray<OutputArray<uint8_t>> block_bytes;
+  OutputArray<OutputArray<uint8_t>> block_coded;
+
+  void begin_keyframe(const Vec3View &positions);
+
+public:
+  TrajectoryWriter() = default;
+  // precision is the quantization step in position units
+  TrajectoryWriter(const std::string &path, double precision, uint32_t keyframe_interval = 64);
+  ~TrajectoryWriter();
+
+  bool open(const std::string &path, double precision, uint32_t keyframe_interval = 64);
+  inline bool is_open() const { return file.is_open(); }
+  // appends a frame, a change in body count starts a keyframe
+  bool write_frame(uint64_t step, const Vec3View &positions);
+  // writes the index and footer, returns false if any write failed
+  bool close();
+};
+
+class TrajectoryReader {
+  std::ifstream file;
+  double precision = 0.0;
+
+  struct IndexEntry {
+    uint64_t offset;
+    uint64_t step;
+    uint32_t flags;
+  };
+  std::vector<IndexEntry> index;
+
+  // state after decoding frame decoded_frame
+  size_t decoded_frame = SIZE_MAX;
+  std::vector<uint32_t> order;
+  std::vector<std::array<int64_t, 3>> quantized;
+  std::array<double, 3> origin = {0.0, 0.0, 0.0};
+
+  bool decode_next(size_t frame);
+
+public:
+  TrajectoryReader() = default;
+  explicit TrajectoryReader(const std::string &path);
+
+  bool open(const std::string &path);
+  inline bool is_open() const { return file.is_open(); }
+  inline size_t num_frames() const { return index.size(); }
+  inline uint64_t get_step(size_t frame) const { return index[frame].step; }
+  inline double get_precision() const { return precision; }
+
+  // positions of a frame in body order, decoding from the nearest keyframe if needed
+  bool read_frame(size_t frame, std::vector<DirectX::XMFLOAT3> &positions);
+};
+
+} // namespace gravitysim
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace gravitysim {
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread. The writer fills its back slot and swaps it with the middle slot,
+// the reader swaps its front slot with the middle slot only when a newer value
+// is there. Neither side ever waits, and the writer can publish faster than
+// the reader consumes, in which case the reader skips to the newest value.
+template <class T>
+class TripleBuffer {
+  static constexpr uint8_t INDEX_MASK = 0x3;
+  // set in middle when it holds a value the reader has not seen
+  static constexpr uint8_t FRESH = 0x4;
+
+  T slots[3];
+  // owned by the writer
+  uint8_t back = 0;
+  // shared, index of the middle slot and the FRESH flag
+  std::atomic<uint8_t> middle = 1;
+  // owned by the reader
+  uint8_t front = 2;
+
+public:
+  // slot for the writer to fill, reused across publishes so its allocations are kept
+  inline T &write_buffer() { return slots[back]; }
+
+  // makes the write buffer the newest value
+  inline void publish() {
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  // true if a value newer than the last read one is waiting
+  inline bool has_fresh() const { return middle.load(std::memory_order_acquire) & FRESH; }
+
+  // the newest published value, valid until the next call to read
+  inline const T &read() {
+    if (has_fresh()) {
+      front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+    return slots[front];
+  }
+};
+
+} // namespace gravitysim
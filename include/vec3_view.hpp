@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <span>
+
+#include "DirectXMath.h"
+
+namespace gravitysim {
+
+// Read-only view of xyz triples stored stride floats apart, so the same view
+// covers packed XMFLOAT3 arrays (stride 3) and XMVECTOR arrays (stride 4)
+// without copying. Elements are returned by value.
+class Vec3View {
+  const float *base = nullptr;
+  size_t count = 0;
+  size_t step = 3;
+
+public:
+  class iterator {
+    const float *p = nullptr;
+    size_t step = 3;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = DirectX::XMFLOAT3;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = DirectX::XMFLOAT3;
+
+    iterator() = default;
+    iterator(const float *p, size_t step) : p(p), step(step) {}
+
+    inline DirectX::XMFLOAT3 operator*() const { return {p[0], p[1], p[2]}; }
+    inline DirectX::XMFLOAT3 operator[](difference_type n) const { return *(*this + n); }
+    inline iterator &operator++() { p += step; return *this; }
+    inline iterator operator++(int) { iterator t = *this; p += step; return t; }
+    inline iterator &operator--() { p -= step; return *this; }
+    inline iterator operator--(int) { iterator t = *this; p -= step; return t; }
+    inline iterator &operator+=(difference_type n) { p += n * static_cast<difference_type>(step); return *this; }
+    inline iterator &operator-=(difference_type n) { p -= n * static_cast<difference_type>(step); return *this; }
+    inline iterator operator+(difference_type n) const { iterator t = *this; return t += n; }
+    inline iterator operator-(difference_type n) const { iterator t = *this; return t -= n; }
+    friend inline iterator operator+(difference_type n, const iterator &it) { return it + n; }
+    inline difference_type operator-(const iterator &o) const {
+      return (p - o.p) / static_cast<difference_type>(step);
+    }
+    inline auto operator<=>(const iterator &o) const { return p <=> o.p; }
+    inline bool operator==(const iterator &o) const { return p == o.p; }
+  };
+
+  Vec3View() = default;
+  Vec3View(const float *base, size_t count, size_t stride) : base(base), count(count), step(stride) {}
+  explicit Vec3View(std::span<const DirectX::XMFLOAT3> v)
+      : base(reinterpret_cast<const float *>(v.data())), count(v.size()), step(3) {}
+  explicit Vec3View(std::span<const DirectX::XMVECTOR> v)
+      : base(reinterpret_cast<const float *>(v.data())), count(v.size()), step(4) {}
+
+  inline size_t size() const { return count; }
+  inline bool empty() const { return count == 0; }
+  // floats between consecutive bodies
+  inline size_t stride() const { return step; }
+  // x of body 0, component c of body i is at data()[i * stride() + c]
+  inline const float *data() const { return base; }
+
+  inline DirectX::XMFLOAT3 operator[](size_t i) const {
+    const float *p = base + i * step;
+    return {p[0], p[1], p[2]};
+  }
+  inline iterator begin() const { return {base, step}; }
+  inline iterator end() const { return {base + count * step, step}; }
+
+  // materializes the view into a packed array of size() elements
+  inline void copy_to(std::span<DirectX::XMFLOAT3> out) const {
+    for (size_t i = 0; i < count; i++) out[i] = (*this)[i];
+  }
+};
+
+} // namespace gravitysim
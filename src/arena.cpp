@@ -0,0 +1,41 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+namespace gravitysim {
+
+Arena::Arena(size_t initial_capacity)
+    : block(initial_capacity > 0 ? new std::byte[initial_capacity] : nullptr), capacity(initial_capacity) {
+  track_allocation(MemorySubsystem::SCRATCH, capacity);
+}
+
+Arena::~Arena() {
+  track_deallocation(MemorySubsystem::SCRATCH, capacity + overflow_bytes);
+}
+
+void *Arena::allocate_overflow(size_t bytes, size_t align) {
+  std::lock_guard lock(overflow_mutex);
+  // new[] of bytes is only aligned to max_align_t, pad for larger alignments
+  size_t padded = bytes + align - 1;
+  overflow.emplace_back(new std::byte[padded]);
+  overflow_bytes += padded;
+  track_allocation(MemorySubsystem::SCRATCH, padded);
+  auto address = reinterpret_cast<uintptr_t>(overflow.back().get());
+  return reinterpret_cast<void *>((address + align - 1) & ~(uintptr_t(align) - 1));
+}
+
+void Arena::reset() {
+  // offset keeps counting past capacity, so it is the total requested this step
+  high_water = std::max(high_water, offset.load(std::memory_order_relaxed));
+  if (!overflow.empty()) {
+    overflow.clear();
+    track_deallocation(MemorySubsystem::SCRATCH, capacity + overflow_bytes);
+    overflow_bytes = 0;
+    capacity = high_water;
+    block.reset(new std::byte[capacity]);
+    track_allocation(MemorySubsystem::SCRATCH, capacity);
+  }
+  offset.store(0, std::memory_order_relaxed);
+}
+
+} // namespace gravitysim
@@ -0,0 +1,191 @@
+#include "simulation.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+void Simulation::begin_body_edit() {
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    transfer_gpu_kinematics_to_cpu();
+    transfer_kinematics_to_simd();
+  }
+}
+
+void Simulation::end_body_edit() {
+  transfer_simd_kinematics_to_cpu();
+  invalidate_integrator_state();
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    transfer_mus_to_gpu();
+    transfer_kinematics_to_gpu();
+  }
+}
+
+void Simulation::compact_bodies(std::span<const uint8_t> keep) {
+  assert(keep.size() == num_bodies);
+  size_t new_num_massive = std::count(keep.begin(), keep.begin() + num_massive, 1);
+  size_t new_num_bodies = std::count(keep.begin(), keep.end(), 1);
+
+  for_each_body_array([&](auto &v) {
+    if (v.size() != num_bodies) return;
+    size_t out = 0;
+    for (size_t i = 0; i < num_bodies; i++) {
+      if (keep[i]) v[out++] = v[i];
+    }
+    v.resize(out);
+  });
+
+  num_bodies = new_num_bodies;
+  num_massive = new_num_massive;
+  invalidate_integrator_state();
+}
+
+void Simulation::swap_remove_bodies(std::span<const uint8_t> keep) {
+  assert(keep.size() == num_bodies);
+  auto move_body = [&](size_t from, size_t to) {
+    for_each_body_array([&](auto &v) {
+      if (v.size() == num_bodies) v[to] = v[from];
+    });
+  };
+
+  // from the back, so every body moved into a hole has already been kept
+  for (size_t i = num_bodies; i-- > 0;) {
+    if (keep[i]) continue;
+    if (i < num_massive) {
+      // the last massive body fills the hole, the last test particle fills its slot
+      move_body(num_massive - 1, i);
+      move_body(num_bodies - 1, num_massive - 1);
+      num_massive--;
+    } else {
+      move_body(num_bodies - 1, i);
+    }
+    for_each_body_array([&](auto &v) {
+      if (v.size() == num_bodies) v.pop_back();
+    });
+    num_bodies--;
+  }
+  invalidate_integrator_state();
+}
+
+void Simulation::remove_masked_bodies(std::span<const uint8_t> keep, RemovalOrder order) {
+  switch (order) {
+  case RemovalOrder::STABLE:
+    compact_bodies(keep);
+    break;
+  case RemovalOrder::SWAP_WITH_LAST:
+    swap_remove_bodies(keep);
+    break;
+  }
+}
+
+uint32_t Simulation::add_body(float mass, vec3f position, vec3f vel, float radius) {
+  begin_body_edit();
+  if (radius > 0.0f && radii.size() != num_bodies) {
+    radii.assign(num_bodies, 0.0f);
+  }
+
+  uint32_t id = next_id++;
+  masses.push_back(mass);
+  mus.push_back(G * mass);
+  inv_mu.push_back(1.0f / G / mass);
+  ids.push_back(id);
+  positions.push_back(position);
+  vels.push_back(vel);
+  if (radii.size() == num_bodies) radii.push_back(radius);
+  simd_data.positions.push_back(XMLoadFloat3(&position));
+  simd_data.vels.push_back(XMLoadFloat3(&vel));
+  simd_data.accs.push_back(XMVectorZero());
+  num_bodies++;
+
+  // a massive body swaps places with the first test particle
+  if (mass != 0.0f) {
+    if (num_massive + 1 < num_bodies) {
+      for_each_body_array([&](auto &v) {
+        if (v.size() == num_bodies) std::swap(v[num_massive], v.back());
+      });
+    }
+    num_massive++;
+  }
+
+  end_body_edit();
+  return id;
+}
+
+size_t Simulation::remove_bodies(std::span<const uint32_t> remove_ids, RemovalOrder order) {
+  begin_body_edit();
+  std::vector<uint32_t> sorted_ids(remove_ids.begin(), remove_ids.end());
+  std::sort(sorted_ids.begin(), sorted_ids.end());
+
+  std::vector<uint8_t> keep(num_bodies);
+  size_t removed = 0;
+  for (size_t i = 0; i < num_bodies; i++) {
+    keep[i] = !std::binary_search(sorted_ids.begin(), sorted_ids.end(), ids[i]);
+    removed += !keep[i];
+  }
+  if (removed > 0) remove_masked_bodies(keep, order);
+
+  end_body_edit();
+  return removed;
+}
+
+size_t Simulation::remove_escapers(float radius, RemovalOrder order) {
+  begin_body_edit();
+
+  auto com = XMVectorZero();
+  float total_mu = 0.0f;
+  for (size_t i = 0; i < num_massive; i++) {
+    total_mu += mus[i];
+    com += mus[i] * simd_data.positions[i];
+  }
+  com = total_mu > 0.0f ? com / total_mu : com;
+
+  std::vector<uint8_t> keep(num_bodies);
+  float radius2 = radius * radius;
+  pool->for_each(keep.begin(), keep.end(),
+    [&](uint8_t &k) {
+      size_t i = &k - keep.data();
+      XMVECTOR diff = simd_data.positions[i] - com;
+      k = XMVectorGetX(XMVector3Dot(diff, diff)) <= radius2;
+    }
+  );
+  size_t removed = std::count(keep.begin(), keep.end(), 0);
+  if (removed > 0) remove_masked_bodies(keep, order);
+
+  end_body_edit();
+  return removed;
+}
+
+size_t Simulation::remove_unbound(RemovalOrder order) {
+  begin_body_edit();
+
+  auto com_vel = XMVectorZero();
+  float total_mu = 0.0f;
+  for (size_t i = 0; i < num_massive; i++) {
+    total_mu += mus[i];
+    com_vel += mus[i] * simd_data.vels[i];
+  }
+  com_vel = total_mu > 0.0f ? com_vel / total_mu : com_vel;
+
+  // specific kinetic plus potential energy of each body against every other massive body
+  std::vector<uint8_t> keep(num_bodies);
+  pool->for_each(keep.begin(), keep.end(),
+    [&](uint8_t &k) {
+      size_t i = &k - keep.data();
+      XMVECTOR vel = simd_data.vels[i] - com_vel;
+      float energy = 0.5f * XMVectorGetX(XMVector3Dot(vel, vel));
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        energy -= mus[j] / XMVectorGetX(XMVector3Length(simd_data.positions[j] - simd_data.positions[i]));
+      }
+      k = energy <= 0.0f;
+    }
+  );
+  size_t removed = std::count(keep.begin(), keep.end(), 0);
+  if (removed > 0) remove_masked_bodies(keep, order);
+
+  end_body_edit();
+  return removed;
+}
+
+} // namespace gravitysim
@@ -0,0 +1,215 @@
+#include "catalog_loader.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+namespace gravitysim {
+
+namespace {
+
+constexpr size_t COLUMNS = 7;
+// pieces smaller than this are not worth a task
+constexpr size_t MIN_PIECE_BYTES = 1 << 16;
+
+// read-only view of a whole file, empty if it could not be mapped
+class MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+
+public:
+  bool opened = false;
+
+  explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) return;
+    size = static_cast<size_t>(file_size.QuadPart);
+    opened = true;
+    if (size == 0) return;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    opened = data != nullptr;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    if (::fstat(fd, &info) == 0) {
+      size = static_cast<size_t>(info.st_size);
+      opened = true;
+      if (size > 0) {
+        void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          // pieces are read front to back
+          ::madvise(p, size, MADV_SEQUENTIAL);
+          data = static_cast<const char *>(p);
+        }
+        opened = data != nullptr;
+      }
+    }
+    ::close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+    if (data) ::munmap(const_cast<char *>(data), size);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  inline std::string_view text() const { return data ? std::string_view(data, size) : std::string_view(); }
+};
+
+inline bool is_separator(char c) {
+  return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r';
+}
+
+// kinds of line, decided by the first character that is not a separator
+enum class LineKind { BLANK, COMMENT, TEXT, DATA };
+
+LineKind classify(const char *p, const char *end) {
+  while (p < end && is_separator(*p)) p++;
+  if (p == end) return LineKind::BLANK;
+  if (*p == '#') return LineKind::COMMENT;
+  // nan and inf are the only numbers that start with a letter, neither makes sense here
+  if (std::isalpha(static_cast<unsigned char>(*p))) return LineKind::TEXT;
+  return LineKind::DATA;
+}
+
+// parses the first COLUMNS values of a data line
+bool parse_row(const char *p, const char *end, float (&values)[COLUMNS]) {
+  for (size_t k = 0; k < COLUMNS; k++) {
+    while (p < end && is_separator(*p)) p++;
+    if (p < end && *p == '+') p++;
+    auto [next, ec] = std::from_chars(p, end, values[k]);
+    if (ec != std::errc() || (next < end && !is_separator(*next))) return false;
+    p = next;
+  }
+  return true;
+}
+
+inline const char *line_end(const char *p, const char *end) {
+  const void *newline = std::memchr(p, '\n', end - p);
+  return newline ? static_cast<const char *>(newline) : end;
+}
+
+} // namespace
+
+bool parse_catalog(std::string_view text, InitialConditions &ics, size_t *error_line, ThreadPool &pool) {
+  ics = {};
+  const char *begin = text.data(), *end = text.data() + text.size();
+
+  // pieces start just after a newline so no line is split
+  size_t num_pieces = std::clamp<size_t>(text.size() / MIN_PIECE_BYTES, 1, 4 * pool.size());
+  std::vector<const char *> starts(num_pieces + 1, end);
+  starts[0] = begin;
+  for (size_t k = 1; k < num_pieces; k++) {
+    const char *p = std::max(begin + text.size() * k / num_pieces, starts[k - 1]);
+    starts[k] = p == end ? end : std::min(end, line_end(p, end) + 1);
+  }
+
+  // a leading line of text is a header, anywhere else it is an error
+  const char *header_end = begin;
+  for (const char *p = begin; p < end;) {
+    const char *e = line_end(p, end);
+    LineKind kind = classify(p, e);
+    if (kind == LineKind::TEXT) header_end = e;
+    if (kind == LineKind::TEXT || kind == LineKind::DATA) break;
+    p = e + 1;
+  }
+
+  // first pass counts the rows and lines of each piece
+  std::vector<size_t> rows(num_pieces + 1, 0), lines(num_pieces + 1, 0);
+  pool.parallel_for(num_pieces, [&](size_t first, size_t last) {
+    for (size_t k = first; k < last; k++) {
+      for (const char *p = starts[k]; p < starts[k + 1];) {
+        const char *e = line_end(p, starts[k + 1]);
+        LineKind kind = classify(p, e);
+        if (p >= header_end && kind != LineKind::BLANK && kind != LineKind::COMMENT) rows[k + 1]++;
+        lines[k + 1]++;
+        p = e + 1;
+      }
+    }
+  });
+  for (size_t k = 0; k < num_pieces; k++) {
+    rows[k + 1] += rows[k];
+    lines[k + 1] += lines[k];
+  }
+
+  size_t n = rows[num_pieces];
+  ics.masses.resize(n);
+  ics.positions.resize(n);
+  ics.vels.resize(n);
+
+  // second pass writes each row at its index, remembering the first bad line
+  std::atomic<size_t> bad_line = SIZE_MAX;
+  pool.parallel_for(num_pieces, [&](size_t first, size_t last) {
+    for (size_t k = first; k < last; k++) {
+      size_t row = rows[k], line = lines[k];
+      for (const char *p = starts[k]; p < starts[k + 1]; line++) {
+        const char *e = line_end(p, starts[k + 1]);
+        LineKind kind = classify(p, e);
+        float values[COLUMNS];
+        if (p >= header_end && kind != LineKind::BLANK && kind != LineKind::COMMENT) {
+          if (kind == LineKind::TEXT || !parse_row(p, e, values)) {
+            size_t current = bad_line.load(std::memory_order_relaxed);
+            while (line < current && !bad_line.compare_exchange_weak(current, line, std::memory_order_relaxed)) {}
+            break;
+          }
+          ics.masses[row] = values[0];
+          ics.positions[row] = {values[1], values[2], values[3]};
+          ics.vels[row] = {values[4], values[5], values[6]};
+          row++;
+        }
+        p = e + 1;
+      }
+    }
+  });
+
+  if (bad_line.load() != SIZE_MAX) {
+    if (error_line) *error_line = bad_line.load() + 1;
+    ics = {};
+    return false;
+  }
+  return true;
+}
+
+bool load_catalog(const std::string &path, InitialConditions &ics, size_t *error_line, ThreadPool &pool) {
+  MappedFile file(path);
+  if (!file.opened) {
+    ics = {};
+    if (error_line) *error_line = 0;
+    return false;
+  }
+  return parse_catalog(file.text(), ics, error_line, pool);
+}
+
+} // namespace gravitysim
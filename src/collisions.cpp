@@ -0,0 +1,81 @@
+#include "simulation.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+void Simulation::resolve_collisions() {
+  PhaseScope phase(step_profiler, StepPhase::COLLISIONS);
+  if (num_bodies < 2) return;
+  float max_radius = *std::max_element(radii.begin(), radii.end());
+  if (!(max_radius > 0.0f)) return;
+
+  // any overlapping pair is in neighbouring cells of this size
+  spatial_hash.build(simd_data.positions, 2.0f * max_radius, box_size, *pool);
+  // separations across the periodic box go to the nearest image
+  XMVECTOR box = XMVectorReplicate(box_size);
+  XMVECTOR inv_box = XMVectorReplicate(box_size > 0.0f ? 1.0f / box_size : 0.0f);
+  auto separation = [&](FXMVECTOR from, FXMVECTOR to) {
+    XMVECTOR diff = to - from;
+    return diff - box * XMVectorRound(diff * inv_box);
+  };
+
+  // scratch is reused by the resolve of every substep
+  Arena::Scope scope(*step_arena);
+
+  // each body finds the lowest indexed body it overlaps, or itself
+  std::span<uint32_t> collision_partner = step_arena->allocate_array<uint32_t>(num_bodies);
+  pool->for_each(collision_partner.begin(), collision_partner.end(),
+    [&](uint32_t &partner) {
+      uint32_t i = static_cast<uint32_t>(&partner - collision_partner.data());
+      partner = i;
+      XMVECTOR p = simd_data.positions[i];
+      spatial_hash.for_each_neighbour(p, [&](uint32_t j) {
+        if (j >= partner) return;
+        // test particles do not collide with each other
+        if (masses[i] == 0.0f && masses[j] == 0.0f) return;
+        XMVECTOR diff = separation(p, simd_data.positions[j]);
+        float reach = radii[i] + radii[j];
+        if (XMVectorGetX(XMVector3Dot(diff, diff)) < reach * reach) partner = j;
+      });
+    }
+  );
+
+  std::span<uint8_t> keep;
+  for (uint32_t i = 0; i < num_bodies; i++) {
+    if (collision_partner[i] == i) continue;
+    if (keep.empty()) {
+      keep = step_arena->allocate_array<uint8_t>(num_bodies);
+      std::fill(keep.begin(), keep.end(), 1);
+    }
+
+    // partners have lower indices, so theirs are already resolved to a surviving body
+    uint32_t root = collision_partner[collision_partner[i]];
+    collision_partner[i] = root;
+
+    // momentum conserving merge of i into root
+    float mass = masses[root] + masses[i];
+    if (mass > 0.0f) {
+      float w_root = masses[root] / mass;
+      float w_i = masses[i] / mass;
+      // i's nearest image, so a merge across the boundary stays next to both bodies
+      XMVECTOR p_i = simd_data.positions[root] + separation(simd_data.positions[root], simd_data.positions[i]);
+      simd_data.positions[root] = w_root * simd_data.positions[root] + w_i * p_i;
+      simd_data.vels[root] = w_root * simd_data.vels[root] + w_i * simd_data.vels[i];
+    }
+    radii[root] = std::cbrt(radii[root] * radii[root] * radii[root] + radii[i] * radii[i] * radii[i]);
+    masses[root] = mass;
+    mus[root] = G * mass;
+    inv_mu[root] = 1.0f / G / mass;
+    keep[i] = 0;
+  }
+
+  if (keep.empty()) return;
+  compact_bodies(keep);
+  // a merge across the boundary can land just outside the box
+  if (box_size > 0.0f) wrap_simd_positions();
+}
+
+} // namespace gravitysim
@@ -0,0 +1,130 @@
+#include "ensemble.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+Ensemble::Ensemble(size_t num_systems, size_t num_bodies, float time_step)
+    : num_systems(num_systems), num_bodies(num_bodies),
+      num_groups((num_systems + LANES - 1) / LANES), time_step(time_step) {
+  positions.resize(num_groups * num_bodies * 3);
+  vels.assign(num_groups * num_bodies * 3, XMVectorZero());
+  accs.assign(num_groups * num_bodies * 3, XMVectorZero());
+  masses.assign(num_groups * num_bodies, XMVectorZero());
+  // bodies start apart so unused lanes never divide by zero
+  for (size_t g = 0; g < num_groups; g++) {
+    for (size_t b = 0; b < num_bodies; b++) {
+      size_t p = (g * num_bodies + b) * 3;
+      positions[p] = XMVectorReplicate(static_cast<float>(b));
+      positions[p + 1] = XMVectorZero();
+      positions[p + 2] = XMVectorZero();
+    }
+  }
+}
+
+void Ensemble::set_G(float G) {
+  this->G = G;
+}
+
+void Ensemble::set_body(size_t system, size_t body, float mass, XMFLOAT3 position, XMFLOAT3 vel) {
+  assert(system < num_systems && body < num_bodies);
+  size_t lane = system % LANES;
+  size_t p = component(system, body, 0);
+  const float pos[3] = {position.x, position.y, position.z};
+  const float vel_[3] = {vel.x, vel.y, vel.z};
+  for (size_t c = 0; c < 3; c++) {
+    positions[p + c] = XMVectorSetByIndex(positions[p + c], pos[c], lane);
+    vels[p + c] = XMVectorSetByIndex(vels[p + c], vel_[c], lane);
+  }
+  size_t m = system / LANES * num_bodies + body;
+  masses[m] = XMVectorSetByIndex(masses[m], mass, lane);
+}
+
+XMFLOAT3 Ensemble::get_position(size_t system, size_t body) const {
+  size_t lane = system % LANES;
+  size_t p = component(system, body, 0);
+  return {XMVectorGetByIndex(positions[p], lane), XMVectorGetByIndex(positions[p + 1], lane),
+          XMVectorGetByIndex(positions[p + 2], lane)};
+}
+
+XMFLOAT3 Ensemble::get_vel(size_t system, size_t body) const {
+  size_t lane = system % LANES;
+  size_t p = component(system, body, 0);
+  return {XMVectorGetByIndex(vels[p], lane), XMVectorGetByIndex(vels[p + 1], lane),
+          XMVectorGetByIndex(vels[p + 2], lane)};
+}
+
+double Ensemble::get_energy(size_t system) const {
+  double energy = 0.0;
+  for (size_t i = 0; i < num_bodies; i++) {
+    double mass_i = XMVectorGetByIndex(masses[system / LANES * num_bodies + i], system % LANES);
+    XMFLOAT3 vi = get_vel(system, i);
+    XMFLOAT3 pi = get_position(system, i);
+    energy += 0.5 * mass_i * (double(vi.x) * vi.x + double(vi.y) * vi.y + double(vi.z) * vi.z);
+    for (size_t j = i + 1; j < num_bodies; j++) {
+      double mass_j = XMVectorGetByIndex(masses[system / LANES * num_bodies + j], system % LANES);
+      XMFLOAT3 pj = get_position(system, j);
+      double dx = pj.x - pi.x, dy = pj.y - pi.y, dz = pj.z - pi.z;
+      energy -= G * mass_i * mass_j / std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+  }
+  return energy;
+}
+
+void Ensemble::calc_accs(size_t g) {
+  XMVECTOR *pos = &positions[g * num_bodies * 3];
+  XMVECTOR *acc = &accs[g * num_bodies * 3];
+  const XMVECTOR *mass = &masses[g * num_bodies];
+  XMVECTOR vG = XMVectorReplicate(G);
+
+  std::fill(acc, acc + num_bodies * 3, XMVectorZero());
+  // every pair once, each lane is a different system
+  for (size_t i = 0; i < num_bodies; i++) {
+    XMVECTOR mu_i = vG * mass[i];
+    for (size_t j = i + 1; j < num_bodies; j++) {
+      XMVECTOR mu_j = vG * mass[j];
+      XMVECTOR dx = pos[j * 3] - pos[i * 3];
+      XMVECTOR dy = pos[j * 3 + 1] - pos[i * 3 + 1];
+      XMVECTOR dz = pos[j * 3 + 2] - pos[i * 3 + 2];
+      XMVECTOR r2 = XMVectorMultiplyAdd(dx, dx, XMVectorMultiplyAdd(dy, dy, dz * dz));
+      XMVECTOR inv_r3 = XMVectorReciprocal(r2 * XMVectorSqrt(r2));
+      XMVECTOR s_i = mu_j * inv_r3;
+      XMVECTOR s_j = mu_i * inv_r3;
+      acc[i * 3] = XMVectorMultiplyAdd(s_i, dx, acc[i * 3]);
+      acc[i * 3 + 1] = XMVectorMultiplyAdd(s_i, dy, acc[i * 3 + 1]);
+      acc[i * 3 + 2] = XMVectorMultiplyAdd(s_i, dz, acc[i * 3 + 2]);
+      acc[j * 3] = XMVectorNegativeMultiplySubtract(s_j, dx, acc[j * 3]);
+      acc[j * 3 + 1] = XMVectorNegativeMultiplySubtract(s_j, dy, acc[j * 3 + 1]);
+      acc[j * 3 + 2] = XMVectorNegativeMultiplySubtract(s_j, dz, acc[j * 3 + 2]);
+    }
+  }
+}
+
+void Ensemble::step(size_t num_steps) {
+  // each group runs all its steps while its few bodies stay in cache
+  default_thread_pool().parallel_for(num_groups, [&](size_t first_group, size_t last_group) {
+    for (size_t g = first_group; g < last_group; g++) {
+      XMVECTOR *pos = &positions[g * num_bodies * 3];
+      XMVECTOR *vel = &vels[g * num_bodies * 3];
+      const XMVECTOR *acc = &accs[g * num_bodies * 3];
+      size_t n = num_bodies * 3;
+      XMVECTOR half_dt = XMVectorReplicate(0.5f * time_step);
+      XMVECTOR dt = XMVectorReplicate(time_step);
+
+      // drift-kick-drift
+      for (size_t s = 0; s < num_steps; s++) {
+        for (size_t k = 0; k < n; k++) pos[k] = XMVectorMultiplyAdd(vel[k], half_dt, pos[k]);
+        calc_accs(g);
+        for (size_t k = 0; k < n; k++) vel[k] = XMVectorMultiplyAdd(acc[k], dt, vel[k]);
+        for (size_t k = 0; k < n; k++) pos[k] = XMVectorMultiplyAdd(vel[k], half_dt, pos[k]);
+      }
+    }
+  });
+}
+
+} // namespace gravitysim
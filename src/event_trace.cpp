@@ -0,0 +1,199 @@
+#include "event_trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gravitysim {
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  const char *category;
+  // since the trace epoch
+  uint64_t ns;
+  // 'B' or 'E'
+  char phase;
+};
+
+// Events of one thread in a list of fixed chunks. Only the owning thread
+// appends, and it publishes the count after the event is written, so readers
+// see every event below published without locking.
+struct TraceBuffer {
+  static constexpr size_t CHUNK_SIZE = 4096;
+  struct Chunk {
+    std::array<TraceEvent, CHUNK_SIZE> events;
+    std::atomic<Chunk *> next = nullptr;
+  };
+
+  std::unique_ptr<Chunk> head = std::make_unique<Chunk>();
+  // owner only
+  Chunk *tail = head.get();
+  size_t tail_count = 0;
+
+  std::atomic<size_t> published = 0;
+  // events below this were cleared
+  std::atomic<size_t> first = 0;
+  uint32_t tid = 0;
+  // guarded by the registry mutex
+  std::string name;
+
+  ~TraceBuffer() {
+    Chunk *chunk = head.release();
+    while (chunk) {
+      Chunk *next = chunk->next.load(std::memory_order_relaxed);
+      delete chunk;
+      chunk = next;
+    }
+  }
+
+  void push(const TraceEvent &event) {
+    if (tail_count == CHUNK_SIZE) {
+      Chunk *chunk = new Chunk;
+      tail->next.store(chunk, std::memory_order_release);
+      tail = chunk;
+      tail_count = 0;
+    }
+    tail->events[tail_count++] = event;
+    published.store(published.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+};
+
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  std::atomic<bool> enabled = false;
+};
+
+// never destroyed, threads of static pools can outlive any static registry
+TraceRegistry &registry() {
+  static TraceRegistry *r = new TraceRegistry;
+  return *r;
+}
+
+thread_local TraceBuffer *local_buffer = nullptr;
+// kept until the thread records its first event, so naming a thread allocates no buffer
+thread_local std::string local_name;
+
+TraceBuffer &thread_buffer() {
+  if (!local_buffer) {
+    TraceRegistry &r = registry();
+    std::lock_guard lock(r.mutex);
+    r.buffers.push_back(std::make_unique<TraceBuffer>());
+    local_buffer = r.buffers.back().get();
+    local_buffer->tid = static_cast<uint32_t>(r.buffers.size());
+    local_buffer->name = local_name;
+  }
+  return *local_buffer;
+}
+
+void record(const char *name, const char *category, char phase) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch);
+  thread_buffer().push({name, category, static_cast<uint64_t>(ns.count()), phase});
+}
+
+void write_json_string(std::ostream &out, const char *s) {
+  out << '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      out << '\\' << *s;
+    } else if (static_cast<unsigned char>(*s) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(*s));
+      out << escaped;
+    } else {
+      out << *s;
+    }
+  }
+  out << '"';
+}
+
+} // namespace
+
+void set_tracing(bool enabled) {
+  registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool tracing_enabled() {
+  return registry().enabled.load(std::memory_order_relaxed);
+}
+
+void trace_begin(const char *name, const char *category) {
+  record(name, category, 'B');
+}
+
+void trace_end(const char *name, const char *category) {
+  record(name, category, 'E');
+}
+
+void set_trace_thread_name(const std::string &name) {
+  local_name = name;
+  if (!local_buffer) return;
+  std::lock_guard lock(registry().mutex);
+  local_buffer->name = name;
+}
+
+void clear_trace() {
+  TraceRegistry &r = registry();
+  std::lock_guard lock(r.mutex);
+  for (auto &buffer : r.buffers) {
+    buffer->first.store(buffer->published.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+}
+
+void write_chrome_trace(std::ostream &out) {
+  TraceRegistry &r = registry();
+  std::lock_guard lock(r.mutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first_event = true;
+  auto separator = [&] {
+    if (!first_event) out << ",";
+    out << "\n";
+    first_event = false;
+  };
+
+  char ts[32];
+  for (const auto &buffer : r.buffers) {
+    separator();
+    std::string name = buffer->name.empty() ? "thread " + std::to_string(buffer->tid) : buffer->name;
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"name\":";
+    write_json_string(out, name.c_str());
+    out << "}}";
+
+    size_t end = buffer->published.load(std::memory_order_acquire);
+    size_t begin = buffer->first.load(std::memory_order_relaxed);
+    const TraceBuffer::Chunk *chunk = buffer->head.get();
+    for (size_t k = 0; k < end; k++) {
+      if (k > 0 && k % TraceBuffer::CHUNK_SIZE == 0) chunk = chunk->next.load(std::memory_order_acquire);
+      if (k < begin) continue;
+      const TraceEvent &event = chunk->events[k % TraceBuffer::CHUNK_SIZE];
+      separator();
+      out << "{\"name\":";
+      write_json_string(out, event.name);
+      out << ",\"cat\":";
+      write_json_string(out, event.category);
+      // microseconds, keeping the nanoseconds
+      std::snprintf(ts, sizeof(ts), "%llu.%03llu", static_cast<unsigned long long>(event.ns / 1000),
+                    static_cast<unsigned long long>(event.ns % 1000));
+      out << ",\"ph\":\"" << event.phase << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << buffer->tid << "}";
+    }
+  }
+  out << "\n]}\n";
+}
+
+bool write_chrome_trace(const std::string &path) {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file) return false;
+  write_chrome_trace(file);
+  return static_cast<bool>(file.flush());
+}
+
+} // namespace gravitysim
@@ -0,0 +1,88 @@
+#include "ewald.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+// splitting parameter for a unit box, |n| and |h| up to 4 converge to double precision
+static constexpr double EWALD_ALPHA = 2.0;
+static constexpr int EWALD_RANGE = 4;
+static constexpr int EWALD_MAX_H2 = 10;
+
+dvec3 ewald_correction(const dvec3 &d) {
+  constexpr double pi = std::numbers::pi;
+  constexpr double alpha = EWALD_ALPHA;
+  dvec3 acc = {0.0, 0.0, 0.0};
+  if (dot(d, d) == 0.0) return acc;
+
+  // real space, screened images, the Newtonian d / |d|^3 of the nearest image is left out
+  for (int nz = -EWALD_RANGE; nz <= EWALD_RANGE; nz++) {
+    for (int ny = -EWALD_RANGE; ny <= EWALD_RANGE; ny++) {
+      for (int nx = -EWALD_RANGE; nx <= EWALD_RANGE; nx++) {
+        dvec3 diff = d + dvec3{double(nx), double(ny), double(nz)};
+        double r = std::sqrt(dot(diff, diff));
+        // erfc(6) is below double precision
+        if (alpha * r > 6.0) continue;
+        double screen = std::erfc(alpha * r) + 2.0 * alpha * r / std::sqrt(pi) * std::exp(-alpha * alpha * r * r);
+        if (nx == 0 && ny == 0 && nz == 0) screen -= 1.0;
+        acc += (screen / (r * r * r)) * diff;
+      }
+    }
+  }
+
+  // reciprocal space
+  for (int hz = -EWALD_RANGE; hz <= EWALD_RANGE; hz++) {
+    for (int hy = -EWALD_RANGE; hy <= EWALD_RANGE; hy++) {
+      for (int hx = -EWALD_RANGE; hx <= EWALD_RANGE; hx++) {
+        int h2 = hx * hx + hy * hy + hz * hz;
+        if (h2 == 0 || h2 > EWALD_MAX_H2) continue;
+        dvec3 h = {double(hx), double(hy), double(hz)};
+        double w = 2.0 / h2 * std::exp(-pi * pi * h2 / (alpha * alpha)) * std::sin(2.0 * pi * dot(h, d));
+        acc += w * h;
+      }
+    }
+  }
+  return acc;
+}
+
+void EwaldTable::build() {
+  constexpr uint32_t side = CELLS + 1;
+  table.resize(side * side * side);
+  default_thread_pool().for_each(table.begin(), table.end(),
+    [&](XMFLOAT3 &c) {
+      uint32_t k = static_cast<uint32_t>(&c - table.data());
+      dvec3 d = {0.5 * (k % side) / CELLS, 0.5 * (k / side % side) / CELLS, 0.5 * (k / side / side) / CELLS};
+      dvec3 corr = ewald_correction(d);
+      c = {float(corr.x), float(corr.y), float(corr.z)};
+    }
+  );
+}
+
+XMVECTOR EwaldTable::correction(FXMVECTOR d) const {
+  // the table covers |d| in [0, 0.5] per axis, other octants follow by sign
+  XMVECTOR sign = XMVectorOrInt(XMVectorAndInt(d, XMVectorSplatSignMask()), XMVectorSplatOne());
+  XMVECTOR u = XMVectorClamp(XMVectorAbs(d) * (2.0f * CELLS), XMVectorZero(), XMVectorReplicate(float(CELLS)));
+  XMVECTOR cell = XMVectorMin(XMVectorFloor(u), XMVectorReplicate(float(CELLS - 1)));
+  XMVECTOR t = u - cell;
+
+  XMFLOAT3 c, f;
+  XMStoreFloat3(&c, cell);
+  XMStoreFloat3(&f, t);
+  uint32_t x = static_cast<uint32_t>(c.x), y = static_cast<uint32_t>(c.y), z = static_cast<uint32_t>(c.z);
+
+  auto load = [&](uint32_t dx, uint32_t dy, uint32_t dz) { return XMLoadFloat3(&at(x + dx, y + dy, z + dz)); };
+  XMVECTOR c00 = XMVectorLerp(load(0, 0, 0), load(1, 0, 0), f.x);
+  XMVECTOR c10 = XMVectorLerp(load(0, 1, 0), load(1, 1, 0), f.x);
+  XMVECTOR c01 = XMVectorLerp(load(0, 0, 1), load(1, 0, 1), f.x);
+  XMVECTOR c11 = XMVectorLerp(load(0, 1, 1), load(1, 1, 1), f.x);
+  XMVECTOR c0 = XMVectorLerp(c00, c10, f.y);
+  XMVECTOR c1 = XMVectorLerp(c01, c11, f.y);
+  return XMVectorLerp(c0, c1, f.z) * sign;
+}
+
+} // namespace gravitysim
@@ -0,0 +1,280 @@
+#include "gadget_io.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include "event_trace.hpp"
+#include "memory_tracker.hpp"
+
+namespace gravitysim {
+
+namespace {
+
+constexpr uint32_t HEADER_BYTES = 256;
+// values converted per read when the file's precision differs from ours
+constexpr size_t BUFFER_VALUES = 1 << 16;
+
+template <class T>
+bool read_pod(std::ifstream &file, T &value) {
+  return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+template <class T>
+void write_pod(std::ofstream &file, const T &value) {
+  file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+void take_pod(const uint8_t *&p, T &value) {
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+}
+
+template <class T>
+void put_pod(uint8_t *&p, const T &value) {
+  std::memcpy(p, &value, sizeof(T));
+  p += sizeof(T);
+}
+
+// the block before each data block: 8, label, size of the next block, 8
+bool read_label(std::ifstream &file, std::string &label) {
+  uint32_t begin, next, end;
+  char name[4];
+  if (!read_pod(file, begin)) return false;
+  if (!file.read(name, sizeof(name)) || !read_pod(file, next) || !read_pod(file, end) || begin != 8 || end != 8) {
+    return false;
+  }
+  label.assign(name, sizeof(name));
+  return true;
+}
+
+inline bool skip(std::ifstream &file, uint64_t bytes) {
+  return static_cast<bool>(file.seekg(static_cast<std::streamoff>(bytes), std::ios::cur));
+}
+
+// reads count numbers stored as From into dst, through a buffer if they need converting
+template <class To, class From>
+bool read_converted(std::ifstream &file, size_t count, To *dst, std::vector<From> &buffer) {
+  if constexpr (std::is_same_v<To, From>) {
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(dst), count * sizeof(To)));
+  } else {
+    for (size_t done = 0; done < count;) {
+      size_t m = std::min(BUFFER_VALUES, count - done);
+      buffer.resize(m);
+      if (!file.read(reinterpret_cast<char *>(buffer.data()), m * sizeof(From))) return false;
+      std::transform(buffer.begin(), buffer.end(), dst + done, [](From v) { return static_cast<To>(v); });
+      done += m;
+    }
+    return true;
+  }
+}
+
+bool read_floats(std::ifstream &file, size_t value_size, size_t count, float *dst, std::vector<double> &buffer) {
+  if (value_size == sizeof(float)) {
+    std::vector<float> unused;
+    return read_converted(file, count, dst, unused);
+  }
+  return value_size == sizeof(double) && read_converted(file, count, dst, buffer);
+}
+
+bool read_ids(std::ifstream &file, size_t value_size, size_t count, uint32_t *dst, std::vector<uint64_t> &buffer) {
+  if (value_size == sizeof(uint32_t)) {
+    std::vector<uint32_t> unused;
+    return read_converted(file, count, dst, unused);
+  }
+  return value_size == sizeof(uint64_t) && read_converted(file, count, dst, buffer);
+}
+
+void parse_header(const uint8_t *p, GadgetHeader &header) {
+  for (auto &n : header.npart) take_pod(p, n);
+  for (auto &m : header.mass) take_pod(p, m);
+  take_pod(p, header.time);
+  take_pod(p, header.redshift);
+  take_pod(p, header.flag_sfr);
+  take_pod(p, header.flag_feedback);
+  for (auto &n : header.npart_total) take_pod(p, n);
+  take_pod(p, header.flag_cooling);
+  take_pod(p, header.num_files);
+  take_pod(p, header.box_size);
+  take_pod(p, header.omega0);
+  take_pod(p, header.omega_lambda);
+  take_pod(p, header.hubble_param);
+  take_pod(p, header.flag_stellarage);
+  take_pod(p, header.flag_metals);
+  for (auto &n : header.npart_total_high_word) take_pod(p, n);
+  take_pod(p, header.flag_entropy_instead_u);
+}
+
+void serialize_header(const GadgetHeader &header, uint8_t *p) {
+  std::memset(p, 0, HEADER_BYTES);
+  for (auto n : header.npart) put_pod(p, n);
+  for (auto m : header.mass) put_pod(p, m);
+  put_pod(p, header.time);
+  put_pod(p, header.redshift);
+  put_pod(p, header.flag_sfr);
+  put_pod(p, header.flag_feedback);
+  for (auto n : header.npart_total) put_pod(p, n);
+  put_pod(p, header.flag_cooling);
+  put_pod(p, header.num_files);
+  put_pod(p, header.box_size);
+  put_pod(p, header.omega0);
+  put_pod(p, header.omega_lambda);
+  put_pod(p, header.hubble_param);
+  put_pod(p, header.flag_stellarage);
+  put_pod(p, header.flag_metals);
+  for (auto n : header.npart_total_high_word) put_pod(p, n);
+  put_pod(p, header.flag_entropy_instead_u);
+}
+
+// writes the label block and the block around the payload that write_payload produces
+template <class F>
+bool write_block(std::ofstream &file, const char (&label)[5], uint64_t payload, F &&write_payload) {
+  if (payload > UINT32_MAX - 8) return false;
+  uint32_t size = static_cast<uint32_t>(payload);
+  write_pod(file, uint32_t(8));
+  file.write(label, 4);
+  write_pod(file, size + 8);
+  write_pod(file, uint32_t(8));
+  write_pod(file, size);
+  write_payload();
+  write_pod(file, size);
+  return static_cast<bool>(file);
+}
+
+void write_vec3s(std::ofstream &file, const Vec3View &values) {
+  OutputArray<vec3f> buffer;
+  for (size_t done = 0; done < values.size();) {
+    size_t m = std::min(BUFFER_VALUES, values.size() - done);
+    buffer.resize(m);
+    for (size_t i = 0; i < m; i++) buffer[i] = values[done + i];
+    file.write(reinterpret_cast<const char *>(buffer.data()), m * sizeof(vec3f));
+    done += m;
+  }
+}
+
+} // namespace
+
+bool read_gadget(const std::string &path, InitialConditions &ics, std::vector<uint32_t> *ids, GadgetHeader *header,
+                 uint32_t type_mask) {
+  ics = {};
+  std::ifstream file(path, std::ios::binary);
+  std::string label;
+  uint32_t size, end_size;
+  uint8_t raw_header[HEADER_BYTES];
+  if (!file || !read_label(file, label) || label != "HEAD" || !read_pod(file, size) || size != HEADER_BYTES ||
+      !file.read(reinterpret_cast<char *>(raw_header), HEADER_BYTES) || !read_pod(file, end_size) ||
+      end_size != HEADER_BYTES) {
+    return false;
+  }
+  GadgetHeader h;
+  parse_header(raw_header, h);
+  if (h.num_files > 1) return false;
+
+  // where each selected type starts among the bodies
+  std::array<size_t, GADGET_TYPES> first_body = {};
+  size_t n = 0, in_file = 0, variable_mass = 0;
+  for (size_t t = 0; t < GADGET_TYPES; t++) {
+    first_body[t] = n;
+    if (type_mask & (1u << t)) n += h.npart[t];
+    in_file += h.npart[t];
+    if (h.mass[t] == 0.0) variable_mass += h.npart[t];
+  }
+  ics.masses.resize(n);
+  ics.positions.resize(n);
+  ics.vels.resize(n);
+  if (ids) ids->assign(n, 0);
+  for (size_t t = 0; t < GADGET_TYPES; t++) {
+    if ((type_mask & (1u << t)) && h.mass[t] != 0.0) {
+      std::fill_n(ics.masses.begin() + first_body[t], h.npart[t], static_cast<float>(h.mass[t]));
+    }
+  }
+
+  std::vector<double> float_buffer;
+  std::vector<uint64_t> id_buffer;
+  bool has_positions = false;
+  while (read_label(file, label)) {
+    if (!read_pod(file, size)) return false;
+    bool ok = true;
+    if ((label == "POS " || label == "VEL ") && in_file > 0) {
+      size_t value_size = size / (3 * in_file);
+      ok = value_size * 3 * in_file == size;
+      auto &dst = label == "POS " ? ics.positions : ics.vels;
+      for (size_t t = 0; t < GADGET_TYPES && ok; t++) {
+        size_t count = 3 * size_t(h.npart[t]);
+        float *values = reinterpret_cast<float *>(dst.data() + first_body[t]);
+        ok = (type_mask & (1u << t)) ? read_floats(file, value_size, count, values, float_buffer)
+                                     : skip(file, count * value_size);
+      }
+      has_positions = has_positions || label == "POS ";
+    } else if (label == "ID  " && ids && in_file > 0) {
+      size_t value_size = size / in_file;
+      ok = value_size * in_file == size;
+      for (size_t t = 0; t < GADGET_TYPES && ok; t++) {
+        ok = (type_mask & (1u << t)) ? read_ids(file, value_size, h.npart[t], ids->data() + first_body[t], id_buffer)
+                                     : skip(file, h.npart[t] * value_size);
+      }
+    } else if (label == "MASS" && variable_mass > 0) {
+      // only types without a mass in the header are in the block
+      size_t value_size = size / variable_mass;
+      ok = value_size * variable_mass == size;
+      for (size_t t = 0; t < GADGET_TYPES && ok; t++) {
+        if (h.mass[t] != 0.0) continue;
+        ok = (type_mask & (1u << t))
+               ? read_floats(file, value_size, h.npart[t], ics.masses.data() + first_body[t], float_buffer)
+               : skip(file, h.npart[t] * value_size);
+      }
+    } else {
+      ok = skip(file, size);
+    }
+    if (!ok || !read_pod(file, end_size) || end_size != size) {
+      ics = {};
+      return false;
+    }
+  }
+
+  if (!has_positions && n > 0) {
+    ics = {};
+    return false;
+  }
+  if (header) *header = h;
+  return true;
+}
+
+bool write_gadget(const std::string &path, Simulation &simulation, double time, uint32_t type) {
+  TraceScope trace("write gadget", "io");
+  if (type >= GADGET_TYPES) return false;
+  size_t n = simulation.get_num_bodies();
+  if (n > UINT32_MAX) return false;
+  const auto &masses = simulation.get_masses();
+  bool equal_masses = n > 0 && std::all_of(masses.begin(), masses.end(), [&](float m) { return m == masses[0]; });
+
+  GadgetHeader h;
+  h.npart[type] = static_cast<uint32_t>(n);
+  h.npart_total[type] = static_cast<uint32_t>(n);
+  h.mass[type] = equal_masses ? masses[0] : 0.0;
+  h.time = time;
+  uint8_t raw_header[HEADER_BYTES];
+  serialize_header(h, raw_header);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  bool ok = write_block(file, "HEAD", HEADER_BYTES, [&] {
+    file.write(reinterpret_cast<const char *>(raw_header), HEADER_BYTES);
+  });
+  ok = ok && write_block(file, "POS ", n * sizeof(vec3f), [&] { write_vec3s(file, simulation.view_positions()); });
+  ok = ok && write_block(file, "VEL ", n * sizeof(vec3f), [&] { write_vec3s(file, simulation.view_vels()); });
+  const auto &ids = simulation.get_ids();
+  ok = ok && write_block(file, "ID  ", n * sizeof(uint32_t), [&] {
+    file.write(reinterpret_cast<const char *>(ids.data()), n * sizeof(uint32_t));
+  });
+  if (!equal_masses) {
+    ok = ok && write_block(file, "MASS", n * sizeof(float), [&] {
+      file.write(reinterpret_cast<const char *>(masses.data()), n * sizeof(float));
+    });
+  }
+  return ok;
+}
+
+} // namespace gravitysim
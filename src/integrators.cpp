@@ -0,0 +1,529 @@
+#include "simulation.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+void Simulation::step_cpu() {
+  switch (integrator) {
+  case Integrator::EULER_CROMER:
+    step_euler_cromer();
+    break;
+  case Integrator::HERMITE:
+    step_hermite();
+    break;
+  case Integrator::LEAPFROG:
+    step_composition<LeapfrogScheme>();
+    break;
+  case Integrator::YOSHIDA4:
+    step_composition<Yoshida4Scheme>();
+    break;
+  case Integrator::YOSHIDA6:
+    step_composition<Yoshida6Scheme>();
+    break;
+  case Integrator::WISDOM_HOLMAN:
+    step_wisdom_holman();
+    break;
+  case Integrator::IAS15:
+    step_ias15();
+    break;
+  }
+}
+
+void Simulation::invalidate_integrator_state() {
+  hermite_data.valid = false;
+  wh_data.valid = false;
+  ias15_data.valid = false;
+}
+
+void Simulation::step_euler_cromer() {
+  calc_accs_cpu();
+  update_simd_kinematics();
+}
+
+void Simulation::drift_simd(float dt) {
+  PhaseScope scope(step_profiler, StepPhase::INTEGRATION);
+  pool->for_each(simd_data.positions.begin(), simd_data.positions.end(),
+    [&](XMVECTOR &pos) {
+      size_t i = &pos - simd_data.positions.data();
+      pos += simd_data.vels[i] * dt;
+    }
+  );
+}
+
+void Simulation::kick_simd(float dt) {
+  calc_accs_cpu();
+  PhaseScope scope(step_profiler, StepPhase::INTEGRATION);
+  pool->for_each(simd_data.vels.begin(), simd_data.vels.end(),
+    [&](XMVECTOR &vel) {
+      size_t i = &vel - simd_data.vels.data();
+      vel += simd_data.accs[i] * dt;
+    }
+  );
+}
+
+template <class Scheme>
+void Simulation::step_composition() {
+  using C = Composition<Scheme>;
+  // drift, then (kick, drift) for every stage, unrolled at compile time
+  drift_simd(C::drifts[0] * time_step);
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((kick_simd(C::kicks[I] * time_step), drift_simd(C::drifts[I + 1] * time_step)), ...);
+  }(std::make_index_sequence<C::stages>{});
+}
+
+// Hermite's force pass for every method, the jerk has no softened or tree form here
+void Simulation::calc_accs_jerks_cpu_particle_particle() {
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
+  hermite_data.jerks.resize(num_bodies);
+
+  // O(n^2), but diff and r^-3 are shared by the acceleration and the jerk
+  pool->for_each(simd_data.accs.begin(), simd_data.accs.end(),
+    [&](XMVECTOR &acc) {
+      size_t i = &acc - simd_data.accs.data();
+      XMVECTOR p1 = simd_data.positions[i];
+      XMVECTOR v1 = simd_data.vels[i];
+      XMVECTOR jerk = XMVectorZero();
+      acc = XMVectorZero();
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        XMVECTOR diff = simd_data.positions[j] - p1;
+        XMVECTOR vel_diff = simd_data.vels[j] - v1;
+
+        XMVECTOR inv_r2 = XMVectorReciprocal(XMVector3Dot(diff, diff));
+        XMVECTOR mu_inv_r3 = mus[j] * inv_r2 * XMVectorSqrt(inv_r2);
+        // 3 (r . v) / r^2
+        XMVECTOR rv = 3.0f * XMVector3Dot(diff, vel_diff) * inv_r2;
+
+        acc += mu_inv_r3 * diff;
+        jerk += mu_inv_r3 * (vel_diff - rv * diff);
+      }
+      hermite_data.jerks[i] = jerk;
+    }
+  );
+}
+
+void Simulation::step_hermite() {
+  if (!hermite_data.valid) {
+    calc_accs_jerks_cpu_particle_particle();
+    hermite_data.valid = true;
+  }
+
+  // start of step state, accs and jerks carry over from the last correction
+  hermite_data.old_positions.assign(simd_data.positions.begin(), simd_data.positions.end());
+  hermite_data.old_vels.assign(simd_data.vels.begin(), simd_data.vels.end());
+  std::swap(hermite_data.old_accs, simd_data.accs);
+  std::swap(hermite_data.old_jerks, hermite_data.jerks);
+  simd_data.accs.resize(num_bodies);
+
+  const float dt = time_step;
+  const float dt2 = dt * dt / 2.0f;
+  const float dt3 = dt * dt * dt / 6.0f;
+
+  // predict positions and velocities with a third order Taylor expansion
+  for (size_t i = 0; i < num_bodies; i++) {
+    XMVECTOR a0 = hermite_data.old_accs[i];
+    XMVECTOR j0 = hermite_data.old_jerks[i];
+    simd_data.positions[i] += simd_data.vels[i] * dt + a0 * dt2 + j0 * dt3;
+    simd_data.vels[i] += a0 * dt + j0 * dt2;
+  }
+
+  calc_accs_jerks_cpu_particle_particle();
+
+  // correct using accelerations and jerks at both ends of the step
+  for (size_t i = 0; i < num_bodies; i++) {
+    XMVECTOR a0 = hermite_data.old_accs[i];
+    XMVECTOR j0 = hermite_data.old_jerks[i];
+    XMVECTOR a1 = simd_data.accs[i];
+    XMVECTOR j1 = hermite_data.jerks[i];
+    XMVECTOR v0 = hermite_data.old_vels[i];
+    XMVECTOR v1 = v0 + (a0 + a1) * (dt / 2.0f) + (j0 - j1) * (dt * dt / 12.0f);
+    simd_data.vels[i] = v1;
+    simd_data.positions[i] = hermite_data.old_positions[i] + (v0 + v1) * (dt / 2.0f) +
+                             (a0 - a1) * (dt * dt / 12.0f);
+  }
+}
+
+namespace {
+
+// Stumpff functions c0..c3 of x
+void stumpff(double x, double c[4]) {
+  if (std::abs(x) < 1e-2) {
+    c[0] = 1.0 - x / 2.0 * (1.0 - x / 12.0 * (1.0 - x / 30.0));
+    c[1] = 1.0 - x / 6.0 * (1.0 - x / 20.0 * (1.0 - x / 42.0));
+    c[2] = 0.5 * (1.0 - x / 12.0 * (1.0 - x / 30.0 * (1.0 - x / 56.0)));
+    c[3] = (1.0 - x / 20.0 * (1.0 - x / 42.0 * (1.0 - x / 72.0))) / 6.0;
+  } else if (x > 0.0) {
+    double sx = std::sqrt(x);
+    c[0] = std::cos(sx);
+    c[1] = std::sin(sx) / sx;
+    c[2] = (1.0 - c[0]) / x;
+    c[3] = (1.0 - c[1]) / x;
+  } else {
+    double sx = std::sqrt(-x);
+    c[0] = std::cosh(sx);
+    c[1] = std::sinh(sx) / sx;
+    c[2] = (1.0 - c[0]) / x;
+    c[3] = (1.0 - c[1]) / x;
+  }
+}
+
+} // namespace
+
+void kepler_drift(double mu, dvec3 &r, dvec3 &v, double dt) {
+  double r0 = std::sqrt(dot(r, r));
+  double eta0 = dot(r, v);
+  // beta > 0 for bound orbits
+  double beta = 2.0 * mu / r0 - dot(v, v);
+  double zeta0 = mu - beta * r0;
+
+  // solve r0 s + eta0 G2 + zeta0 G3 = dt for the universal anomaly s
+  double s = dt / r0;
+  double c[4];
+  double G1 = 0.0, G2 = 0.0, G3 = 0.0, r1 = r0;
+  for (int iter = 0; iter < 50; iter++) {
+    stumpff(beta * s * s, c);
+    G1 = s * c[1];
+    G2 = s * s * c[2];
+    G3 = s * s * s * c[3];
+    r1 = r0 * c[0] + eta0 * G1 + mu * G2;
+    double ds = (r0 * s + eta0 * G2 + zeta0 * G3 - dt) / r1;
+    s -= ds;
+    if (std::abs(ds) <= 1e-15 * std::abs(s)) break;
+  }
+  stumpff(beta * s * s, c);
+  G1 = s * c[1];
+  G2 = s * s * c[2];
+  G3 = s * s * s * c[3];
+  r1 = r0 * c[0] + eta0 * G1 + mu * G2;
+
+  // Gauss f and g functions
+  double f = 1.0 - mu * G2 / r0;
+  double g = dt - mu * G3;
+  double fdot = -mu * G1 / (r0 * r1);
+  double gdot = 1.0 - mu * G2 / r1;
+
+  dvec3 r_new = f * r + g * v;
+  v = fdot * r + gdot * v;
+  r = r_new;
+}
+
+void Simulation::step_wisdom_holman() {
+  auto &wh = wh_data;
+  if (!wh.valid) {
+    wh.central = std::max_element(masses.begin(), masses.end()) - masses.begin();
+    wh.positions.resize(num_bodies);
+    wh.vels.resize(num_bodies);
+
+    // barycenter, then heliocentric positions and barycentric velocities
+    double total_mu = 0.0;
+    wh.com_position = wh.com_vel = {0.0, 0.0, 0.0};
+    for (size_t i = 0; i < num_bodies; i++) {
+      XMFLOAT3 p, v;
+      XMStoreFloat3(&p, simd_data.positions[i]);
+      XMStoreFloat3(&v, simd_data.vels[i]);
+      wh.positions[i] = {p.x, p.y, p.z};
+      wh.vels[i] = {v.x, v.y, v.z};
+      total_mu += mus[i];
+      wh.com_position += static_cast<double>(mus[i]) * wh.positions[i];
+      wh.com_vel += static_cast<double>(mus[i]) * wh.vels[i];
+    }
+    wh.com_position = (1.0 / total_mu) * wh.com_position;
+    wh.com_vel = (1.0 / total_mu) * wh.com_vel;
+    dvec3 central_position = wh.positions[wh.central];
+    for (size_t i = 0; i < num_bodies; i++) {
+      wh.positions[i] -= central_position;
+      wh.vels[i] -= wh.com_vel;
+    }
+    wh.valid = true;
+  }
+
+  const size_t c = wh.central;
+  const double mu_central = mus[c];
+  const double dt = time_step;
+
+  // interactions between the non-central bodies only
+  auto kick = [&](double h) {
+    pool->for_each(wh.vels.begin(), wh.vels.end(),
+      [&](dvec3 &vel) {
+        size_t i = &vel - wh.vels.data();
+        if (i == c) return;
+        dvec3 acc{0.0, 0.0, 0.0};
+        for (size_t j = 0; j < num_massive; j++) {
+          if (j == i || j == c) continue;
+          dvec3 diff = wh.positions[j] - wh.positions[i];
+          double r2 = dot(diff, diff);
+          acc += (mus[j] / (r2 * std::sqrt(r2))) * diff;
+        }
+        vel += h * acc;
+      }
+    );
+  };
+  // the central body's momentum term moves every heliocentric position alike
+  auto jump = [&](double h) {
+    dvec3 momentum{0.0, 0.0, 0.0};
+    for (size_t i = 0; i < num_bodies; i++) {
+      if (i != c) momentum += static_cast<double>(mus[i]) * wh.vels[i];
+    }
+    dvec3 shift = (h / mu_central) * momentum;
+    for (size_t i = 0; i < num_bodies; i++) {
+      if (i != c) wh.positions[i] += shift;
+    }
+  };
+
+  kick(dt / 2.0);
+  jump(dt / 2.0);
+  pool->for_each(wh.positions.begin(), wh.positions.end(),
+    [&](dvec3 &pos) {
+      size_t i = &pos - wh.positions.data();
+      if (i != c) kepler_drift(mu_central, pos, wh.vels[i], dt);
+    }
+  );
+  jump(dt / 2.0);
+  kick(dt / 2.0);
+  wh.com_position += dt * wh.com_vel;
+
+  // back to inertial coordinates
+  double total_mu = 0.0;
+  dvec3 weighted_position{0.0, 0.0, 0.0}, momentum{0.0, 0.0, 0.0};
+  for (size_t i = 0; i < num_bodies; i++) {
+    total_mu += mus[i];
+    if (i == c) continue;
+    weighted_position += static_cast<double>(mus[i]) * wh.positions[i];
+    momentum += static_cast<double>(mus[i]) * wh.vels[i];
+  }
+  dvec3 central_position = wh.com_position - (1.0 / total_mu) * weighted_position;
+  dvec3 central_vel = wh.com_vel - (1.0 / mu_central) * momentum;
+  for (size_t i = 0; i < num_bodies; i++) {
+    dvec3 p = i == c ? central_position : wh.positions[i] + central_position;
+    dvec3 v = i == c ? central_vel : wh.vels[i] + wh.com_vel;
+    simd_data.positions[i] = XMVectorSet(static_cast<float>(p.x), static_cast<float>(p.y),
+                                         static_cast<float>(p.z), 0.0f);
+    simd_data.vels[i] = XMVectorSet(static_cast<float>(v.x), static_cast<float>(v.y),
+                                    static_cast<float>(v.z), 0.0f);
+  }
+}
+
+namespace {
+
+// Gauss-Radau spacings on [0, 1] and the matrices converting between the
+// divided differences g and the polynomial coefficients b of the acceleration
+struct RadauCoefficients {
+  static constexpr std::array<double, 8> h = {
+    0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780,
+    0.352624717113169637373907769648, 0.547153626330555383001448554766,
+    0.734210177215410531523210605558, 0.885320946839095768090359771030,
+    0.977520613561287501891174488626};
+
+  // c[k][j] is the coefficient of t^(k+1) in t (t - h[1]) ... (t - h[j]), so b = c g
+  double c[7][7] = {};
+  // d = c^-1, so g = d b
+  double d[7][7] = {};
+
+  RadauCoefficients() {
+    for (int j = 0; j < 7; j++) {
+      double poly[8] = {1.0};
+      for (int m = 1; m <= j; m++) {
+        for (int k = m; k > 0; k--) poly[k] = poly[k - 1] - h[m] * poly[k];
+        poly[0] *= -h[m];
+      }
+      for (int k = 0; k <= j; k++) c[k][j] = poly[k];
+    }
+    // c is unit upper triangular
+    for (int j = 0; j < 7; j++) {
+      d[j][j] = 1.0;
+      for (int i = j - 1; i >= 0; i--) {
+        for (int k = i + 1; k <= j; k++) d[i][j] -= c[i][k] * d[k][j];
+      }
+    }
+  }
+};
+
+const RadauCoefficients radau;
+
+constexpr double IAS15_SAFETY = 0.25;
+constexpr int IAS15_MAX_ITERATIONS = 12;
+
+inline dvec3 abs(const dvec3 &a) { return {std::abs(a.x), std::abs(a.y), std::abs(a.z)}; }
+inline double max_component(const dvec3 &a) { return std::max({a.x, a.y, a.z}); }
+
+// sum += value, keeping the rounding error in comp
+inline void compensated_add(dvec3 &sum, dvec3 &comp, const dvec3 &value) {
+  dvec3 y = value + comp;
+  dvec3 t = sum + y;
+  comp = (sum - t) + y;
+  sum = t;
+}
+
+} // namespace
+
+double Simulation::ias15_substep(double dt) {
+  auto &ias = ias15_data;
+  const auto &h = radau.h;
+
+  calc_accs_cpu_particle_particle_double(ias.positions, ias.accs0);
+
+  // divided differences of the predicted polynomial
+  for (size_t i = 0; i < num_bodies; i++) {
+    for (int k = 0; k < 7; k++) {
+      dvec3 gk{0.0, 0.0, 0.0};
+      for (int j = k; j < 7; j++) gk += radau.d[k][j] * ias.b[j][i];
+      ias.g[k][i] = gk;
+    }
+  }
+
+  // iterate the corrector until b stops changing
+  double pc_error = 1.0, prev_pc_error = 2.0;
+  for (int iteration = 0; iteration < IAS15_MAX_ITERATIONS; iteration++) {
+    if (pc_error < 1e-16) break;
+    if (iteration > 2 && pc_error >= prev_pc_error) break;
+    prev_pc_error = pc_error;
+
+    for (int n = 1; n < 8; n++) {
+      // positions at node n from the current polynomial
+      for (size_t i = 0; i < num_bodies; i++) {
+        dvec3 poly = (h[n] / 72.0) * ias.b[6][i];
+        for (int k = 5; k >= 0; k--) {
+          poly = h[n] * (poly + (1.0 / ((k + 2) * (k + 3))) * ias.b[k][i]);
+        }
+        double s = h[n] * dt;
+        ias.predicted[i] = ias.positions[i] + (ias.comp_positions[i] + s * ias.vels[i] +
+                           (s * s) * (poly + 0.5 * ias.accs0[i]));
+      }
+
+      calc_accs_cpu_particle_particle_double(ias.predicted, ias.accs);
+
+      double max_db6 = 0.0, max_acc = 0.0;
+      for (size_t i = 0; i < num_bodies; i++) {
+        dvec3 gk = (1.0 / h[n]) * (ias.accs[i] - ias.accs0[i]);
+        for (int m = 0; m < n - 1; m++) {
+          gk = (1.0 / (h[n] - h[m + 1])) * (gk - ias.g[m][i]);
+        }
+        dvec3 dg = gk - ias.g[n - 1][i];
+        ias.g[n - 1][i] = gk;
+        for (int k = 0; k < n; k++) ias.b[k][i] += radau.c[k][n - 1] * dg;
+        if (n == 7) {
+          max_db6 = std::max(max_db6, max_component(abs(dg)));
+          max_acc = std::max(max_acc, max_component(abs(ias.accs[i])));
+        }
+      }
+      if (n == 7) pc_error = max_acc > 0.0 ? max_db6 / max_acc : 0.0;
+    }
+  }
+
+  // the last coefficient estimates the truncation error
+  double max_b6 = 0.0, max_acc = 0.0;
+  for (size_t i = 0; i < num_bodies; i++) {
+    max_b6 = std::max(max_b6, max_component(abs(ias.b[6][i])));
+    max_acc = std::max(max_acc, max_component(abs(ias.accs[i])));
+  }
+  double error = max_acc > 0.0 ? max_b6 / max_acc : 0.0;
+  double dt_new = error > 0.0 ? dt * std::pow(ias.epsilon / error, 1.0 / 7.0) : dt / IAS15_SAFETY;
+  if (dt_new < IAS15_SAFETY * dt) return dt_new;
+  dt_new = std::min(dt_new, dt / IAS15_SAFETY);
+
+  // accepted, integrate the polynomial over the whole substep
+  for (size_t i = 0; i < num_bodies; i++) {
+    dvec3 pos_poly = (1.0 / 72.0) * ias.b[6][i];
+    dvec3 vel_poly = (1.0 / 8.0) * ias.b[6][i];
+    for (int k = 5; k >= 0; k--) {
+      pos_poly += (1.0 / ((k + 2) * (k + 3))) * ias.b[k][i];
+      vel_poly += (1.0 / (k + 2)) * ias.b[k][i];
+    }
+    compensated_add(ias.positions[i], ias.comp_positions[i],
+                    dt * ias.vels[i] + (dt * dt) * (pos_poly + 0.5 * ias.accs0[i]));
+    compensated_add(ias.vels[i], ias.comp_vels[i], dt * (vel_poly + ias.accs0[i]));
+  }
+  return dt_new;
+}
+
+void Simulation::step_ias15() {
+  auto &ias = ias15_data;
+  if (!ias.valid) {
+    ias.positions.resize(num_bodies);
+    ias.vels.resize(num_bodies);
+    for (size_t i = 0; i < num_bodies; i++) {
+      XMFLOAT3 p, v;
+      XMStoreFloat3(&p, simd_data.positions[i]);
+      XMStoreFloat3(&v, simd_data.vels[i]);
+      ias.positions[i] = {p.x, p.y, p.z};
+      ias.vels[i] = {v.x, v.y, v.z};
+    }
+    ias.comp_positions.assign(num_bodies, {0.0, 0.0, 0.0});
+    ias.comp_vels.assign(num_bodies, {0.0, 0.0, 0.0});
+    ias.predicted.resize(num_bodies);
+    ias.accs0.resize(num_bodies);
+    ias.accs.resize(num_bodies);
+    for (int k = 0; k < 7; k++) {
+      ias.g[k].assign(num_bodies, {0.0, 0.0, 0.0});
+      ias.b[k].assign(num_bodies, {0.0, 0.0, 0.0});
+      ias.e[k].assign(num_bodies, {0.0, 0.0, 0.0});
+    }
+    ias.dt = time_step;
+    ias.dt_last = 0.0;
+    ias.valid = true;
+  }
+
+  double remaining = time_step;
+  while (remaining > 0.0) {
+    bool clamped = ias.dt >= remaining;
+    double dt = clamped ? remaining : ias.dt;
+
+    // extrapolate the last substep's polynomial to this one
+    if (ias.dt_last > 0.0) {
+      double q = dt / ias.dt_last;
+      for (size_t i = 0; i < num_bodies; i++) {
+        for (int m = 0; m < 7; m++) {
+          dvec3 e{0.0, 0.0, 0.0};
+          if (q <= 20.0) {
+            double binomial = 1.0;
+            for (int k = m; k < 7; k++) {
+              // binomial is C(k + 1, m + 1)
+              e += binomial * ias.b[k][i];
+              binomial = binomial * (k + 2) / (k + 1 - m);
+            }
+            e = std::pow(q, m + 1) * e;
+          }
+          ias.b[m][i] = q <= 20.0 ? e + (ias.b[m][i] - ias.e[m][i]) : dvec3{0.0, 0.0, 0.0};
+          ias.e[m][i] = e;
+        }
+      }
+    }
+
+    double dt_new = ias15_substep(dt);
+    while (dt_new < IAS15_SAFETY * dt) {
+      // rejected, shrink the polynomial to the smaller substep and retry
+      double q = dt_new / dt;
+      for (int k = 0; k < 7; k++) {
+        double scale = std::pow(q, k + 1);
+        for (size_t i = 0; i < num_bodies; i++) {
+          ias.b[k][i] = scale * ias.b[k][i];
+          ias.e[k][i] = scale * ias.e[k][i];
+        }
+      }
+      clamped = false;
+      dt = dt_new;
+      dt_new = ias15_substep(dt);
+    }
+
+    ias.dt_last = dt;
+    // a substep shortened to land on time_step says little about the next one
+    if (!clamped || dt_new < dt) ias.dt = dt_new;
+    remaining = clamped ? 0.0 : remaining - dt;
+  }
+
+  for (size_t i = 0; i < num_bodies; i++) {
+    dvec3 p = ias.positions[i] + ias.comp_positions[i];
+    dvec3 v = ias.vels[i] + ias.comp_vels[i];
+    simd_data.positions[i] = XMVectorSet(static_cast<float>(p.x), static_cast<float>(p.y),
+                                         static_cast<float>(p.z), 0.0f);
+    simd_data.vels[i] = XMVectorSet(static_cast<float>(v.x), static_cast<float>(v.y),
+                                    static_cast<float>(v.z), 0.0f);
+  }
+}
+
+} // namespace gravitysim
@@ -83,6 +83,16 @@ int main(int, char**) {
   vels.push_back({-1, 0, 0});
   gravitysim::Simulation simulation(masses, positions, vels, 0.01f);
 
+  // the simulation steps on its own thread, the loop below only draws its snapshots
+  gravitysim::SimulationRunner runner(simulation);
+  // energy for the overlay, not every step since PE is O(n^2); set before subscribing
+  // so the first snapshot already carries it
+  runner.set_energy_interval(100);
+  auto snapshots = runner.subscribe();
+  runner.start();
+  gravitysim::SimulationMethod method = simulation.get_method();
+  gravitysim::Integrator integrator = simulation.get_integrator();
+
   // Main loop
   bool done = false;
   while (!done) {
@@ -96,12 +106,17 @@ int main(int, char**) {
               done = true;
       }
       if (done) break;
-      renderer.RenderFrame(camera, opts, simulation);
-      if (opts.method != simulation.get_method()) {
-        simulation.switch_method(opts.method);
+      renderer.RenderFrame(camera, opts, snapshots->read(), runner);
+      if (opts.method != method) {
+        method = opts.method;
+        runner.submit([method](gravitysim::Simulation &sim) { sim.switch_method(method); });
+      }
+      if (opts.integrator != integrator) {
+        integrator = opts.integrator;
+        runner.submit([integrator](gravitysim::Simulation &sim) { sim.set_integrator(integrator); });
       }
-      if (opts.run_simulation) {
-        simulation.step();
+      if (opts.run_simulation != runner.is_running()) {
+        runner.set_running(opts.run_simulation);
       }
       
       float elapsed;
@@ -127,6 +142,7 @@ int main(int, char**) {
   }
 
   // Cleanup
+  runner.stop();
   ImGui_ImplDX11_Shutdown();
   ImGui_ImplWin32_Shutdown();
   ImGui::DestroyContext();
@@ -0,0 +1,94 @@
+#include "memory_tracker.hpp"
+
+#include <array>
+#include <atomic>
+#include <iomanip>
+
+namespace gravitysim {
+
+namespace {
+
+constexpr std::array<const char *, NUM_MEMORY_SUBSYSTEMS> SUBSYSTEM_NAMES = {
+  "bodies", "simd mirror", "gpu mirror", "tree", "integrator", "scratch", "output",
+};
+
+struct Counter {
+  std::atomic<size_t> current = 0;
+  std::atomic<size_t> peak = 0;
+
+  void add(size_t bytes) {
+    size_t now = current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (now > seen && !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+  }
+};
+
+// never destroyed, static vectors and pools free their memory after any static counters would be gone
+struct Counters {
+  std::array<Counter, NUM_MEMORY_SUBSYSTEMS> subsystems;
+  Counter total;
+};
+
+Counters &counters() {
+  static Counters *c = new Counters;
+  return *c;
+}
+
+double mib(size_t bytes) {
+  return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+const char *memory_subsystem_name(MemorySubsystem subsystem) {
+  return SUBSYSTEM_NAMES[static_cast<size_t>(subsystem)];
+}
+
+void track_allocation(MemorySubsystem subsystem, size_t bytes) {
+  Counters &c = counters();
+  c.subsystems[static_cast<size_t>(subsystem)].add(bytes);
+  c.total.add(bytes);
+}
+
+void track_deallocation(MemorySubsystem subsystem, size_t bytes) {
+  Counters &c = counters();
+  c.subsystems[static_cast<size_t>(subsystem)].current.fetch_sub(bytes, std::memory_order_relaxed);
+  c.total.current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+MemoryUsage memory_usage(MemorySubsystem subsystem) {
+  const Counter &c = counters().subsystems[static_cast<size_t>(subsystem)];
+  return {c.current.load(std::memory_order_relaxed), c.peak.load(std::memory_order_relaxed)};
+}
+
+MemoryUsage total_memory_usage() {
+  const Counter &c = counters().total;
+  return {c.current.load(std::memory_order_relaxed), c.peak.load(std::memory_order_relaxed)};
+}
+
+void reset_memory_peaks() {
+  Counters &c = counters();
+  for (auto &s : c.subsystems) s.peak.store(s.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  c.total.peak.store(c.total.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void write_memory_report(std::ostream &out) {
+  auto flags = out.flags();
+  auto precision = out.precision();
+  out << std::left << std::setw(13) << "memory" << std::right << std::setw(13) << "current MiB" << std::setw(13)
+      << "peak MiB" << "\n"
+      << std::fixed << std::setprecision(2);
+  auto row = [&](const char *name, MemoryUsage usage) {
+    out << std::left << std::setw(13) << name << std::right << std::setw(13) << mib(usage.current) << std::setw(13)
+        << mib(usage.peak) << "\n";
+  };
+  for (size_t s = 0; s < NUM_MEMORY_SUBSYSTEMS; s++) {
+    row(SUBSYSTEM_NAMES[s], memory_usage(static_cast<MemorySubsystem>(s)));
+  }
+  // the total peak is the most at once, not the sum of the peaks
+  row("total", total_memory_usage());
+  out.flags(flags);
+  out.precision(precision);
+}
+
+} // namespace gravitysim
@@ -0,0 +1,326 @@
+#include "octree.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+#include "event_trace.hpp"
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+namespace {
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+// spreads the low 21 bits of v so there are two zero bits between each
+uint64_t split_by_3(uint32_t v) {
+  uint64_t x = v & 0x1fffff;
+  x = (x | x << 32) & 0x001f00000000ffffull;
+  x = (x | x << 16) & 0x001f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+// inverse of split_by_3
+uint32_t compact_by_3(uint64_t x) {
+  x &= 0x1249249249249249ull;
+  x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ull;
+  x = (x ^ (x >> 4)) & 0x100f00f00f00f00full;
+  x = (x ^ (x >> 8)) & 0x001f0000ff0000ffull;
+  x = (x ^ (x >> 16)) & 0x001f00000000ffffull;
+  x = (x ^ (x >> 32)) & 0x1fffff;
+  return static_cast<uint32_t>(x);
+}
+
+struct Bounds {
+  XMVECTOR lo;
+  XMVECTOR hi;
+};
+
+} // namespace
+
+uint64_t morton_encode(uint32_t x, uint32_t y, uint32_t z) {
+  return split_by_3(x) | split_by_3(y) << 1 | split_by_3(z) << 2;
+}
+
+LinearOctree::LinearOctree(uint32_t leaf_capacity) : leaf_capacity(std::max(leaf_capacity, 1u)) {}
+
+void LinearOctree::radix_sort() {
+  TraceScope trace("radix sort", "tree");
+  size_t n = keys.size();
+  key_scratch.resize(n);
+  index_scratch.resize(n);
+
+  // each chunk histograms and scatters its own range, keeping the sort stable
+  size_t num_chunks = std::clamp<size_t>(n / 4096, 1, pool->size());
+  size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+  chunk_counts.resize(num_chunks);
+  auto &counts = chunk_counts;
+
+  for (uint32_t shift = 0; shift < 64; shift += 8) {
+    pool->for_each(counts.begin(), counts.end(),
+      [&](std::array<uint32_t, 256> &count) {
+        size_t c = &count - counts.data();
+        count.fill(0);
+        for (size_t i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++) {
+          count[(keys[i] >> shift) & 0xff]++;
+        }
+      }
+    );
+
+    // exclusive prefix sum, digit major and chunk minor
+    bool single_digit = false;
+    uint32_t sum = 0;
+    for (size_t d = 0; d < 256; d++) {
+      uint32_t digit_begin = sum;
+      for (auto &count : counts) {
+        uint32_t t = count[d];
+        count[d] = sum;
+        sum += t;
+      }
+      single_digit |= sum - digit_begin == n;
+    }
+    // every key has the same digit, this pass would not move anything
+    if (single_digit) continue;
+
+    pool->for_each(counts.begin(), counts.end(),
+      [&](std::array<uint32_t, 256> &count) {
+        size_t c = &count - counts.data();
+        for (size_t i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++) {
+          uint32_t dst = count[(keys[i] >> shift) & 0xff]++;
+          key_scratch[dst] = keys[i];
+          index_scratch[dst] = sorted_index[i];
+        }
+      }
+    );
+    std::swap(keys, key_scratch);
+    std::swap(sorted_index, index_scratch);
+  }
+}
+
+void LinearOctree::build(std::span<const XMVECTOR> positions, std::span<const float> mus, ThreadPool &workers) {
+  TraceScope trace("octree build", "tree");
+  pool = &workers;
+  size_t n = positions.size();
+  assert(n == mus.size());
+  assert(n < NO_NODE);
+  nodes.clear();
+  level_offsets.clear();
+  keys.resize(n);
+  sorted_index.resize(n);
+  sorted_positions.resize(n);
+  sorted_mus.resize(n);
+  if (n == 0) return;
+
+  // bounding cube of all bodies
+  Bounds bounds = pool->transform_reduce(positions.begin(), positions.end(),
+    Bounds{positions[0], positions[0]},
+    [](const Bounds &a, const Bounds &b) {
+      return Bounds{XMVectorMin(a.lo, b.lo), XMVectorMax(a.hi, b.hi)};
+    },
+    [](const XMVECTOR &p) { return Bounds{p, p}; }
+  );
+  XMFLOAT3 lo, extents;
+  XMStoreFloat3(&lo, bounds.lo);
+  XMStoreFloat3(&extents, bounds.hi - bounds.lo);
+  float extent = std::max({extents.x, extents.y, extents.z});
+  if (!(extent > 0.0f)) extent = 1.0f;
+
+  // quantize to 21 bits per axis
+  constexpr float cells = static_cast<float>(1u << MAX_LEVEL);
+  const float scale = cells / extent;
+  pool->for_each(keys.begin(), keys.end(),
+    [&](uint64_t &key) {
+      size_t i = &key - keys.data();
+      XMFLOAT3 q;
+      XMStoreFloat3(&q, XMVectorClamp((positions[i] - bounds.lo) * scale, XMVectorZero(),
+                                      XMVectorReplicate(cells - 1.0f)));
+      key = morton_encode(static_cast<uint32_t>(q.x), static_cast<uint32_t>(q.y), static_cast<uint32_t>(q.z));
+      sorted_index[i] = static_cast<uint32_t>(i);
+    }
+  );
+
+  radix_sort();
+
+  // gather bodies into Morton order so walks touch contiguous memory
+  pool->for_each(sorted_positions.begin(), sorted_positions.end(),
+    [&](XMVECTOR &pos) {
+      size_t k = &pos - sorted_positions.data();
+      pos = positions[sorted_index[k]];
+      sorted_mus[k] = mus[sorted_index[k]];
+    }
+  );
+
+  emit_levels(lo, extent / cells);
+  compute_mass_moments();
+}
+
+void LinearOctree::emit_levels(XMFLOAT3 min_corner, float cell_size) {
+  TraceScope trace("emit levels", "tree");
+  size_t n = keys.size();
+  XMVECTOR corner = XMLoadFloat3(&min_corner);
+
+  auto make_node = [&](uint32_t begin, uint32_t end, uint32_t parent, uint32_t level) {
+    // the cell coordinates are the key prefix of any body inside it
+    uint64_t key = keys[begin];
+    uint32_t shift = MAX_LEVEL - level;
+    float width = cell_size * static_cast<float>(1u << shift);
+    XMVECTOR coords = XMVectorSet(static_cast<float>(compact_by_3(key) >> shift),
+                                  static_cast<float>(compact_by_3(key >> 1) >> shift),
+                                  static_cast<float>(compact_by_3(key >> 2) >> shift), 0.0f);
+    OctreeNode node{begin, end, 0, 0, parent, level};
+    XMStoreFloat3(&node.center, corner + (coords + XMVectorReplicate(0.5f)) * width);
+    node.half_width = 0.5f * width;
+    return node;
+  };
+
+  nodes.push_back(make_node(0, static_cast<uint32_t>(n), NO_NODE, 0));
+  level_offsets = {0, 1};
+  body_node.assign(n, 0);
+  node_starts.resize(n);
+
+  for (uint32_t level = 1; level <= MAX_LEVEL; level++) {
+    uint32_t shift = 3 * (MAX_LEVEL - level);
+
+    // a body starts a new node if its parent is being split and its key
+    // prefix at this level differs from the previous body's
+    pool->for_each(node_starts.begin(), node_starts.end(),
+      [&](uint32_t &start) {
+        size_t i = &start - node_starts.data();
+        uint32_t p = body_node[i];
+        bool split = p != NO_NODE && nodes[p].count() > leaf_capacity;
+        if (!split) body_node[i] = NO_NODE;
+        start = split && (i == nodes[p].begin || (keys[i] >> shift) != (keys[i - 1] >> shift));
+      }
+    );
+    pool->inclusive_scan(node_starts.begin(), node_starts.end(), node_starts.begin());
+
+    uint32_t num_new = node_starts[n - 1];
+    if (num_new == 0) break;
+    uint32_t base = static_cast<uint32_t>(nodes.size());
+    nodes.resize(base + num_new);
+
+    // scan gives every starting body the index of its node
+    pool->for_each(body_node.begin(), body_node.end(),
+      [&](uint32_t &node) {
+        size_t i = &node - body_node.data();
+        if (node == NO_NODE) return;
+        uint32_t k = base + node_starts[i] - 1;
+        if (i == 0 || node_starts[i] != node_starts[i - 1]) {
+          nodes[k] = make_node(static_cast<uint32_t>(i), 0, node, level);
+        }
+        node = k;
+      }
+    );
+
+    // siblings are adjacent, so ends and child offsets follow from neighbours
+    auto level_begin = nodes.begin() + base;
+    pool->for_each(level_begin, nodes.end(),
+      [&](OctreeNode &node) {
+        size_t k = &node - nodes.data();
+        bool last = k + 1 == nodes.size() || nodes[k + 1].parent != node.parent;
+        node.end = last ? nodes[node.parent].end : nodes[k + 1].begin;
+        if (k == base || nodes[k - 1].parent != node.parent) {
+          nodes[node.parent].first_child = static_cast<uint32_t>(k);
+        }
+      }
+    );
+    pool->for_each(level_begin, nodes.end(),
+      [&](OctreeNode &node) {
+        size_t k = &node - nodes.data();
+        if (k + 1 == nodes.size() || nodes[k + 1].parent != node.parent) {
+          nodes[node.parent].num_children = static_cast<uint32_t>(k + 1 - nodes[node.parent].first_child);
+        }
+      }
+    );
+
+    level_offsets.push_back(static_cast<uint32_t>(nodes.size()));
+  }
+}
+
+void LinearOctree::compute_mass_moments() {
+  TraceScope trace("mass moments", "tree");
+  // bottom up, one level at a time
+  for (size_t level = level_offsets.size() - 1; level-- > 0;) {
+    pool->for_each(nodes.begin() + level_offsets[level],
+                  nodes.begin() + level_offsets[level + 1],
+      [&](OctreeNode &node) {
+        float mu = 0.0f;
+        XMVECTOR weighted = XMVectorZero();
+        if (node.is_leaf()) {
+          for (uint32_t b = node.begin; b < node.end; b++) {
+            mu += sorted_mus[b];
+            weighted += sorted_mus[b] * sorted_positions[b];
+          }
+        } else {
+          for (uint32_t c = node.first_child; c < node.first_child + node.num_children; c++) {
+            mu += nodes[c].mu;
+            weighted += nodes[c].mu * XMLoadFloat3(&nodes[c].com);
+          }
+        }
+        node.mu = mu;
+        // massless cells keep their geometric center
+        if (mu > 0.0f) {
+          XMStoreFloat3(&node.com, weighted / mu);
+        } else {
+          node.com = node.center;
+        }
+      }
+    );
+  }
+}
+
+XMVECTOR LinearOctree::calc_acc(uint32_t s, float theta, float softening2) const {
+  return walk(sorted_positions[s], s, theta, softening2);
+}
+
+XMVECTOR LinearOctree::calc_acc_at(XMVECTOR p, float theta, float softening2) const {
+  return walk(p, NO_NODE, theta, softening2);
+}
+
+XMVECTOR LinearOctree::walk(XMVECTOR p, uint32_t s, float theta, float softening2) const {
+  XMVECTOR acc = XMVectorZero();
+  if (nodes.empty()) return acc;
+
+  float theta2 = theta * theta;
+  uint32_t stack[8 * MAX_LEVEL + 8];
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const OctreeNode &node = nodes[stack[--top]];
+    if (node.mu == 0.0f) continue;
+
+    if (node.is_leaf()) {
+      for (uint32_t b = node.begin; b < node.end; b++) {
+        if (b == s) continue;
+        XMVECTOR diff = sorted_positions[b] - p;
+        float dist2 = XMVectorGetX(XMVector3Dot(diff, diff)) + softening2;
+        acc += sorted_mus[b] / (dist2 * std::sqrt(dist2)) * diff;
+      }
+      continue;
+    }
+
+    // never approximate a cell containing the body itself
+    bool contains = s >= node.begin && s < node.end;
+    XMVECTOR diff = XMLoadFloat3(&node.com) - p;
+    float dist2 = XMVectorGetX(XMVector3Dot(diff, diff));
+    float size = 2.0f * node.half_width;
+    if (!contains && size * size < theta2 * dist2) {
+      float soft2 = dist2 + softening2;
+      acc += node.mu / (soft2 * std::sqrt(soft2)) * diff;
+    } else {
+      for (uint32_t c = node.first_child; c < node.first_child + node.num_children; c++) {
+        stack[top++] = c;
+      }
+    }
+  }
+  return acc;
+}
+
+} // namespace gravitysim
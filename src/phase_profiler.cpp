@@ -0,0 +1,246 @@
+#include "phase_profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+#ifdef __linux__
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace gravitysim {
+
+namespace {
+
+constexpr std::array<const char *, NUM_STEP_PHASES> PHASE_NAMES = {
+  "step", "tree build", "forces", "integration", "boundaries", "collisions", "gpu",
+};
+
+constexpr std::array<const char *, NUM_HARDWARE_COUNTERS> COUNTER_NAMES = {
+  "cycles", "instr", "L1D miss", "LLC miss", "br miss", "vec FP",
+};
+
+#ifdef __linux__
+
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+// raw event for vector FP work, there is no generic perf event for it
+uint64_t vector_fp_raw_event() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  for (std::string line; std::getline(cpuinfo, line);) {
+    if (!line.starts_with("vendor_id")) continue;
+    // FP_ARITH_INST_RETIRED, every packed width of single and double
+    if (line.find("GenuineIntel") != std::string::npos) return 0xFCC7;
+    // retired SSE/AVX FLOPs, every type
+    if (line.find("AuthenticAMD") != std::string::npos) return 0xFF03;
+    return 0;
+  }
+  return 0;
+}
+
+std::array<EventConfig, NUM_HARDWARE_COUNTERS> event_configs() {
+  constexpr uint64_t L1D_READ_MISS = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  return {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, L1D_READ_MISS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_RAW, vector_fp_raw_event()},
+  }};
+}
+
+int perf_event_open(const EventConfig &event, pid_t tid, int group_fd) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0));
+}
+
+std::vector<pid_t> process_threads() {
+  std::vector<pid_t> tids;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator("/proc/self/task", ec)) {
+    std::string name = entry.path().filename().string();
+    if (!name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+      tids.push_back(static_cast<pid_t>(std::stol(name)));
+    }
+  }
+  return tids;
+}
+
+#endif
+
+} // namespace
+
+const char *step_phase_name(StepPhase phase) {
+  return PHASE_NAMES[static_cast<size_t>(phase)];
+}
+
+bool HardwareCounters::open() {
+  close();
+#ifdef __linux__
+  auto events = event_configs();
+  for (pid_t tid : process_threads()) {
+    std::array<int, NUM_HARDWARE_COUNTERS> group;
+    group.fill(-1);
+    int leader = -1;
+    for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) {
+      if (events[c].type == PERF_TYPE_RAW && events[c].config == 0) continue;
+      group[c] = perf_event_open(events[c], tid, leader);
+      if (group[c] < 0) {
+        group[c] = -1;
+        continue;
+      }
+      if (leader < 0) leader = group[c];
+      available[c] = true;
+    }
+    if (leader >= 0) fds.push_back(group);
+  }
+#endif
+  return !fds.empty();
+}
+
+void HardwareCounters::close() {
+#ifdef __linux__
+  for (const auto &group : fds) {
+    for (int fd : group) {
+      if (fd >= 0) ::close(fd);
+    }
+  }
+#endif
+  fds.clear();
+  available.fill(false);
+}
+
+void HardwareCounters::read(CounterValues &values) const {
+  values.fill(0);
+#ifdef __linux__
+  std::array<uint64_t, 3 + NUM_HARDWARE_COUNTERS> buffer;
+  for (const auto &group : fds) {
+    int leader = *std::find_if(group.begin(), group.end(), [](int fd) { return fd >= 0; });
+    if (::read(leader, buffer.data(), sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t))) continue;
+    // nr, time enabled, time running, then the values in the order the group was opened
+    uint64_t enabled = buffer[1], running = buffer[2];
+    if (running == 0) continue;
+    double scale = static_cast<double>(enabled) / running;
+    size_t k = 3;
+    for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) {
+      if (group[c] < 0) continue;
+      values[c] += static_cast<uint64_t>(buffer[k++] * scale);
+    }
+  }
+#endif
+}
+
+PhaseProfiler::PhaseProfiler(bool hardware_counters) : hardware_counters(hardware_counters) {
+  attach_counters();
+}
+
+void PhaseProfiler::attach_counters() {
+  if (hardware_counters) counters.open();
+}
+
+void PhaseProfiler::sample(Sample &s) const {
+  if (has_counters()) {
+    counters.read(s.counts);
+  } else {
+    s.counts.fill(0);
+  }
+  // the clock last, so reading the counters is not timed
+  s.time = std::chrono::steady_clock::now();
+}
+
+void PhaseProfiler::add(StepPhase phase, const Sample &start) {
+  Sample end;
+  end.time = std::chrono::steady_clock::now();
+  if (has_counters()) {
+    counters.read(end.counts);
+  } else {
+    end.counts.fill(0);
+  }
+  PhaseStats &stats = phases[static_cast<size_t>(phase)];
+  stats.calls++;
+  stats.seconds += std::chrono::duration<double>(end.time - start.time).count();
+  for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) {
+    // a counter can go backwards when the multiplexing scale changes
+    stats.counts[c] += end.counts[c] > start.counts[c] ? end.counts[c] - start.counts[c] : 0;
+  }
+}
+
+void PhaseProfiler::reset() {
+  phases.fill(PhaseStats{});
+}
+
+void PhaseProfiler::report(std::ostream &out) const {
+  // the rest of STEP is whatever none of the other phases covered
+  PhaseStats rest = get(StepPhase::STEP);
+  for (size_t p = 1; p < NUM_STEP_PHASES; p++) {
+    rest.seconds -= phases[p].seconds;
+    for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) {
+      rest.counts[c] -= std::min(rest.counts[c], phases[p].counts[c]);
+    }
+  }
+  rest.seconds = std::max(0.0, rest.seconds);
+  double total = std::max(get(StepPhase::STEP).seconds, 1e-30);
+
+  auto flags = out.flags();
+  auto precision = out.precision();
+  out << std::left << std::setw(13) << "phase" << std::right << std::setw(8) << "calls" << std::setw(11) << "ms"
+      << std::setw(7) << "%";
+  if (has_counters()) {
+    for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) out << std::setw(11) << COUNTER_NAMES[c];
+    out << std::setw(8) << "IPC";
+  }
+  out << "\n";
+
+  auto row = [&](const char *name, const PhaseStats &stats) {
+    out << std::left << std::setw(13) << name << std::right << std::setw(8) << stats.calls << std::fixed
+        << std::setprecision(3) << std::setw(11) << 1e3 * stats.seconds << std::setprecision(1) << std::setw(7)
+        << 100.0 * stats.seconds / total;
+    out.unsetf(std::ios::floatfield);
+    if (has_counters()) {
+      out << std::setprecision(4);
+      for (size_t c = 0; c < NUM_HARDWARE_COUNTERS; c++) {
+        out << std::setw(11);
+        if (counters.is_available(static_cast<HardwareCounter>(c))) {
+          out << static_cast<double>(stats.counts[c]);
+        } else {
+          out << "n/a";
+        }
+      }
+      uint64_t cycles = stats.counts[static_cast<size_t>(HardwareCounter::CYCLES)];
+      uint64_t instructions = stats.counts[static_cast<size_t>(HardwareCounter::INSTRUCTIONS)];
+      out << std::setprecision(3) << std::setw(8);
+      if (cycles > 0 && is_available(HardwareCounter::INSTRUCTIONS)) {
+        out << static_cast<double>(instructions) / cycles;
+      } else {
+        out << "n/a";
+      }
+    }
+    out << "\n";
+  };
+  for (size_t p = 1; p < NUM_STEP_PHASES; p++) {
+    if (phases[p].calls > 0) row(PHASE_NAMES[p], phases[p]);
+  }
+  rest.calls = get(StepPhase::STEP).calls;
+  row("other", rest);
+  row(PHASE_NAMES[0], get(StepPhase::STEP));
+  out.flags(flags);
+  out.precision(precision);
+}
+
+} // namespace gravitysim
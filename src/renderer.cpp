@@ -163,7 +163,7 @@ void Renderer::set_size(UINT width, UINT height) {
 }
 
 void Renderer::RenderFrame(Camera &camera, RenderOptions &opts,
-                           Simulation &sim) {
+                           const Snapshot &snapshot, SimulationRunner &runner) {
   // Handle window resize (we don't resize directly in the WM_SIZE handler)
   if (resize_width != 0 && resize_height != 0) {
     CleanupRenderTarget();
@@ -202,6 +202,39 @@ void Renderer::RenderFrame(Camera &camera, RenderOptions &opts,
     ImGui::RadioButton(
         "GPU Particle-Particle", reinterpret_cast<int *>(&opts.method),
         static_cast<int>(SimulationMethod::GPU_PARTICLE_PARTICLE));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "CPU Barnes-Hut", reinterpret_cast<int *>(&opts.method),
+        static_cast<int>(SimulationMethod::CPU_BARNES_HUT));
+
+    // integrator used by the CPU methods
+    ImGui::RadioButton(
+        "Euler-Cromer", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::EULER_CROMER));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Hermite", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::HERMITE));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Leapfrog", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::LEAPFROG));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Yoshida 4", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::YOSHIDA4));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Yoshida 6", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::YOSHIDA6));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Wisdom-Holman", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::WISDOM_HOLMAN));
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "IAS15", reinterpret_cast<int *>(&opts.integrator),
+        static_cast<int>(Integrator::IAS15));
 
     // scale of the rendered bodies (temporary)
     ImGui::SliderFloat("Body scale", &opts.body_scale, 0.1f, 100.0f);
@@ -210,7 +243,7 @@ void Renderer::RenderFrame(Camera &camera, RenderOptions &opts,
 
     // button to set frame to COM frame
     if (ImGui::Button("Set center of mass frame")) {
-      sim.set_COM_frame();
+      runner.submit([](Simulation &sim) { sim.set_COM_frame(); });
     }
 
     // show data about simulation
@@ -228,7 +261,8 @@ void Renderer::RenderFrame(Camera &camera, RenderOptions &opts,
     ImGui::SameLine();
     if (ImGui::Button("Reset")) camera.reset_look();
 
-    ImGui::Text("KE: %g, PE: %g, TE: %g", sim.get_KE(), sim.get_KE(), sim.get_KE() + sim.get_PE());
+    ImGui::Text("Step: %llu", static_cast<unsigned long long>(snapshot.step));
+    ImGui::Text("KE: %g, PE: %g, TE: %g", snapshot.KE, snapshot.PE, snapshot.KE + snapshot.PE);
 
     ImGui::End();
   }
@@ -275,12 +309,11 @@ void Renderer::RenderFrame(Camera &camera, RenderOptions &opts,
   auto geosphere = GeometricPrimitive::CreateGeoSphere(device_context.Get(),
                                                        opts.body_scale, 2);
 
-  for (auto &pos : sim.get_positions()) {
+  for (auto &pos : snapshot.positions) {
     XMMATRIX trans = XMMatrixTranslation(pos.x, pos.y, pos.z);
     geosphere->Draw(trans, camera.get_view(), camera.get_proj(), Colors::Purple,
                     NULL, false);
   }
-  auto &pos = sim.get_positions().back();
   //auto bigsphere = GeometricPrimitive::CreateGeoSphere(device_context.Get(), opts.body_scale * 4, 2);
   //XMMATRIX trans = XMMatrixTranslation(pos.x, pos.y, pos.z);
   //bigsphere->Draw(trans, camera.get_view(), camera.get_proj(), Colors::Green,
@@ -0,0 +1,175 @@
+#include "run_config.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+namespace gravitysim {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string_view::npos) return {};
+  size_t end = s.find_last_not_of(" \t\r");
+  return s.substr(begin, end - begin + 1);
+}
+
+template <class T>
+bool parse_number(std::string_view value, T &out) {
+  T parsed;
+  auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+  if (ec != std::errc() || end != value.data() + value.size()) return false;
+  out = parsed;
+  return true;
+}
+
+template <class T>
+bool parse_positive(std::string_view value, T &out) {
+  T parsed;
+  if (!parse_number(value, parsed) || !(parsed > T(0))) return false;
+  out = parsed;
+  return true;
+}
+
+bool parse_bool(std::string_view value, bool &out) {
+  if (value == "true" || value == "yes" || value == "1") {
+    out = true;
+  } else if (value == "false" || value == "no" || value == "0") {
+    out = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// value names of an enum, in the order of its values
+template <class E, size_t N>
+bool parse_enum(std::string_view value, const std::array<std::string_view, N> &names, E &out) {
+  auto it = std::find(names.begin(), names.end(), value);
+  if (it == names.end()) return false;
+  out = static_cast<E>(it - names.begin());
+  return true;
+}
+
+constexpr std::array<std::string_view, 3> IC_FORMATS = {"auto", "catalog", "gadget"};
+constexpr std::array<std::string_view, 3> METHODS = {"cpu_pp", "gpu_pp", "barnes_hut"};
+constexpr std::array<std::string_view, 7> INTEGRATORS = {"euler_cromer", "hermite", "leapfrog", "yoshida4",
+                                                         "yoshida6", "wisdom_holman", "ias15"};
+constexpr std::array<std::string_view, 4> OUTPUT_FORMATS = {"none", "snapshot", "gadget", "trajectory"};
+
+struct Setting {
+  std::string_view key;
+  bool (*apply)(std::string_view value, RunConfig &config);
+};
+
+const std::array<Setting, 20> SETTINGS = {{
+  {"ic", [](std::string_view v, RunConfig &c) { c.ic = v; return !v.empty(); }},
+  {"ic_format", [](std::string_view v, RunConfig &c) { return parse_enum(v, IC_FORMATS, c.ic_format); }},
+  // gpu_pp is refused by builds without CUDA rather than quietly run on the host
+  {"method", [](std::string_view v, RunConfig &c) {
+    SimulationMethod method;
+    if (!parse_enum(v, METHODS, method)) return false;
+    if (method == SimulationMethod::GPU_PARTICLE_PARTICLE && !gpu_method_available()) return false;
+    c.method = method;
+    return true;
+  }},
+  {"integrator", [](std::string_view v, RunConfig &c) { return parse_enum(v, INTEGRATORS, c.integrator); }},
+  {"dt", [](std::string_view v, RunConfig &c) { return parse_positive(v, c.dt); }},
+  {"softening", [](std::string_view v, RunConfig &c) {
+    return parse_number(v, c.softening) && c.softening >= 0.0f;
+  }},
+  {"G", [](std::string_view v, RunConfig &c) { return parse_positive(v, c.G); }},
+  {"theta", [](std::string_view v, RunConfig &c) { return parse_number(v, c.theta) && c.theta >= 0.0f; }},
+  {"end_time", [](std::string_view v, RunConfig &c) { return parse_positive(v, c.end_time); }},
+  {"output", [](std::string_view v, RunConfig &c) { c.output = v; return true; }},
+  {"output_format", [](std::string_view v, RunConfig &c) {
+    return parse_enum(v, OUTPUT_FORMATS, c.output_format);
+  }},
+  {"output_every", [](std::string_view v, RunConfig &c) { return parse_positive(v, c.output_every); }},
+  {"trajectory_precision", [](std::string_view v, RunConfig &c) {
+    return parse_positive(v, c.trajectory_precision);
+  }},
+  {"diagnostics", [](std::string_view v, RunConfig &c) { c.diagnostics = v; return true; }},
+  {"diagnostics_every", [](std::string_view v, RunConfig &c) { return parse_positive(v, c.diagnostics_every); }},
+  {"threads", [](std::string_view v, RunConfig &c) { return parse_number(v, c.threads); }},
+  {"pin_threads", [](std::string_view v, RunConfig &c) { return parse_bool(v, c.pin_threads); }},
+  {"profile", [](std::string_view v, RunConfig &c) { return parse_bool(v, c.profile); }},
+  {"trace", [](std::string_view v, RunConfig &c) { c.trace = v; return true; }},
+  {"memory", [](std::string_view v, RunConfig &c) { return parse_bool(v, c.memory); }},
+}};
+
+} // namespace
+
+bool apply_run_config_line(std::string_view line, RunConfig &config, std::string &error) {
+  line = trim(line.substr(0, line.find('#')));
+  if (line.empty()) return true;
+  size_t equals = line.find('=');
+  if (equals == std::string_view::npos) {
+    error = "expected key = value";
+    return false;
+  }
+  std::string_view key = trim(line.substr(0, equals)), value = trim(line.substr(equals + 1));
+  auto setting = std::find_if(SETTINGS.begin(), SETTINGS.end(), [&](const Setting &s) { return s.key == key; });
+  if (setting == SETTINGS.end()) {
+    error = "unknown key '" + std::string(key) + "'";
+    return false;
+  }
+  if (!setting->apply(value, config)) {
+    error = "bad value '" + std::string(value) + "' for " + std::string(key);
+    return false;
+  }
+  return true;
+}
+
+bool parse_run_config(std::string_view text, RunConfig &config, std::string &error) {
+  size_t line_number = 1;
+  while (!text.empty()) {
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    if (!apply_run_config_line(line, config, error)) {
+      error = "line " + std::to_string(line_number) + ": " + error;
+      return false;
+    }
+    text = newline == std::string_view::npos ? std::string_view() : text.substr(newline + 1);
+    line_number++;
+  }
+  return true;
+}
+
+bool load_run_config(const std::string &path, RunConfig &config, std::string &error) {
+  std::ifstream file(path);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  if (!parse_run_config(text.str(), config, error)) {
+    error = path + ": " + error;
+    return false;
+  }
+  return true;
+}
+
+bool validate_run_config(const RunConfig &config, std::string &error) {
+  if (config.ic.empty()) {
+    error = "no initial conditions, set ic";
+    return false;
+  }
+  if (config.output_format != OutputFormat::NONE && config.output.empty()) {
+    error = "output_format needs an output path prefix";
+    return false;
+  }
+  // the Hermite pass is its own unsoftened direct sum, so it would silently drop both
+  if (config.integrator == Integrator::HERMITE &&
+      (config.method == SimulationMethod::CPU_BARNES_HUT || config.softening > 0.0f)) {
+    error = "hermite always uses the unsoftened direct sum, set method = cpu_pp and softening = 0";
+    return false;
+  }
+  return true;
+}
+
+} // namespace gravitysim
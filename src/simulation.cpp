@@ -1,6 +1,8 @@
 #include "simulation.hpp"
 #include <algorithm>
-#include <execution>
+#include <cmath>
+#include <functional>
+#include <numeric>
 
 namespace gravitysim {
 
@@ -11,12 +13,34 @@ Simulation::Simulation() {}
 Simulation::Simulation(float time_step) : time_step(time_step) {}
 
 Simulation::Simulation(std::vector<float> masses_, std::vector<vec3f> positions_,
-                       std::vector<vec3f> vels_, float time_step)
-    : num_bodies(masses_.size()), masses(std::move(masses_)), positions(std::move(positions_)),
-      vels(std::move(vels_)), time_step(time_step) {
+                       std::vector<vec3f> vels_, float time_step, std::vector<float> radii_)
+    : num_bodies(masses_.size()), time_step(time_step) {
 
-  positions.resize(num_bodies);
-  vels.resize(num_bodies);
+  positions_.resize(num_bodies);
+  vels_.resize(num_bodies);
+
+  // massive bodies first, keeping the given order within each partition
+  ids.resize(num_bodies);
+  std::iota(ids.begin(), ids.end(), 0);
+  auto test_particles = std::stable_partition(ids.begin(), ids.end(),
+    [&](uint32_t id) { return masses_[id] != 0.0f; });
+  num_massive = test_particles - ids.begin();
+  next_id = static_cast<uint32_t>(num_bodies);
+
+  masses.reserve(num_bodies);
+  positions.reserve(num_bodies);
+  vels.reserve(num_bodies);
+  for (uint32_t id : ids) {
+    masses.push_back(masses_[id]);
+    positions.push_back(positions_[id]);
+    vels.push_back(vels_[id]);
+  }
+  if (!radii_.empty()) {
+    radii_.resize(num_bodies);
+    for (uint32_t id : ids) {
+      radii.push_back(radii_[id]);
+    }
+  }
   for (float m : masses) {
     mus.push_back(G * m);
     inv_mu.push_back(1.0f / G / m);
@@ -29,6 +53,7 @@ void Simulation::transfer_kinematics_to_simd() {
   simd_data.positions.resize(num_bodies);
   simd_data.vels.resize(num_bodies);
   simd_data.accs.resize(num_bodies);
+  invalidate_integrator_state();
   for (int i = 0; i < num_bodies; i++) {
     simd_data.positions[i] = XMLoadFloat3(&positions[i]);
     simd_data.vels[i] = XMLoadFloat3(&vels[i]);
@@ -39,7 +64,7 @@ void Simulation::transfer_simd_kinematics_to_cpu() {
   assert(num_bodies == positions.size());
   assert(num_bodies == vels.size());
   // move simd position and vel data to cpu
-  std::for_each(std::execution::par_unseq, simd_data.positions.begin(), simd_data.positions.end(),
+  pool->for_each(simd_data.positions.begin(), simd_data.positions.end(),
     [&](const XMVECTOR &pos) {
       size_t index = &pos - simd_data.positions.data();
       XMStoreFloat3(&positions[index], pos);
@@ -52,106 +77,314 @@ void Simulation::transfer_simd_kinematics_to_cpu() {
   //}
 }
 
-void Simulation::transfer_simd_positions_to_cpu() {
-  assert(num_bodies == simd_data.positions.size());
-  // move simd position data to cpu
-  std::for_each(std::execution::par_unseq, simd_data.positions.begin(), simd_data.positions.end(),
-    [&](const XMVECTOR &pos) {
-      size_t index = &pos - simd_data.positions.data();
-      XMStoreFloat3(&positions[index], pos);
-    }
-  );
+void Simulation::materialize_kinematics() {
+  if (cpu_kinematics_current) return;
+  switch (method) {
+  case SimulationMethod::GPU_PARTICLE_PARTICLE:
+    transfer_gpu_kinematics_to_cpu();
+    break;
+  default:
+    transfer_simd_kinematics_to_cpu();
+    break;
+  }
+  cpu_kinematics_current = true;
 }
 
-void Simulation::calc_accs_cpu_particle_particle() {
-  std::fill(simd_data.accs.begin(), simd_data.accs.end(), XMVectorZero());
-
-  // O(n^2)
-  // calculate acceleration between bodies
-  for (int i = 0; i < num_bodies; i++) {
-    for (int j = 0; j < num_bodies; j++) {
-      if (i == j) continue;
-      XMVECTOR p1 = simd_data.positions[i];
-      XMVECTOR p2 = simd_data.positions[j];
-      XMVECTOR diff = p2 - p1;
+Vec3View Simulation::view_positions() {
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    materialize_kinematics();
+    return Vec3View(std::span<const vec3f>(positions));
+  }
+  return Vec3View(std::span<const XMVECTOR>(simd_data.positions));
+}
 
-      float acc = mus[j] / XMVectorGetX(XMVector3Dot(diff, diff));
+Vec3View Simulation::view_vels() {
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    materialize_kinematics();
+    return Vec3View(std::span<const vec3f>(vels));
+  }
+  return Vec3View(std::span<const XMVECTOR>(simd_data.vels));
+}
 
-      XMVECTOR unit_diff = XMVector3Normalize(diff);
-      XMVECTOR acc_dir = acc * unit_diff;
+void Simulation::calc_accs_cpu_particle_particle() {
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
+  // O(n^2)
+  // calculate acceleration between bodies, each body's sum is independent
+  pool->for_each(simd_data.accs.begin(), simd_data.accs.end(),
+    [&](XMVECTOR &acc_i) {
+      size_t i = &acc_i - simd_data.accs.data();
+      acc_i = XMVectorZero();
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        XMVECTOR p1 = simd_data.positions[i];
+        XMVECTOR p2 = simd_data.positions[j];
+        XMVECTOR diff = p2 - p1;
 
-      simd_data.accs[i] += acc_dir;
+        float dist2 = XMVectorGetX(XMVector3Dot(diff, diff)) + softening2;
+        acc_i += mus[j] / (dist2 * std::sqrt(dist2)) * diff;
+      }
     }
-  }
+  );
+}
 
-  // update velocities and positions
-  for (int i = 0; i < num_bodies; i++) {
-    simd_data.vels[i] += simd_data.accs[i] * time_step;
-    simd_data.positions[i] += simd_data.vels[i] * time_step;
-  }
+void Simulation::calc_accs_cpu_particle_particle_double(std::span<const dvec3> positions, std::span<dvec3> accs) {
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
+  pool->for_each(accs.begin(), accs.end(),
+    [&](dvec3 &acc) {
+      size_t i = &acc - accs.data();
+      acc = {0.0, 0.0, 0.0};
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        dvec3 diff = positions[j] - positions[i];
+        double dist2 = dot(diff, diff) + softening2;
+        acc += (mus[j] / (dist2 * std::sqrt(dist2))) * diff;
+      }
+    }
+  );
 }
 
-void Simulation::calc_accs_cpu_particle_particle_halved() {
-  std::fill(simd_data.accs.begin(), simd_data.accs.end(), XMVectorZero());
+void Simulation::calc_accs_cpu_barnes_hut() {
+  {
+    PhaseScope scope(step_profiler, StepPhase::TREE_BUILD);
+    // only massive bodies are sources
+    octree.build(std::span(simd_data.positions).first(num_massive), std::span(mus).first(num_massive), *pool);
+  }
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
 
-  // calculate two-way forces between bodies, then scale by mass
-  // can have precision issues
-  for (int i = 0; i < num_bodies; i++) {
-    for (int j = i + 1; j < num_bodies; j++) {
-      XMVECTOR p1 = simd_data.positions[i];
-      XMVECTOR p2 = simd_data.positions[j];
-      XMVECTOR diff = p2 - p1;
+  // walk in Morton order so neighbouring walks share most of the tree
+  const auto &sorted_index = octree.get_sorted_index();
+  pool->for_each(sorted_index.begin(), sorted_index.end(),
+    [&](const uint32_t &index) {
+      uint32_t s = static_cast<uint32_t>(&index - sorted_index.data());
+      simd_data.accs[index] = octree.calc_acc(s, theta, softening2);
+    }
+  );
+  pool->for_each(simd_data.accs.begin() + num_massive, simd_data.accs.end(),
+    [&](XMVECTOR &acc) {
+      size_t i = &acc - simd_data.accs.data();
+      acc = octree.calc_acc_at(simd_data.positions[i], theta, softening2);
+    }
+  );
+}
 
-      float F = mus[i] * mus[j] / XMVectorGetX(XMVector3Dot(diff, diff));
+void Simulation::calc_accs_cpu_periodic() {
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
+  XMVECTOR box = XMVectorReplicate(box_size);
+  XMVECTOR inv_box = XMVectorReplicate(1.0f / box_size);
+  // the table is for a unit box, accelerations scale as 1 / box_size^2
+  float corr_scale = 1.0f / (box_size * box_size);
 
-      XMVECTOR unit_diff = XMVector3Normalize(diff);
-      XMVECTOR F_DIR = F * unit_diff;
+  pool->for_each(simd_data.accs.begin(), simd_data.accs.end(),
+    [&](XMVECTOR &acc) {
+      size_t i = &acc - simd_data.accs.data();
+      XMVECTOR p = simd_data.positions[i];
+      acc = XMVectorZero();
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        // minimum image separation in box units
+        XMVECTOR d = (simd_data.positions[j] - p) * inv_box;
+        d -= XMVectorRound(d);
+        XMVECTOR diff = d * box;
+        float dist2 = XMVectorGetX(XMVector3Dot(diff, diff)) + softening2;
+        XMVECTOR newton = diff / (dist2 * std::sqrt(dist2));
+        acc += mus[j] * (newton + corr_scale * ewald.correction(d));
+      }
+    }
+  );
+}
 
-      simd_data.accs[i] += F_DIR;
-      simd_data.accs[j] -= F_DIR;
+void Simulation::calc_accs_cpu() {
+  if (box_size > 0.0f) {
+    calc_accs_cpu_periodic();
+  } else {
+    switch (method) {
+    case SimulationMethod::CPU_BARNES_HUT:
+      calc_accs_cpu_barnes_hut();
+      break;
+    default:
+      calc_accs_cpu_particle_particle();
+      break;
     }
   }
-
-  for (int i = 0; i < num_bodies; i++) {
-    simd_data.accs[i] = XMVectorScale(simd_data.accs[i], inv_mu[i]);
-    simd_data.vels[i] += simd_data.accs[i] * time_step;
-    simd_data.positions[i] += simd_data.vels[i] * time_step;
+  if (external_fields.empty()) return;
+  PhaseScope scope(step_profiler, StepPhase::FORCES);
+  for (const auto &field : external_fields) {
+    field->add_accs(simd_data.positions, simd_data.accs, *pool);
   }
 }
 
+void Simulation::wrap_simd_positions() {
+  PhaseScope scope(step_profiler, StepPhase::BOUNDARIES);
+  XMVECTOR box = XMVectorReplicate(box_size);
+  XMVECTOR inv_box = XMVectorReplicate(1.0f / box_size);
+  pool->for_each(simd_data.positions.begin(), simd_data.positions.end(),
+    [&](XMVECTOR &pos) {
+      pos -= box * XMVectorFloor(pos * inv_box);
+    }
+  );
+}
+
+void Simulation::update_simd_kinematics() {
+  PhaseScope scope(step_profiler, StepPhase::INTEGRATION);
+  // update velocities and positions
+  pool->for_each(simd_data.positions.begin(), simd_data.positions.end(),
+    [&](XMVECTOR &pos) {
+      size_t i = &pos - simd_data.positions.data();
+      simd_data.vels[i] += simd_data.accs[i] * time_step;
+      pos += simd_data.vels[i] * time_step;
+    }
+  );
+}
 
 // calculate total kinetic energy of system
 // almost certainly has precision issues
 float Simulation::get_KE() {
-  float KE = 0.0f;
-  for (int i = 0; i < num_bodies; i++) {
-    XMVECTOR vi = XMLoadFloat3(&vels[i]);
-    KE += 0.5f * masses[i] * XMVectorGetX(XMVector3Dot(vi, vi));
-  }
-  return KE;
+  materialize_kinematics();
+  return pool->transform_reduce(vels.begin(), vels.end(), 0.0f, std::plus<float>(),
+    [&](const vec3f &vel) {
+      size_t i = &vel - vels.data();
+      XMVECTOR vi = XMLoadFloat3(&vel);
+      return 0.5f * masses[i] * XMVectorGetX(XMVector3Dot(vi, vi));
+    }
+  );
 }
 
 // calculate total potential energy of system
 // almost certainly has precision issues
 float Simulation::get_PE() {
-  float PE = 0.0f;
-  for (int i = 0; i < num_bodies; i++) {
-    for (int j = i + 1; j < num_bodies; j++) {
-      XMVECTOR pi = XMLoadFloat3(&positions[i]);
-      XMVECTOR pj = XMLoadFloat3(&positions[j]);
-      PE -= G * masses[i] * masses[j] / XMVectorGetX(XMVector3Length(pj - pi));
+  materialize_kinematics();
+  float PE = pool->transform_reduce(positions.begin(), positions.begin() + num_massive, 0.0f, std::plus<float>(),
+    [&](const vec3f &position) {
+      size_t i = &position - positions.data();
+      XMVECTOR pi = XMLoadFloat3(&position);
+      float PE_i = 0.0f;
+      for (size_t j = i + 1; j < num_massive; j++) {
+        XMVECTOR pj = XMLoadFloat3(&positions[j]);
+        XMVECTOR diff = pj - pi;
+        PE_i -= G * masses[i] * masses[j] / std::sqrt(XMVectorGetX(XMVector3Dot(diff, diff)) + softening2);
+      }
+      return PE_i;
     }
+  );
+  for (const auto &field : external_fields) {
+    PE += field->potential_energy(positions, masses);
   }
   return PE;
 }
 
+void Simulation::get_accelerations(std::vector<vec3f> &accs) {
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    materialize_kinematics();
+    transfer_kinematics_to_simd();
+  }
+  // Hermite carries simd_data.accs between steps, so they are put back afterwards
+  SIMDArray step_accs = simd_data.accs;
+  calc_accs_cpu();
+  accs.resize(num_bodies);
+  for (size_t i = 0; i < num_bodies; i++) {
+    XMStoreFloat3(&accs[i], simd_data.accs[i]);
+  }
+  simd_data.accs.swap(step_accs);
+}
+
+void Simulation::get_exact_accelerations(std::vector<dvec3> &accs) {
+  Vec3View view = view_positions();
+  std::vector<dvec3> exact_positions(num_bodies);
+  for (size_t i = 0; i < num_bodies; i++) {
+    vec3f p = view[i];
+    exact_positions[i] = {p.x, p.y, p.z};
+  }
+  accs.resize(num_bodies);
+  calc_accs_cpu_particle_particle_double(exact_positions, accs);
+}
+
 void Simulation::set_G(float G) {
   this->G = G;
+  for (size_t i = 0; i < num_bodies; i++) {
+    mus[i] = G * masses[i];
+    inv_mu[i] = 1.0f / G / masses[i];
+  }
+  if (method == SimulationMethod::GPU_PARTICLE_PARTICLE) {
+    transfer_mus_to_gpu();
+  }
+  invalidate_integrator_state();
+}
+
+void Simulation::set_theta(float theta) {
+  this->theta = theta;
+}
+
+namespace {
+
+// Hermite, Wisdom-Holman and IAS15 carry state across steps that the wrap would not update
+bool steps_in_periodic_box(Integrator integrator) {
+  switch (integrator) {
+  case Integrator::EULER_CROMER:
+  case Integrator::LEAPFROG:
+  case Integrator::YOSHIDA4:
+  case Integrator::YOSHIDA6:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+bool Simulation::set_integrator(Integrator integrator) {
+  if (box_size > 0.0f && !steps_in_periodic_box(integrator)) return false;
+  this->integrator = integrator;
+  invalidate_integrator_state();
+  return true;
+}
+
+void Simulation::set_collisions(bool enabled) {
+  assert(!enabled || radii.size() == num_bodies);
+  collisions = enabled;
+}
+
+void Simulation::set_threads(size_t num_threads, bool pin_threads) {
+  own_pool = std::make_unique<ThreadPool>(num_threads, pin_threads);
+  pool = own_pool.get();
+  // count the new workers too
+  if (profiler) profiler->attach_counters();
+}
+
+void Simulation::set_softening(float softening) {
+  softening2 = softening * softening;
+  invalidate_integrator_state();
+}
+
+void Simulation::set_profiling(bool enabled, bool hardware_counters) {
+  profiler = enabled ? std::make_unique<PhaseProfiler>(hardware_counters) : nullptr;
+}
+
+void Simulation::set_ias15_epsilon(double epsilon) {
+  ias15_data.epsilon = epsilon;
+}
+
+void Simulation::clear_external_potentials() {
+  external_fields.clear();
+  invalidate_integrator_state();
+}
+
+bool Simulation::set_periodic_box(float box_size) {
+  assert(box_size >= 0.0f);
+  if (box_size > 0.0f && !steps_in_periodic_box(integrator)) return false;
+  this->box_size = box_size;
+  if (box_size == 0.0f) return true;
+  if (ewald.empty()) ewald.build();
+
+  begin_body_edit();
+  wrap_simd_positions();
+  end_body_edit();
+  return true;
 }
 
 void Simulation::switch_method(SimulationMethod new_method) {
   switch (method) {
   case SimulationMethod::CPU_PARTICLE_PARTICLE:
+  case SimulationMethod::CPU_BARNES_HUT:
     transfer_simd_kinematics_to_cpu();
     break;
   case SimulationMethod::GPU_PARTICLE_PARTICLE:
@@ -161,6 +394,7 @@ void Simulation::switch_method(SimulationMethod new_method) {
   method = new_method;
   switch (new_method) {
   case SimulationMethod::CPU_PARTICLE_PARTICLE:
+  case SimulationMethod::CPU_BARNES_HUT:
     transfer_kinematics_to_simd();
     break;
   case SimulationMethod::GPU_PARTICLE_PARTICLE:
@@ -171,28 +405,40 @@ void Simulation::switch_method(SimulationMethod new_method) {
 }
 
 void Simulation::step() {
+  step_profiler = profiler.get();
+  PhaseScope scope(step_profiler, StepPhase::STEP);
+  step_arena->reset();
   switch (method) {
   case SimulationMethod::CPU_PARTICLE_PARTICLE:
-    for (int i=0; i<10; i++)
-      calc_accs_cpu_particle_particle();
-    transfer_simd_positions_to_cpu();
+  case SimulationMethod::CPU_BARNES_HUT:
+    for (int i=0; i<10; i++) {
+      step_cpu();
+      if (box_size > 0.0f) wrap_simd_positions();
+      if (collisions) resolve_collisions();
+    }
+    cpu_kinematics_current = false;
   break;
   case SimulationMethod::GPU_PARTICLE_PARTICLE:
-    for (int i=0; i<10; i++)
+    for (int i=0; i<10; i++) {
+      PhaseScope gpu_scope(step_profiler, StepPhase::GPU);
       calc_accs_gpu_particle_particle();
-    transfer_gpu_positions_to_cpu();
+    }
+    cpu_kinematics_current = false;
   break;
   }
+  step_profiler = nullptr;
 }
 
 void Simulation::set_COM_frame() {
   // do it on simd
   switch (method) {
+  case SimulationMethod::CPU_PARTICLE_PARTICLE:
+  case SimulationMethod::CPU_BARNES_HUT:
+  break;
   case SimulationMethod::GPU_PARTICLE_PARTICLE:
     transfer_gpu_kinematics_to_cpu();
     transfer_kinematics_to_simd();
   break;
-  default: break;
   }
 
   // calculate total momentum of system
@@ -209,13 +455,20 @@ void Simulation::set_COM_frame() {
     vel -= total_vel;
   }
   
+  invalidate_integrator_state();
+
   // transfer data back
-  transfer_simd_kinematics_to_cpu();
   switch (method) {
+  case SimulationMethod::CPU_PARTICLE_PARTICLE:
+  case SimulationMethod::CPU_BARNES_HUT:
+    transfer_simd_kinematics_to_cpu();
+  break;
   case SimulationMethod::GPU_PARTICLE_PARTICLE:
     transfer_simd_kinematics_to_cpu();
     transfer_kinematics_to_gpu();
+  break;
   }
+  cpu_kinematics_current = true;
 }
 
 } // namespace gravitysim
@@ -1,5 +1,7 @@
 #include "simulation.hpp"
 
+#include <cassert>
+
 #include <thrust/device_vector.h>
 #include <thrust/execution_policy.h>
 #include <thrust/copy.h>
@@ -21,6 +23,15 @@ void check_cuda(cudaError_t result, char const *const func, const char *const fi
   }
 }
 
+bool gpu_method_available() {
+  return true;
+}
+
+__host__ const float3 *Simulation::get_gpu_positions() {
+  assert(method == SimulationMethod::GPU_PARTICLE_PARTICLE);
+  return thrust::raw_pointer_cast(gpu_data.positions.data());
+}
+
 __host__ void Simulation::transfer_mus_to_gpu() {
   gpu_data.mus = mus;
 }
@@ -48,32 +59,27 @@ __host__ void Simulation::transfer_gpu_kinematics_to_cpu() {
   thrust::copy(gpu_data.vels.begin(), gpu_data.vels.end(), reinterpret_cast<float3 *>(vels.data()));
 }
 
-__host__ void Simulation::transfer_gpu_positions_to_cpu() {
-  // data has the same layout
-  // I have not found a better way of doing this
-  thrust::copy(gpu_data.positions.begin(), gpu_data.positions.end(), reinterpret_cast<float3 *>(positions.data()));
-}
-
-__global__ void gpu_particle_particle(float *mus, float3 *positions, float3 *vels, float3 *accs, size_t n, float G, float time_step) {
+__global__ void gpu_particle_particle(float *mus, float3 *positions, float3 *vels, float3 *accs, size_t n, size_t num_massive, float softening2, float time_step) {
   int i = blockIdx.x * blockDim.x + threadIdx.x; // thread id
   if (i >= n) return;
   float3 p1 = positions[i];
+  float3 acc = make_float3(0);
   
   // maybe use 2d thread but could have race conditions
-  // parallelized calculation of acceleration between all bodies
-  for (int j = 0; j < n; j++) {
+  // parallelized calculation of acceleration from all massive bodies
+  for (int j = 0; j < num_massive; j++) {
     if (i == j) continue;
     float3 p2 = positions[j];
     float3 diff = p2 - p1;
     
-    float acc_magnitude = mus[j] / dot(diff, diff);
-    
-    float3 unit_diff = normalize(diff);
-    float3 acc_delta = acc_magnitude * unit_diff;
-    
-    accs[i] += acc_delta;
+    // cubing dist2 in float would overflow past ~1e6 units, so cube the inverse instead
+    float dist2 = dot(diff, diff) + softening2;
+    float inv_dist = rsqrtf(dist2);
+    acc += mus[j] * inv_dist * inv_dist * inv_dist * diff;
   }
-  vels[i] += accs[i] * time_step;
+  // written rather than accumulated, so accs never needs clearing
+  accs[i] = acc;
+  vels[i] += acc * time_step;
 }
 
 __global__ void gpu_step(float3 *positions, float3 *vels, size_t n, float time_step) {
@@ -86,15 +92,14 @@ __host__ void Simulation::calc_accs_gpu_particle_particle() {
   unsigned int block_size = 256;
   unsigned int num_blocks = (num_bodies + block_size - 1) / block_size;
 
-  gpu_data.accs.assign(num_bodies, make_float3(0));
-
   gpu_particle_particle<<<block_size, num_blocks>>>(
       thrust::raw_pointer_cast(gpu_data.mus.data()),
       thrust::raw_pointer_cast(gpu_data.positions.data()),
       thrust::raw_pointer_cast(gpu_data.vels.data()),
       thrust::raw_pointer_cast(gpu_data.accs.data()),
       num_bodies,
-      G,
+      num_massive,
+      softening2,
       time_step
   );
   
@@ -0,0 +1,72 @@
+// Host stand-in for src/simulation.cu, built when CUDA is not available. It
+// runs the same kick then drift passes over the host copy of gpu_data, so the
+// GPU method keeps working, just without the speed.
+#include "simulation.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace gravitysim {
+
+bool gpu_method_available() {
+  return false;
+}
+
+const float3 *Simulation::get_gpu_positions() {
+  assert(method == SimulationMethod::GPU_PARTICLE_PARTICLE);
+  return gpu_data.positions.data();
+}
+
+void Simulation::transfer_mus_to_gpu() {
+  gpu_data.mus.assign(mus.begin(), mus.end());
+}
+
+void Simulation::transfer_kinematics_to_gpu() {
+  gpu_data.positions.resize(num_bodies);
+  gpu_data.vels.resize(num_bodies);
+  gpu_data.accs.assign(num_bodies, float3{0.0f, 0.0f, 0.0f});
+  // the data has the same layout
+  std::memcpy(gpu_data.positions.data(), positions.data(), num_bodies * sizeof(vec3f));
+  std::memcpy(gpu_data.vels.data(), vels.data(), num_bodies * sizeof(vec3f));
+}
+
+void Simulation::transfer_gpu_kinematics_to_cpu() {
+  std::memcpy(positions.data(), gpu_data.positions.data(), num_bodies * sizeof(vec3f));
+  std::memcpy(vels.data(), gpu_data.vels.data(), num_bodies * sizeof(vec3f));
+}
+
+void Simulation::calc_accs_gpu_particle_particle() {
+  const float3 *p = gpu_data.positions.data();
+  pool->for_each(gpu_data.accs.begin(), gpu_data.accs.end(),
+    [&](float3 &acc) {
+      size_t i = &acc - gpu_data.accs.data();
+      acc = {0.0f, 0.0f, 0.0f};
+      for (size_t j = 0; j < num_massive; j++) {
+        if (i == j) continue;
+        float dx = p[j].x - p[i].x, dy = p[j].y - p[i].y, dz = p[j].z - p[i].z;
+        float dist2 = dx * dx + dy * dy + dz * dz + softening2;
+        float inv_dist = 1.0f / std::sqrt(dist2);
+        float s = gpu_data.mus[j] * inv_dist * inv_dist * inv_dist;
+        acc.x += s * dx;
+        acc.y += s * dy;
+        acc.z += s * dz;
+      }
+      // the kick only touches this body's velocity, as in the kernel
+      float3 &v = gpu_data.vels[i];
+      v.x += acc.x * time_step;
+      v.y += acc.y * time_step;
+      v.z += acc.z * time_step;
+    }
+  );
+  // the drift waits for every force, as after the kernel's synchronize
+  for (size_t i = 0; i < num_bodies; i++) {
+    float3 &x = gpu_data.positions[i];
+    const float3 &v = gpu_data.vels[i];
+    x.x += v.x * time_step;
+    x.y += v.y * time_step;
+    x.z += v.z * time_step;
+  }
+}
+
+} // namespace gravitysim
@@ -0,0 +1,120 @@
+#include "simulation_runner.hpp"
+
+#include <algorithm>
+
+#include "event_trace.hpp"
+
+namespace gravitysim {
+
+SimulationRunner::SimulationRunner(Simulation &sim) : sim(sim) {}
+
+SimulationRunner::~SimulationRunner() {
+  stop();
+}
+
+void SimulationRunner::start() {
+  if (thread.joinable()) return;
+  quit = false;
+  thread = std::thread([this] { run(); });
+}
+
+void SimulationRunner::stop() {
+  if (!thread.joinable()) return;
+  {
+    std::lock_guard lock(command_mutex);
+    quit = true;
+  }
+  command_ready.notify_all();
+  thread.join();
+  // the simulation is no longer shared, so leftover commands run here
+  run_commands(false);
+}
+
+void SimulationRunner::set_running(bool running) {
+  {
+    std::lock_guard lock(command_mutex);
+    this->running = running;
+  }
+  command_ready.notify_all();
+}
+
+void SimulationRunner::submit(std::function<void(Simulation &)> f) {
+  {
+    std::lock_guard lock(command_mutex);
+    commands.push_back(std::move(f));
+  }
+  command_ready.notify_all();
+}
+
+std::shared_ptr<SnapshotChannel> SimulationRunner::subscribe() {
+  auto channel = std::make_shared<SnapshotChannel>();
+  auto add = [this, channel](Simulation &) {
+    channels.push_back(channel);
+    publish();
+  };
+  if (thread.joinable()) {
+    submit(add);
+  } else {
+    add(sim);
+  }
+  return channel;
+}
+
+void SimulationRunner::unsubscribe(const std::shared_ptr<SnapshotChannel> &channel) {
+  auto remove = [this, channel](Simulation &) {
+    channels.erase(std::remove(channels.begin(), channels.end(), channel), channels.end());
+  };
+  if (thread.joinable()) {
+    submit(remove);
+  } else {
+    remove(sim);
+  }
+}
+
+void SimulationRunner::run_commands(bool wait) {
+  std::vector<std::function<void(Simulation &)>> pending;
+  {
+    std::unique_lock lock(command_mutex);
+    if (wait) command_ready.wait(lock, [&] { return quit || running || !commands.empty(); });
+    pending.swap(commands);
+  }
+  for (auto &f : pending) f(sim);
+  // commands can change the state while paused, show it
+  if (!pending.empty()) publish();
+}
+
+void SimulationRunner::run() {
+  set_trace_thread_name("simulation runner");
+  while (!quit) {
+    run_commands(!running);
+    if (quit) break;
+    if (running) {
+      sim.step();
+      steps++;
+      publish();
+    }
+  }
+}
+
+void SimulationRunner::publish() {
+  if (channels.empty()) return;
+  TraceScope trace("publish", "runner");
+  uint64_t interval = energy_interval;
+  if (interval > 0 && steps % interval == 0) {
+    KE = sim.get_KE();
+    PE = sim.get_PE();
+  }
+  for (auto &channel : channels) {
+    Snapshot &snapshot = channel->buffer.write_buffer();
+    snapshot.step = steps;
+    Vec3View positions = sim.view_positions();
+    snapshot.positions.resize(positions.size());
+    positions.copy_to(snapshot.positions);
+    snapshot.ids.assign(sim.get_ids().begin(), sim.get_ids().end());
+    snapshot.KE = KE;
+    snapshot.PE = PE;
+    channel->buffer.publish();
+  }
+}
+
+} // namespace gravitysim
@@ -0,0 +1,445 @@
+#include "snapshot_store.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "event_trace.hpp"
+#include "memory_tracker.hpp"
+#include "octree.hpp"
+
+namespace gravitysim {
+
+namespace {
+
+constexpr char FILE_MAGIC[8] = {'G', 'S', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr char INDEX_MAGIC[8] = {'G', 'S', 'S', 'N', 'P', 'I', 'D', 'X'};
+constexpr size_t FIELD_SIZES[NUM_SNAPSHOT_FIELDS] = {sizeof(DirectX::XMFLOAT3), sizeof(DirectX::XMFLOAT3), sizeof(float),
+                                                     sizeof(uint32_t)};
+constexpr size_t FOOTER_SIZE = 8 + 8 + 4 + 8 + 8 + sizeof(INDEX_MAGIC);
+
+uint64_t fnv1a(const void *data, size_t bytes) {
+  auto p = static_cast<const uint8_t *>(data);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < bytes; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+template <class T>
+void append_pod(OutputArray<uint8_t> &out, const T &value) {
+  auto p = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <class T>
+void take_pod(const uint8_t *&p, T &value) {
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+}
+
+void append_chunk_info(OutputArray<uint8_t> &out, const ChunkInfo &info) {
+  append_pod(out, info.first_body);
+  append_pod(out, info.num_bodies);
+  for (uint64_t offset : info.offsets) append_pod(out, offset);
+  for (uint64_t checksum : info.checksums) append_pod(out, checksum);
+  append_pod(out, info.lo);
+  append_pod(out, info.hi);
+  append_pod(out, info.max_speed);
+  append_pod(out, info.min_mass);
+  append_pod(out, info.max_mass);
+  append_pod(out, info.min_id);
+  append_pod(out, info.max_id);
+}
+
+void take_chunk_info(const uint8_t *&p, ChunkInfo &info) {
+  take_pod(p, info.first_body);
+  take_pod(p, info.num_bodies);
+  for (uint64_t &offset : info.offsets) take_pod(p, offset);
+  for (uint64_t &checksum : info.checksums) take_pod(p, checksum);
+  take_pod(p, info.lo);
+  take_pod(p, info.hi);
+  take_pod(p, info.max_speed);
+  take_pod(p, info.min_mass);
+  take_pod(p, info.max_mass);
+  take_pod(p, info.min_id);
+  take_pod(p, info.max_id);
+}
+
+constexpr size_t CHUNK_INFO_SIZE = 8 + 8 + 8 * NUM_SNAPSHOT_FIELDS * 2 + 12 + 12 + 4 * 5;
+
+// positional reads and writes, safe to issue from many threads on one handle
+#ifdef _WIN32
+intptr_t open_file(const std::string &path, bool write) {
+  HANDLE file = CreateFileA(path.c_str(), write ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  return file == INVALID_HANDLE_VALUE ? -1 : reinterpret_cast<intptr_t>(file);
+}
+
+void close_file(intptr_t handle) {
+  CloseHandle(reinterpret_cast<HANDLE>(handle));
+}
+
+uint64_t file_size(intptr_t handle) {
+  LARGE_INTEGER size;
+  return GetFileSizeEx(reinterpret_cast<HANDLE>(handle), &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+}
+
+bool write_at(intptr_t handle, uint64_t offset, const void *data, size_t bytes) {
+  auto p = static_cast<const uint8_t *>(data);
+  while (bytes > 0) {
+    OVERLAPPED at = {};
+    at.Offset = static_cast<DWORD>(offset);
+    at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    DWORD request = static_cast<DWORD>(std::min<size_t>(bytes, 1u << 30));
+    if (!WriteFile(reinterpret_cast<HANDLE>(handle), p, request, &written, &at) || written == 0) return false;
+    p += written;
+    offset += written;
+    bytes -= written;
+  }
+  return true;
+}
+
+bool read_at_offset(intptr_t handle, uint64_t offset, void *data, size_t bytes) {
+  auto p = static_cast<uint8_t *>(data);
+  while (bytes > 0) {
+    OVERLAPPED at = {};
+    at.Offset = static_cast<DWORD>(offset);
+    at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD read = 0;
+    DWORD request = static_cast<DWORD>(std::min<size_t>(bytes, 1u << 30));
+    if (!ReadFile(reinterpret_cast<HANDLE>(handle), p, request, &read, &at) || read == 0) return false;
+    p += read;
+    offset += read;
+    bytes -= read;
+  }
+  return true;
+}
+#else
+intptr_t open_file(const std::string &path, bool write) {
+  int fd = write ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+  return fd < 0 ? -1 : fd;
+}
+
+void close_file(intptr_t handle) {
+  ::close(static_cast<int>(handle));
+}
+
+uint64_t file_size(intptr_t handle) {
+  off_t end = ::lseek(static_cast<int>(handle), 0, SEEK_END);
+  return end < 0 ? 0 : static_cast<uint64_t>(end);
+}
+
+bool write_at(intptr_t handle, uint64_t offset, const void *data, size_t bytes) {
+  auto p = static_cast<const uint8_t *>(data);
+  while (bytes > 0) {
+    ssize_t written = ::pwrite(static_cast<int>(handle), p, bytes, static_cast<off_t>(offset));
+    if (written <= 0) return false;
+    p += written;
+    offset += written;
+    bytes -= written;
+  }
+  return true;
+}
+
+bool read_at_offset(intptr_t handle, uint64_t offset, void *data, size_t bytes) {
+  auto p = static_cast<uint8_t *>(data);
+  while (bytes > 0) {
+    ssize_t read = ::pread(static_cast<int>(handle), p, bytes, static_cast<off_t>(offset));
+    if (read <= 0) return false;
+    p += read;
+    offset += read;
+    bytes -= read;
+  }
+  return true;
+}
+#endif
+
+// body indices sorted by the Morton key of their position in the bounding box
+void morton_order(const Vec3View &positions, OutputArray<uint32_t> &order, ThreadPool &pool) {
+  size_t n = positions.size();
+  order.resize(n);
+  if (n == 0) return;
+  auto box = [&](auto pick) {
+    return pool.transform_reduce(positions.begin(), positions.end(), positions[0], pick,
+                                 [](const DirectX::XMFLOAT3 &p) { return p; });
+  };
+  DirectX::XMFLOAT3 lo = box([](const DirectX::XMFLOAT3 &a, const DirectX::XMFLOAT3 &b) {
+    return DirectX::XMFLOAT3{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+  });
+  DirectX::XMFLOAT3 hi = box([](const DirectX::XMFLOAT3 &a, const DirectX::XMFLOAT3 &b) {
+    return DirectX::XMFLOAT3{std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+  });
+  constexpr float MAX_CELL = float((1u << LinearOctree::MAX_LEVEL) - 1);
+  float extent = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+  float scale = extent > 0.0f ? MAX_CELL / extent : 0.0f;
+  // NaN and anything the float rounding pushes out of range land in the edge cells
+  auto cell = [&](float v, float v_lo) {
+    float c = (v - v_lo) * scale;
+    return c >= 0.0f ? static_cast<uint32_t>(std::min(c, MAX_CELL)) : 0u;
+  };
+
+  OutputArray<uint64_t> keys(n);
+  pool.for_each(keys.begin(), keys.end(),
+    [&](uint64_t &key) {
+      size_t i = &key - keys.data();
+      DirectX::XMFLOAT3 p = positions[i];
+      key = morton_encode(cell(p.x, lo.x), cell(p.y, lo.y), cell(p.z, lo.z));
+      order[i] = static_cast<uint32_t>(i);
+    }
+  );
+  OutputArray<uint32_t> scratch(n);
+  pool.sort(order.begin(), order.end(), scratch.begin(),
+    [&](uint32_t a, uint32_t b) { return keys[a] < keys[b] || (keys[a] == keys[b] && a < b); });
+}
+
+} // namespace
+
+bool write_snapshot_store(const std::string &path, uint64_t step, const SnapshotColumns &columns, uint32_t chunk_size,
+                          ThreadPool &pool) {
+  TraceScope trace("write snapshot", "io");
+  size_t n = columns.positions.size();
+  if (columns.vels.size() != n || columns.masses.size() != n || columns.ids.size() != n) return false;
+  chunk_size = std::max(chunk_size, 1u);
+  size_t num_chunks = (n + chunk_size - 1) / chunk_size;
+
+  // each field's chunks follow one another, so one field reads sequentially
+  OutputArray<ChunkInfo> chunks(num_chunks);
+  uint64_t offset = sizeof(FILE_MAGIC);
+  for (size_t f = 0; f < NUM_SNAPSHOT_FIELDS; f++) {
+    for (size_t c = 0; c < num_chunks; c++) {
+      chunks[c].first_body = c * chunk_size;
+      chunks[c].num_bodies = std::min<uint64_t>(chunk_size, n - chunks[c].first_body);
+      chunks[c].offsets[f] = offset;
+      offset += chunks[c].num_bodies * FIELD_SIZES[f];
+    }
+  }
+  uint64_t index_offset = offset;
+
+  OutputArray<uint32_t> order;
+  morton_order(columns.positions, order, pool);
+
+  intptr_t handle = open_file(path, true);
+  if (handle == -1) return false;
+  std::atomic<bool> ok = write_at(handle, 0, FILE_MAGIC, sizeof(FILE_MAGIC));
+
+  pool.parallel_for(num_chunks, [&](size_t begin, size_t end) {
+    OutputArray<DirectX::XMFLOAT3> vec_column;
+    OutputArray<float> mass_column;
+    OutputArray<uint32_t> id_column;
+    for (size_t c = begin; c < end && ok.load(std::memory_order_relaxed); c++) {
+      ChunkInfo &info = chunks[c];
+      size_t first = info.first_body, count = info.num_bodies;
+      auto bodies = std::span(order).subspan(first, count);
+
+      vec_column.resize(count);
+      DirectX::XMFLOAT3 lo = columns.positions[bodies[0]], hi = lo;
+      for (size_t i = 0; i < count; i++) {
+        DirectX::XMFLOAT3 p = columns.positions[bodies[i]];
+        vec_column[i] = p;
+        lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+        hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+      }
+      info.lo = lo;
+      info.hi = hi;
+      size_t bytes = count * sizeof(DirectX::XMFLOAT3);
+      info.checksums[0] = fnv1a(vec_column.data(), bytes);
+      bool written = write_at(handle, info.offsets[0], vec_column.data(), bytes);
+
+      float max_speed_sq = 0.0f;
+      for (size_t i = 0; i < count; i++) {
+        DirectX::XMFLOAT3 v = columns.vels[bodies[i]];
+        vec_column[i] = v;
+        max_speed_sq = std::max(max_speed_sq, v.x * v.x + v.y * v.y + v.z * v.z);
+      }
+      info.max_speed = std::sqrt(max_speed_sq);
+      info.checksums[1] = fnv1a(vec_column.data(), bytes);
+      written = written && write_at(handle, info.offsets[1], vec_column.data(), bytes);
+
+      mass_column.resize(count);
+      id_column.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        mass_column[i] = columns.masses[bodies[i]];
+        id_column[i] = columns.ids[bodies[i]];
+      }
+      auto [min_mass, max_mass] = std::minmax_element(mass_column.begin(), mass_column.end());
+      info.min_mass = *min_mass;
+      info.max_mass = *max_mass;
+      info.checksums[2] = fnv1a(mass_column.data(), count * sizeof(float));
+      written = written && write_at(handle, info.offsets[2], mass_column.data(), count * sizeof(float));
+
+      auto [min_id, max_id] = std::minmax_element(id_column.begin(), id_column.end());
+      info.min_id = *min_id;
+      info.max_id = *max_id;
+      info.checksums[3] = fnv1a(id_column.data(), count * sizeof(uint32_t));
+      written = written && write_at(handle, info.offsets[3], id_column.data(), count * sizeof(uint32_t));
+
+      if (!written) ok.store(false, std::memory_order_relaxed);
+    }
+  });
+
+  OutputArray<uint8_t> tail;
+  tail.reserve(num_chunks * CHUNK_INFO_SIZE + FOOTER_SIZE);
+  for (const auto &info : chunks) append_chunk_info(tail, info);
+  append_pod(tail, step);
+  append_pod(tail, static_cast<uint64_t>(n));
+  append_pod(tail, chunk_size);
+  append_pod(tail, static_cast<uint64_t>(num_chunks));
+  append_pod(tail, index_offset);
+  tail.insert(tail.end(), INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+  bool written = ok.load() && write_at(handle, index_offset, tail.data(), tail.size());
+  close_file(handle);
+  return written;
+}
+
+bool write_snapshot_store(const std::string &path, uint64_t step, Simulation &simulation, uint32_t chunk_size,
+                          ThreadPool &pool) {
+  SnapshotColumns columns = {simulation.view_positions(), simulation.view_vels(), simulation.get_masses(),
+                             simulation.get_ids()};
+  return write_snapshot_store(path, step, columns, chunk_size, pool);
+}
+
+SnapshotStoreReader::SnapshotStoreReader(const std::string &path) {
+  open(path);
+}
+
+SnapshotStoreReader::~SnapshotStoreReader() {
+  close();
+}
+
+void SnapshotStoreReader::close() {
+  if (handle != -1) close_file(handle);
+  handle = -1;
+  chunks.clear();
+  num_bodies = 0;
+}
+
+bool SnapshotStoreReader::read_at(uint64_t offset, void *data, size_t bytes) const {
+  return read_at_offset(handle, offset, data, bytes);
+}
+
+bool SnapshotStoreReader::open(const std::string &path) {
+  close();
+  handle = open_file(path, false);
+  if (handle == -1) return false;
+
+  char magic[8];
+  uint8_t footer[FOOTER_SIZE];
+  uint64_t size = file_size(handle);
+  if (size < sizeof(FILE_MAGIC) + FOOTER_SIZE || !read_at(0, magic, sizeof(magic)) ||
+      std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 || !read_at(size - FOOTER_SIZE, footer, FOOTER_SIZE) ||
+      std::memcmp(footer + FOOTER_SIZE - sizeof(INDEX_MAGIC), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+    close();
+    return false;
+  }
+  const uint8_t *p = footer;
+  uint64_t num_chunks, index_offset;
+  take_pod(p, step);
+  take_pod(p, num_bodies);
+  take_pod(p, chunk_size);
+  take_pod(p, num_chunks);
+  take_pod(p, index_offset);
+  if (index_offset + num_chunks * CHUNK_INFO_SIZE + FOOTER_SIZE != size) {
+    close();
+    return false;
+  }
+
+  std::vector<uint8_t> index(num_chunks * CHUNK_INFO_SIZE);
+  if (!read_at(index_offset, index.data(), index.size())) {
+    close();
+    return false;
+  }
+  chunks.resize(num_chunks);
+  p = index.data();
+  for (auto &info : chunks) take_chunk_info(p, info);
+  return true;
+}
+
+bool SnapshotStoreReader::read_chunk(size_t chunk, SnapshotField field, void *dst) const {
+  const ChunkInfo &info = chunks[chunk];
+  size_t f = static_cast<size_t>(field);
+  size_t bytes = info.num_bodies * FIELD_SIZES[f];
+  return read_at(info.offsets[f], dst, bytes) && fnv1a(dst, bytes) == info.checksums[f];
+}
+
+template <class T>
+bool SnapshotStoreReader::read_column(SnapshotField field, std::vector<T> &out, ThreadPool &pool) const {
+  if (!is_open()) return false;
+  out.resize(num_bodies);
+  std::atomic<bool> ok = true;
+  pool.parallel_for(chunks.size(), [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; c++) {
+      if (!read_chunk(c, field, out.data() + chunks[c].first_body)) ok.store(false, std::memory_order_relaxed);
+    }
+  });
+  return ok.load();
+}
+
+bool SnapshotStoreReader::read_positions(std::vector<DirectX::XMFLOAT3> &out, ThreadPool &pool) const {
+  return read_column(SnapshotField::POSITIONS, out, pool);
+}
+
+bool SnapshotStoreReader::read_vels(std::vector<DirectX::XMFLOAT3> &out, ThreadPool &pool) const {
+  return read_column(SnapshotField::VELOCITIES, out, pool);
+}
+
+bool SnapshotStoreReader::read_masses(std::vector<float> &out, ThreadPool &pool) const {
+  return read_column(SnapshotField::MASSES, out, pool);
+}
+
+bool SnapshotStoreReader::read_ids(std::vector<uint32_t> &out, ThreadPool &pool) const {
+  return read_column(SnapshotField::IDS, out, pool);
+}
+
+std::vector<size_t> SnapshotStoreReader::chunks_in_box(const DirectX::XMFLOAT3 &lo, const DirectX::XMFLOAT3 &hi) const {
+  std::vector<size_t> result;
+  for (size_t c = 0; c < chunks.size(); c++) {
+    const ChunkInfo &info = chunks[c];
+    if (info.lo.x <= hi.x && info.hi.x >= lo.x && info.lo.y <= hi.y && info.hi.y >= lo.y && info.lo.z <= hi.z &&
+        info.hi.z >= lo.z) {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+bool SnapshotStoreReader::query_box(const DirectX::XMFLOAT3 &lo, const DirectX::XMFLOAT3 &hi, std::vector<uint32_t> &ids,
+                                    std::vector<DirectX::XMFLOAT3> &positions) const {
+  ids.clear();
+  positions.clear();
+  if (!is_open()) return false;
+  std::vector<DirectX::XMFLOAT3> chunk_positions;
+  std::vector<uint32_t> chunk_ids;
+  for (size_t c : chunks_in_box(lo, hi)) {
+    chunk_positions.resize(chunks[c].num_bodies);
+    chunk_ids.resize(chunks[c].num_bodies);
+    if (!read_chunk(c, SnapshotField::POSITIONS, chunk_positions.data()) ||
+        !read_chunk(c, SnapshotField::IDS, chunk_ids.data())) {
+      return false;
+    }
+    for (size_t i = 0; i < chunk_positions.size(); i++) {
+      const DirectX::XMFLOAT3 &p = chunk_positions[i];
+      if (p.x >= lo.x && p.x <= hi.x && p.y >= lo.y && p.y <= hi.y && p.z >= lo.z && p.z <= hi.z) {
+        ids.push_back(chunk_ids[i]);
+        positions.push_back(p);
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace gravitysim
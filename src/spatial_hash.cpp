@@ -0,0 +1,54 @@
+#include "spatial_hash.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <numeric>
+
+namespace gravitysim {
+
+using namespace DirectX;
+
+void SpatialHash::build(std::span<const XMVECTOR> positions, float cell_size, float box_size, ThreadPool &pool) {
+  size_t n = positions.size();
+  periodic_cells = 0;
+  if (box_size > 0.0f) {
+    // a whole number of cells at least cell_size wide tiles the box
+    periodic_cells = std::max(1, clamp_cell(std::floor(box_size / cell_size)));
+    cell_size = box_size / static_cast<float>(periodic_cells);
+  }
+  inv_cell_size = 1.0f / cell_size;
+  // about two buckets per body keeps unrelated cells from sharing buckets
+  size_t table_size = std::bit_ceil(std::max<size_t>(2 * n, 1));
+  table_mask = static_cast<uint32_t>(table_size - 1);
+
+  body_buckets.resize(n);
+  sorted_bodies.resize(n);
+  sort_scratch.resize(n);
+  pool.for_each(body_buckets.begin(), body_buckets.end(),
+    [&](uint32_t &b) {
+      size_t i = &b - body_buckets.data();
+      XMINT3 c = cell(positions[i]);
+      b = bucket(c.x, c.y, c.z);
+      sorted_bodies[i] = static_cast<uint32_t>(i);
+    }
+  );
+  pool.sort(sorted_bodies.begin(), sorted_bodies.end(), sort_scratch.begin(),
+    [&](uint32_t a, uint32_t b) {
+      return body_buckets[a] < body_buckets[b] || (body_buckets[a] == body_buckets[b] && a < b);
+    }
+  );
+
+  // empty buckets have begin == end
+  bucket_begin.assign(table_size, 0);
+  bucket_end.assign(table_size, 0);
+  pool.for_each(sorted_bodies.begin(), sorted_bodies.end(),
+    [&](const uint32_t &body) {
+      size_t k = &body - sorted_bodies.data();
+      uint32_t b = body_buckets[body];
+      if (k == 0 || body_buckets[sorted_bodies[k - 1]] != b) bucket_begin[b] = static_cast<uint32_t>(k);
+      if (k + 1 == n || body_buckets[sorted_bodies[k + 1]] != b) bucket_end[b] = static_cast<uint32_t>(k + 1);
+    }
+  );
+}
+
+} // namespace gravitysim
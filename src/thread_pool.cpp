@@ -0,0 +1,165 @@
+#include "thread_pool.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <string>
+
+#include "event_trace.hpp"
+
+namespace gravitysim {
+
+namespace {
+
+// the pool and queue of the worker running on this thread, if any
+thread_local ThreadPool *current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+void pin_to_core(std::thread &thread, size_t core) {
+#ifdef _WIN32
+  SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core % CPU_SETSIZE, &set);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+  (void)thread;
+  (void)core;
+#endif
+}
+
+} // namespace
+
+void ThreadPool::WorkQueue::push_back(const Task &task) {
+  if (count == ring.size()) {
+    // unwrap into a ring twice the size
+    std::vector<Task> grown(2 * ring.size());
+    for (size_t k = 0; k < count; k++) grown[k] = ring[(head + k) % ring.size()];
+    ring.swap(grown);
+    head = 0;
+  }
+  ring[(head + count++) % ring.size()] = task;
+}
+
+ThreadPool::ThreadPool(size_t num_threads, bool pin_threads) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t num_workers = num_threads - 1;
+  size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t k = 0; k < num_workers; k++) {
+    queues.push_back(std::make_unique<WorkQueue>());
+  }
+  for (size_t k = 0; k < num_workers; k++) {
+    threads.emplace_back([this, k] { worker_loop(k); });
+    if (pin_threads) pin_to_core(threads.back(), (k + 1) % num_cores);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(sleep_mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &thread : threads) thread.join();
+}
+
+bool ThreadPool::find_task(size_t index, Task &task) {
+  size_t num_queues = queues.size();
+  for (size_t k = 0; k < num_queues; k++) {
+    // own queue from the back, others from the front
+    size_t q = (index + k) % num_queues;
+    WorkQueue &queue = *queues[q];
+    std::lock_guard lock(queue.mutex);
+    if (queue.count == 0) continue;
+    task = k == 0 ? queue.pop_back() : queue.pop_front();
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+  current_pool = this;
+  current_queue = index;
+  set_trace_thread_name("pool worker " + std::to_string(index + 1));
+  while (true) {
+    Task task;
+    if (find_task(index, task)) {
+      {
+        TraceScope trace("task", "pool");
+        task.run(task.ctx, task.begin, task.end);
+      }
+      task.pending->fetch_sub(1, std::memory_order_release);
+      continue;
+    }
+    // steps come back to back, so spin briefly before sleeping
+    bool found = false;
+    for (int spin = 0; spin < 256 && !found; spin++) {
+      std::this_thread::yield();
+      found = queued.load(std::memory_order_relaxed) > 0;
+    }
+    if (found) continue;
+
+    std::unique_lock lock(sleep_mutex);
+    wake.wait(lock, [&] { return stop || queued.load(std::memory_order_relaxed) > 0; });
+    if (stop && queued.load(std::memory_order_relaxed) == 0) return;
+  }
+}
+
+void ThreadPool::run_chunks(size_t n, size_t num_chunks, void (*fn)(void *, size_t, size_t), void *ctx) {
+  if (n == 0) return;
+  if (threads.empty() || num_chunks <= 1) {
+    fn(ctx, 0, n);
+    return;
+  }
+
+  size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+  num_chunks = (n + chunk_size - 1) / chunk_size;
+  std::atomic<size_t> pending = num_chunks;
+
+  // a worker keeps its chunks on its own deque for the others to steal,
+  // an outside caller deals them out across all deques
+  bool inside = current_pool == this;
+  size_t home = inside ? current_queue : 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    WorkQueue &queue = *queues[inside ? home : c % queues.size()];
+    std::lock_guard lock(queue.mutex);
+    queue.push_back({fn, ctx, c * chunk_size, std::min(n, (c + 1) * chunk_size), &pending});
+  }
+  queued.fetch_add(num_chunks, std::memory_order_relaxed);
+  {
+    // a worker between checking queued and waiting holds the mutex, so it cannot miss this
+    std::lock_guard lock(sleep_mutex);
+  }
+  wake.notify_all();
+
+  // help until every chunk is done, possibly running chunks of other calls
+  while (pending.load(std::memory_order_acquire) > 0) {
+    Task task;
+    if (find_task(home, task)) {
+      {
+        TraceScope trace("task", "pool");
+        task.run(task.ctx, task.begin, task.end);
+      }
+      task.pending->fetch_sub(1, std::memory_order_release);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+ThreadPool &default_thread_pool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+} // namespace gravitysim
@@ -0,0 +1,410 @@
+#include "trajectory.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#include "event_trace.hpp"
+#include "octree.hpp"
+#include "thread_pool.hpp"
+
+namespace gravitysim {
+
+namespace {
+
+constexpr char FILE_MAGIC[8] = {'G', 'S', 'T', 'R', 'A', 'J', '0', '1'};
+constexpr char FRAME_MAGIC[4] = {'F', 'R', 'A', 'M'};
+constexpr char INDEX_MAGIC[8] = {'G', 'S', 'T', 'R', 'J', 'I', 'D', 'X'};
+constexpr uint32_t KEYFRAME = 1;
+// bodies per independently coded block
+constexpr size_t BLOCK_BODIES = 1 << 16;
+
+template <class T>
+void write_pod(std::ofstream &file, const T &value) {
+  file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+bool read_pod(std::ifstream &file, T &value) {
+  return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+inline void put_varint(OutputArray<uint8_t> &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<uint8_t>(v) | 0x80);
+    v >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+inline uint64_t get_varint(const uint8_t *&p, const uint8_t *end) {
+  uint64_t v = 0;
+  for (uint32_t shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = *p++;
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) break;
+  }
+  return v;
+}
+
+// order-0 byte-wise rANS with 12 bit probabilities and 32 bit state (Duda 2013)
+constexpr uint32_t PROB_BITS = 12;
+constexpr uint32_t PROB_SCALE = 1u << PROB_BITS;
+constexpr uint32_t RANS_L = 1u << 23;
+
+// scales counts to sum to PROB_SCALE, keeping every present symbol at least 1
+void normalize_freqs(const uint32_t *counts, size_t total, uint16_t *freqs) {
+  uint32_t sum = 0;
+  size_t best = 0;
+  for (size_t s = 0; s < 256; s++) {
+    freqs[s] = 0;
+    if (counts[s] == 0) continue;
+    freqs[s] = static_cast<uint16_t>(std::max<uint64_t>(1, uint64_t(counts[s]) * PROB_SCALE / total));
+    sum += freqs[s];
+    if (counts[s] > counts[best]) best = s;
+  }
+  if (sum == 0) return;
+  if (sum < PROB_SCALE) {
+    freqs[best] += static_cast<uint16_t>(PROB_SCALE - sum);
+  }
+  // rounding up rare symbols can overshoot, take it back from the common ones
+  while (sum > PROB_SCALE) {
+    for (size_t s = 0; s < 256 && sum > PROB_SCALE; s++) {
+      if (freqs[s] > 1) {
+        freqs[s]--;
+        sum--;
+      }
+    }
+  }
+}
+
+// appends the frequency table and the coded bytes to out
+void rans_encode(const OutputArray<uint8_t> &in, OutputArray<uint8_t> &out) {
+  uint32_t counts[256] = {};
+  for (uint8_t b : in) counts[b]++;
+  uint16_t freqs[256];
+  normalize_freqs(counts, in.size(), freqs);
+  uint32_t cum[256];
+  for (uint32_t s = 0, c = 0; s < 256; s++) {
+    cum[s] = c;
+    c += freqs[s];
+  }
+
+  out.resize(sizeof(freqs));
+  std::memcpy(out.data(), freqs, sizeof(freqs));
+
+  // a symbol costs at most PROB_BITS bits, the coder writes backwards
+  OutputArray<uint8_t> coded(in.size() * PROB_BITS / 8 + 16);
+  uint8_t *end = coded.data() + coded.size();
+  uint8_t *p = end;
+  uint32_t x = RANS_L;
+  for (size_t i = in.size(); i-- > 0;) {
+    uint32_t f = freqs[in[i]];
+    uint32_t x_max = ((RANS_L >> PROB_BITS) << 8) * f;
+    while (x >= x_max) {
+      *--p = static_cast<uint8_t>(x);
+      x >>= 8;
+    }
+    x = ((x / f) << PROB_BITS) + (x % f) + cum[in[i]];
+  }
+  p -= 4;
+  for (int k = 0; k < 4; k++) p[k] = static_cast<uint8_t>(x >> (8 * k));
+  out.insert(out.end(), p, end);
+}
+
+// decodes n bytes from the output of rans_encode
+bool rans_decode(const std::vector<uint8_t> &in, std::vector<uint8_t> &out, size_t n) {
+  uint16_t freqs[256];
+  if (in.size() < sizeof(freqs) + 4) return false;
+  std::memcpy(freqs, in.data(), sizeof(freqs));
+  uint32_t cum[256];
+  std::vector<uint8_t> slot_symbol(PROB_SCALE);
+  uint32_t c = 0;
+  for (uint32_t s = 0; s < 256; s++) {
+    cum[s] = c;
+    if (c + freqs[s] > PROB_SCALE) return false;
+    std::fill(slot_symbol.begin() + c, slot_symbol.begin() + c + freqs[s], static_cast<uint8_t>(s));
+    c += freqs[s];
+  }
+
+  const uint8_t *p = in.data() + sizeof(freqs);
+  const uint8_t *end = in.data() + in.size();
+  uint32_t x = 0;
+  for (int k = 0; k < 4; k++) x |= static_cast<uint32_t>(p[k]) << (8 * k);
+  p += 4;
+
+  out.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t slot = x & (PROB_SCALE - 1);
+    uint8_t s = slot_symbol[slot];
+    out[i] = s;
+    x = freqs[s] * (x >> PROB_BITS) + slot - cum[s];
+    while (x < RANS_L && p < end) x = (x << 8) | *p++;
+  }
+  return true;
+}
+
+} // namespace
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path, double precision, uint32_t keyframe_interval) {
+  open(path, precision, keyframe_interval);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+  close();
+}
+
+bool TrajectoryWriter::open(const std::string &path, double precision, uint32_t keyframe_interval) {
+  close();
+  this->precision = precision;
+  this->keyframe_interval = std::max(keyframe_interval, 1u);
+  index.clear();
+  previous.clear();
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+  write_pod(file, precision);
+  write_pod(file, this->keyframe_interval);
+  return static_cast<bool>(file);
+}
+
+void TrajectoryWriter::begin_keyframe(const Vec3View &positions) {
+  size_t n = positions.size();
+  ThreadPool &pool = default_thread_pool();
+
+  // the grid is anchored at the bounding box corner
+  DirectX::XMFLOAT3 lo = positions.empty() ? DirectX::XMFLOAT3{0, 0, 0} : positions[0];
+  lo = pool.transform_reduce(positions.begin(), positions.end(), lo,
+    [](const DirectX::XMFLOAT3 &a, const DirectX::XMFLOAT3 &b) {
+      return DirectX::XMFLOAT3{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+    },
+    [](const DirectX::XMFLOAT3 &p) { return p; }
+  );
+  origin = {lo.x, lo.y, lo.z};
+
+  // Morton keys from the quantized positions, coarsened to 21 bits per axis
+  OutputArray<std::array<uint64_t, 3>> cells(n);
+  uint64_t max_cell = 0;
+  for (size_t i = 0; i < n; i++) {
+    DirectX::XMFLOAT3 p = positions[i];
+    cells[i] = {static_cast<uint64_t>(std::llround((p.x - origin[0]) / precision)),
+                static_cast<uint64_t>(std::llround((p.y - origin[1]) / precision)),
+                static_cast<uint64_t>(std::llround((p.z - origin[2]) / precision))};
+    max_cell = std::max({max_cell, cells[i][0], cells[i][1], cells[i][2]});
+  }
+  int shift = std::max(0, static_cast<int>(std::bit_width(max_cell)) - static_cast<int>(LinearOctree::MAX_LEVEL));
+  OutputArray<uint64_t> keys(n);
+  pool.for_each(keys.begin(), keys.end(),
+    [&](uint64_t &key) {
+      size_t i = &key - keys.data();
+      key = morton_encode(static_cast<uint32_t>(cells[i][0] >> shift), static_cast<uint32_t>(cells[i][1] >> shift),
+                          static_cast<uint32_t>(cells[i][2] >> shift));
+    }
+  );
+
+  order.resize(n);
+  order_scratch.resize(n);
+  for (size_t i = 0; i < n; i++) order[i] = static_cast<uint32_t>(i);
+  pool.sort(order.begin(), order.end(), order_scratch.begin(),
+    [&](uint32_t a, uint32_t b) { return keys[a] < keys[b] || (keys[a] == keys[b] && a < b); });
+}
+
+bool TrajectoryWriter::write_frame(uint64_t step, const Vec3View &positions) {
+  TraceScope trace("write trajectory frame", "io");
+  if (!file) return false;
+  size_t n = positions.size();
+  bool keyframe = previous.size() != n || index.size() % keyframe_interval == 0;
+  if (keyframe) begin_keyframe(positions);
+  ThreadPool &pool = default_thread_pool();
+
+  current.resize(n);
+  pool.for_each(current.begin(), current.end(),
+    [&](std::array<int64_t, 3> &q) {
+      size_t k = &q - current.data();
+      DirectX::XMFLOAT3 p = positions[order[k]];
+      q = {std::llround((p.x - origin[0]) / precision), std::llround((p.y - origin[1]) / precision),
+           std::llround((p.z - origin[2]) / precision)};
+    }
+  );
+
+  // keyframes code against the previous body in Morton order, other frames against the previous frame
+  size_t num_blocks = (n + BLOCK_BODIES - 1) / BLOCK_BODIES;
+  block_bytes.resize(num_blocks);
+  block_coded.resize(num_blocks);
+  pool.for_each(block_bytes.begin(), block_bytes.end(),
+    [&](OutputArray<uint8_t> &bytes) {
+      size_t b = &bytes - block_bytes.data();
+      size_t begin = b * BLOCK_BODIES, end = std::min(n, begin + BLOCK_BODIES);
+      bytes.clear();
+      for (size_t k = begin; k < end; k++) {
+        if (keyframe) {
+          int64_t prev_index = k == begin ? 0 : order[k - 1];
+          put_varint(bytes, zigzag(int64_t(order[k]) - prev_index));
+          for (int a = 0; a < 3; a++) put_varint(bytes, zigzag(current[k][a] - (k == begin ? 0 : current[k - 1][a])));
+        } else {
+          for (int a = 0; a < 3; a++) put_varint(bytes, zigzag(current[k][a] - previous[k][a]));
+        }
+      }
+      rans_encode(bytes, block_coded[b]);
+    }
+  );
+
+  uint32_t flags = keyframe ? KEYFRAME : 0;
+  index.push_back({static_cast<uint64_t>(file.tellp()), step, flags});
+  file.write(FRAME_MAGIC, sizeof(FRAME_MAGIC));
+  write_pod(file, flags);
+  write_pod(file, step);
+  write_pod(file, static_cast<uint64_t>(n));
+  for (double o : origin) write_pod(file, o);
+  write_pod(file, static_cast<uint32_t>(num_blocks));
+  for (size_t b = 0; b < num_blocks; b++) {
+    write_pod(file, static_cast<uint32_t>(block_bytes[b].size()));
+    write_pod(file, static_cast<uint32_t>(block_coded[b].size()));
+    file.write(reinterpret_cast<const char *>(block_coded[b].data()), block_coded[b].size());
+  }
+
+  previous.swap(current);
+  return static_cast<bool>(file);
+}
+
+bool TrajectoryWriter::close() {
+  if (!file.is_open()) return true;
+  TraceScope trace("write trajectory index", "io");
+  uint64_t index_offset = static_cast<uint64_t>(file.tellp());
+  for (const auto &entry : index) {
+    write_pod(file, entry.offset);
+    write_pod(file, entry.step);
+    write_pod(file, entry.flags);
+  }
+  write_pod(file, static_cast<uint64_t>(index.size()));
+  write_pod(file, index_offset);
+  file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  bool ok = static_cast<bool>(file);
+  file.close();
+  return ok;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string &path) {
+  open(path);
+}
+
+bool TrajectoryReader::open(const std::string &path) {
+  file.close();
+  index.clear();
+  decoded_frame = SIZE_MAX;
+  file.open(path, std::ios::binary);
+  if (!file) return false;
+
+  char magic[8];
+  uint32_t keyframe_interval;
+  if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+      !read_pod(file, precision) || !read_pod(file, keyframe_interval)) {
+    file.close();
+    return false;
+  }
+
+  uint64_t num_frames, index_offset;
+  file.seekg(-static_cast<std::streamoff>(2 * sizeof(uint64_t) + sizeof(INDEX_MAGIC)), std::ios::end);
+  if (!read_pod(file, num_frames) || !read_pod(file, index_offset) || !file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) {
+    file.close();
+    return false;
+  }
+  file.seekg(static_cast<std::streamoff>(index_offset));
+  index.resize(num_frames);
+  for (auto &entry : index) {
+    if (!read_pod(file, entry.offset) || !read_pod(file, entry.step) || !read_pod(file, entry.flags)) {
+      file.close();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TrajectoryReader::decode_next(size_t frame) {
+  file.clear();
+  file.seekg(static_cast<std::streamoff>(index[frame].offset));
+  char magic[4];
+  uint32_t flags, num_blocks;
+  uint64_t step, n;
+  if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, FRAME_MAGIC, sizeof(magic)) != 0 ||
+      !read_pod(file, flags) || !read_pod(file, step) || !read_pod(file, n)) {
+    return false;
+  }
+  for (double &o : origin) read_pod(file, o);
+  if (!read_pod(file, num_blocks)) return false;
+
+  bool keyframe = flags & KEYFRAME;
+  if (!keyframe && quantized.size() != n) return false;
+  if (keyframe) {
+    order.resize(n);
+    quantized.resize(n);
+  }
+
+  // blocks are read in turn and decoded in parallel
+  std::vector<std::vector<uint8_t>> coded(num_blocks);
+  std::vector<uint32_t> raw_sizes(num_blocks);
+  for (uint32_t b = 0; b < num_blocks; b++) {
+    uint32_t coded_size;
+    if (!read_pod(file, raw_sizes[b]) || !read_pod(file, coded_size)) return false;
+    coded[b].resize(coded_size);
+    if (!file.read(reinterpret_cast<char *>(coded[b].data()), coded_size)) return false;
+  }
+
+  std::vector<uint8_t> ok(num_blocks, 1);
+  default_thread_pool().for_each(coded.begin(), coded.end(),
+    [&](const std::vector<uint8_t> &block) {
+      size_t b = &block - coded.data();
+      std::vector<uint8_t> bytes;
+      if (!rans_decode(block, bytes, raw_sizes[b])) {
+        ok[b] = 0;
+        return;
+      }
+      const uint8_t *p = bytes.data(), *end = bytes.data() + bytes.size();
+      size_t begin = b * BLOCK_BODIES, last = std::min<size_t>(n, begin + BLOCK_BODIES);
+      for (size_t k = begin; k < last; k++) {
+        if (keyframe) {
+          int64_t prev_index = k == begin ? 0 : order[k - 1];
+          order[k] = static_cast<uint32_t>(prev_index + unzigzag(get_varint(p, end)));
+          for (int a = 0; a < 3; a++) {
+            quantized[k][a] = (k == begin ? 0 : quantized[k - 1][a]) + unzigzag(get_varint(p, end));
+          }
+        } else {
+          for (int a = 0; a < 3; a++) quantized[k][a] += unzigzag(get_varint(p, end));
+        }
+      }
+    }
+  );
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end()) return false;
+  decoded_frame = frame;
+  return true;
+}
+
+bool TrajectoryReader::read_frame(size_t frame, std::vector<DirectX::XMFLOAT3> &positions) {
+  if (frame >= index.size()) return false;
+
+  // continue from the decoded frame unless a keyframe is closer
+  size_t start = frame;
+  while (start > 0 && !(index[start].flags & KEYFRAME)) start--;
+  if (decoded_frame != SIZE_MAX && decoded_frame >= start && decoded_frame <= frame) start = decoded_frame + 1;
+  for (size_t f = start; f <= frame; f++) {
+    if (!decode_next(f)) {
+      decoded_frame = SIZE_MAX;
+      return false;
+    }
+  }
+
+  positions.resize(quantized.size());
+  for (size_t k = 0; k < quantized.size(); k++) {
+    positions[order[k]] = {static_cast<float>(origin[0] + quantized[k][0] * precision),
+                           static_cast<float>(origin[1] + quantized[k][1] * precision),
+                           static_cast<float>(origin[2] + quantized[k][2] * precision)};
+  }
+  return true;
+}
+
+} // namespace gravitysim
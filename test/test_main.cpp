@@ -1,6 +1,20 @@
 #include <gtest/gtest.h>
 
+#include "catalog_loader.hpp"
+#include "ensemble.hpp"
+#include "event_trace.hpp"
+#include "gadget_io.hpp"
+#include "run_config.hpp"
 #include "simulation.hpp"
+#include "simulation_runner.hpp"
+#include "snapshot_store.hpp"
+#include "trajectory.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <sstream>
 
 TEST(Hello, BasicAssertions) {
   EXPECT_STRNE("hello", "world");
@@ -98,3 +112,1047 @@ TEST(GravitySim, CPU_and_GPU_same) {
     }
   }
 }
+
+TEST(GravitySim, GPUMatchesCPUAtLargeSeparations) {
+  // 1e7 units apart, where the cube of dist2 no longer fits in a float
+  std::vector<float> masses = {1.0f, 1.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{-5e6f, 0, 0}, {5e6f, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, 0, 0}};
+  gravitysim::Simulation sim_cpu(masses, positions, vels, 1e-3);
+  gravitysim::Simulation sim_gpu(masses, positions, vels, 1e-3);
+  sim_cpu.set_G(1e14f);
+  sim_gpu.set_G(1e14f);
+  // the GPU method kicks then drifts
+  sim_cpu.set_integrator(gravitysim::Integrator::EULER_CROMER);
+  sim_gpu.switch_method(gravitysim::SimulationMethod::GPU_PARTICLE_PARTICLE);
+  sim_cpu.step();
+  sim_gpu.step();
+
+  const auto &cpu_vels = sim_cpu.get_vels();
+  const auto &gpu_vels = sim_gpu.get_vels();
+  ASSERT_GT(cpu_vels[0].x, 0.0f);
+  for (size_t i = 0; i < cpu_vels.size(); i++) {
+    EXPECT_NEAR(gpu_vels[i].x, cpu_vels[i].x, 1e-4f * std::abs(cpu_vels[i].x));
+  }
+}
+
+TEST(GravitySim, OctreeCoversBodies) {
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+  std::vector<DirectX::XMVECTOR> positions;
+  std::vector<float> mus;
+  for (int i=0; i<5000; i++) {
+    positions.push_back(DirectX::XMVectorSet(dist(rng), dist(rng), dist(rng) * 0.1f, 0.0f));
+    mus.push_back(1.0f);
+  }
+  gravitysim::LinearOctree octree(8);
+  octree.build(positions, mus);
+
+  const auto &nodes = octree.get_nodes();
+  const auto &keys = octree.get_keys();
+  EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+  EXPECT_EQ(nodes[0].count(), positions.size());
+  EXPECT_FLOAT_EQ(nodes[0].mu, 5000.0f);
+  for (const auto &node : nodes) {
+    if (node.is_leaf()) {
+      EXPECT_LE(node.count(), 8u);
+      continue;
+    }
+    // children partition the parent's range
+    uint32_t next = node.begin;
+    for (uint32_t c = node.first_child; c < node.first_child + node.num_children; c++) {
+      EXPECT_EQ(nodes[c].begin, next);
+      EXPECT_EQ(nodes[c].level, node.level + 1);
+      next = nodes[c].end;
+    }
+    EXPECT_EQ(next, node.end);
+  }
+}
+
+TEST(GravitySim, BarnesHutMatchesParticleParticle) {
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<float> dist(-50.0f, 50.0f);
+  std::vector<float> masses;
+  std::vector<DirectX::XMFLOAT3> positions, vels;
+  for (int i=0; i<500; i++) {
+    masses.push_back(1.0f);
+    positions.push_back({dist(rng), dist(rng), dist(rng)});
+    vels.push_back({0, 0, 0});
+  }
+  gravitysim::Simulation sim_pp(masses, positions, vels, 1e-2f);
+  gravitysim::Simulation sim_bh(masses, positions, vels, 1e-2f);
+  sim_pp.set_G(1e1);
+  sim_bh.set_G(1e1);
+  sim_bh.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+  // never opening criterion is met, so the walk is an exact direct sum
+  sim_bh.set_theta(0.0f);
+
+  sim_pp.step();
+  sim_bh.step();
+  const auto &pp = sim_pp.get_positions();
+  const auto &bh = sim_bh.get_positions();
+  for (int i=0; i<pp.size(); i++) {
+    EXPECT_NEAR(pp[i].x, bh[i].x, 1e-3f);
+    EXPECT_NEAR(pp[i].y, bh[i].y, 1e-3f);
+    EXPECT_NEAR(pp[i].z, bh[i].z, 1e-3f);
+  }
+}
+
+TEST(GravitySim, HermiteConservesTE) {
+  // circular two body orbit with a period of about 11.5 time units
+  std::vector<float> masses = {2e1, 1e1};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {10, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, sqrtf(30.0f), 0}};
+  gravitysim::Simulation sim_euler(masses, positions, vels, 1e-2f);
+  gravitysim::Simulation sim_hermite(masses, positions, vels, 1e-2f);
+  sim_euler.set_G(1e1);
+  sim_hermite.set_G(1e1);
+  sim_euler.set_COM_frame();
+  sim_hermite.set_COM_frame();
+  sim_hermite.set_integrator(gravitysim::Integrator::HERMITE);
+
+  float TE = sim_hermite.get_KE() + sim_hermite.get_PE();
+  float euler_error = 0.0f, hermite_error = 0.0f;
+  for (int i=0; i<100; i++) {
+    sim_euler.step();
+    sim_hermite.step();
+    // synchronizes vels from simd data
+    sim_euler.set_COM_frame();
+    sim_hermite.set_COM_frame();
+    euler_error = std::max(euler_error, fabsf(sim_euler.get_KE() + sim_euler.get_PE() - TE));
+    hermite_error = std::max(hermite_error, fabsf(sim_hermite.get_KE() + sim_hermite.get_PE() - TE));
+  }
+  printf("Max TE error over one orbit: Euler-Cromer %g, Hermite %g\n", euler_error, hermite_error);
+  EXPECT_LT(hermite_error, 1e-4f * fabsf(TE));
+  EXPECT_LT(hermite_error * 10.0f, euler_error);
+}
+
+TEST(GravitySim, YoshidaMoreAccurateThanLeapfrog) {
+  // eccentric two body orbit, compare final positions against a small step reference
+  std::vector<float> masses = {2e1, 1e1};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {10, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, 4.0f, 0}};
+  auto run = [&](gravitysim::Integrator integrator, float time_step, int steps) {
+    gravitysim::Simulation sim(masses, positions, vels, time_step);
+    sim.set_G(1e1);
+    sim.set_COM_frame();
+    sim.set_integrator(integrator);
+    for (int i=0; i<steps; i++) sim.step();
+    return sim.get_positions()[1];
+  };
+  auto reference = run(gravitysim::Integrator::YOSHIDA6, 1e-3f, 500);
+  auto leapfrog = run(gravitysim::Integrator::LEAPFROG, 5e-2f, 10);
+  auto yoshida4 = run(gravitysim::Integrator::YOSHIDA4, 5e-2f, 10);
+  auto error = [&](DirectX::XMFLOAT3 p) {
+    return std::hypot(p.x - reference.x, p.y - reference.y, p.z - reference.z);
+  };
+  printf("Position error: leapfrog %g, Yoshida 4 %g\n", error(leapfrog), error(yoshida4));
+  EXPECT_LT(error(yoshida4) * 10.0f, error(leapfrog));
+}
+
+TEST(GravitySim, WisdomHolmanKeepsPlanetaryOrbits) {
+  // two light planets on circular orbits, 20 Wisdom-Holman steps per inner orbit
+  std::vector<float> masses = {1e3, 1e-3, 1e-3};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {10, 0, 0}, {0, 20, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, 10, 0}, {-sqrtf(50.0f), 0, 0}};
+  float inner_period = 2.0f * 3.14159265f;
+  gravitysim::Simulation sim(masses, positions, vels, inner_period / 20.0f);
+  sim.set_G(1.0f);
+  sim.set_COM_frame();
+  sim.set_integrator(gravitysim::Integrator::WISDOM_HOLMAN);
+
+  // each step is half an inner orbit
+  for (int i=0; i<200; i++) {
+    sim.step();
+    const auto &p = sim.get_positions();
+    float r1 = std::hypot(p[1].x - p[0].x, p[1].y - p[0].y, p[1].z - p[0].z);
+    float r2 = std::hypot(p[2].x - p[0].x, p[2].y - p[0].y, p[2].z - p[0].z);
+    ASSERT_NEAR(r1, 10.0f, 1e-2f);
+    ASSERT_NEAR(r2, 20.0f, 2e-2f);
+  }
+}
+
+TEST(GravitySim, IAS15ResolvesEccentricOrbit) {
+  // e = 0.9 orbit with period 2 pi, started at apocenter
+  std::vector<float> masses = {1.0f, 1e-6f};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {1.9f, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, sqrtf(0.1f / 1.9f), 0}};
+  float period = 2.0f * 3.14159265f;
+  // each step is a tenth of the orbit, far too long for a fixed step through pericenter
+  gravitysim::Simulation sim(masses, positions, vels, period / 100.0f);
+  sim.set_G(1.0f);
+  sim.set_integrator(gravitysim::Integrator::IAS15);
+
+  float TE = sim.get_KE() + sim.get_PE();
+  for (int i=0; i<10; i++) sim.step();
+  // synchronizes vels from simd data
+  sim.set_COM_frame();
+
+  const auto &p = sim.get_positions();
+  EXPECT_NEAR(p[1].x - p[0].x, 1.9f, 1e-4f);
+  EXPECT_NEAR(p[1].y - p[0].y, 0.0f, 1e-4f);
+  EXPECT_NEAR(sim.get_KE() + sim.get_PE(), TE, 1e-5f * fabsf(TE));
+}
+
+TEST(GravitySim, TestParticlesAreNotSources) {
+  // tracers are listed first but stored after the massive bodies
+  std::vector<float> masses = {0.0f, 1e3f, 0.0f, 1e3f};
+  std::vector<DirectX::XMFLOAT3> positions = {{100, 0, 0}, {0, 0, 0}, {100.001f, 0, 0}, {0, 10, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 1, 0}, {0, 0, 0}, {0, 1, 0}, {1, 0, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-3f);
+  sim.set_G(1.0f);
+  EXPECT_EQ(sim.get_num_massive(), 2);
+  std::vector<uint32_t> expected_ids = {1, 3, 0, 2};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+
+  // a lone massive pair moves exactly as if the tracers were absent
+  gravitysim::Simulation sim_massive({1e3f, 1e3f}, {{0, 0, 0}, {0, 10, 0}}, {{0, 0, 0}, {1, 0, 0}}, 1e-3f);
+  sim_massive.set_G(1.0f);
+  for (int i=0; i<100; i++) {
+    sim.step();
+    sim_massive.step();
+  }
+  const auto &p = sim.get_positions();
+  const auto &q = sim_massive.get_positions();
+  for (int i=0; i<2; i++) {
+    EXPECT_EQ(p[i].x, q[i].x);
+    EXPECT_EQ(p[i].y, q[i].y);
+    EXPECT_EQ(p[i].z, q[i].z);
+  }
+  // the two nearby tracers do not attract each other
+  EXPECT_NEAR(p[3].x - p[2].x, 0.001f, 1e-4f);
+}
+
+TEST(GravitySim, CollisionsMergeBodies) {
+  // two bodies about to collide head on, one far away body and a far tracer
+  std::vector<float> masses = {3.0f, 1.0f, 1.0f, 0.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {1.5f, 0, 0}, {100, 0, 0}, {0, 100, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{1, 0, 0}, {-1, 1, 0}, {0, 0, 0}, {0, 0, 0}};
+  std::vector<float> radii = {1.0f, 1.0f, 1.0f, 1.0f};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-2f, radii);
+  sim.set_G(1e-3f);
+  sim.set_collisions(true);
+  sim.step();
+  // synchronizes vels from simd data
+  sim.set_COM_frame();
+
+  ASSERT_EQ(sim.get_num_bodies(), 3);
+  EXPECT_EQ(sim.get_num_massive(), 2);
+  std::vector<uint32_t> expected_ids = {0, 2, 3};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+  EXPECT_FLOAT_EQ(sim.get_masses()[0], 4.0f);
+  EXPECT_NEAR(sim.get_radii()[0], cbrtf(2.0f), 1e-6f);
+
+  // merged body moves with the pair's momentum, relative to the new COM frame
+  const auto &v = sim.get_vels();
+  float total_momentum_x = 4.0f * v[0].x + v[1].x;
+  float total_momentum_y = 4.0f * v[0].y + v[1].y;
+  EXPECT_NEAR(total_momentum_x, 0.0f, 1e-4f);
+  EXPECT_NEAR(total_momentum_y, 0.0f, 1e-4f);
+  EXPECT_NEAR(v[0].x - v[1].x, 0.5f, 1e-3f);
+  EXPECT_NEAR(v[0].y - v[1].y, 0.25f, 1e-3f);
+
+  // bodies touching across the periodic boundary merge at the boundary, an escaper
+  // far beyond the int range of the cells is left alone
+  std::vector<float> edge_masses = {1.0f, 1.0f, 1.0f};
+  std::vector<DirectX::XMFLOAT3> edge_positions = {{0.2f, 5, 5}, {9.8f, 5, 5}, {5, 5, 5}};
+  std::vector<DirectX::XMFLOAT3> edge_vels = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  std::vector<float> edge_radii = {0.5f, 0.5f, 0.5f};
+  gravitysim::Simulation periodic(edge_masses, edge_positions, edge_vels, 1e-4f, edge_radii);
+  periodic.set_G(1e-6f);
+  ASSERT_TRUE(periodic.set_periodic_box(10.0f));
+  periodic.set_collisions(true);
+  periodic.step();
+  ASSERT_EQ(periodic.get_num_bodies(), 2);
+  float x = periodic.get_positions()[0].x;
+  EXPECT_TRUE(x < 0.01f || x > 9.99f) << x;
+
+  edge_positions[2] = {3e10f, 0, 0};
+  gravitysim::Simulation open(edge_masses, edge_positions, edge_vels, 1e-4f, edge_radii);
+  open.set_G(1e-6f);
+  open.set_collisions(true);
+  open.step();
+  EXPECT_EQ(open.get_num_bodies(), 3);
+}
+
+TEST(GravitySim, AddAndRemoveBodies) {
+  std::vector<float> masses = {1e3f, 1.0f, 0.0f, 0.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {10, 0, 0}, {0, 20, 0}, {500, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, 10, 0}, {7, 0, 0}, {0, 0, 100}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-3f);
+  sim.set_G(1.0f);
+
+  // massive bodies join the massive partition, test particles the end
+  EXPECT_EQ(sim.add_body(2.0f, {-10, 0, 0}, {0, -10, 0}), 4);
+  EXPECT_EQ(sim.add_body(0.0f, {0, -20, 0}, {-7, 0, 0}), 5);
+  EXPECT_EQ(sim.get_num_bodies(), 6);
+  EXPECT_EQ(sim.get_num_massive(), 3);
+  std::vector<uint32_t> expected_ids = {0, 1, 4, 3, 2, 5};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+  EXPECT_EQ(sim.get_masses()[2], 2.0f);
+  EXPECT_EQ(sim.get_positions()[2].x, -10.0f);
+
+  // body 3 is far out and fast, nothing else is unbound
+  EXPECT_EQ(sim.remove_unbound(), 1);
+  expected_ids = {0, 1, 4, 2, 5};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+
+  EXPECT_EQ(sim.remove_escapers(15.0f, gravitysim::RemovalOrder::SWAP_WITH_LAST), 2);
+  expected_ids = {0, 1, 4};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+
+  std::vector<uint32_t> remove = {1};
+  EXPECT_EQ(sim.remove_bodies(remove, gravitysim::RemovalOrder::SWAP_WITH_LAST), 1);
+  expected_ids = {0, 4};
+  EXPECT_EQ(sim.get_ids(), expected_ids);
+  EXPECT_EQ(sim.get_num_massive(), 2);
+  EXPECT_EQ(sim.get_masses()[1], 2.0f);
+
+  // still steps after the arrays shrank
+  sim.step();
+  EXPECT_EQ(sim.get_positions().size(), 2);
+
+  // the COM shift reaches the body arrays after a Barnes-Hut step too
+  sim.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+  sim.step();
+  sim.set_COM_frame();
+  const auto &vels_after = sim.get_vels();
+  float momentum_y = 1e3f * vels_after[0].y + 2.0f * vels_after[1].y;
+  EXPECT_NEAR(momentum_y, 0.0f, 1e-3f);
+}
+
+TEST(GravitySim, PeriodicEwaldBalancesImages) {
+  gravitysim::EwaldTable table;
+  table.build();
+  // interpolated correction follows the exact sums between grid points
+  gravitysim::dvec3 d = {0.123, -0.271, 0.409};
+  gravitysim::dvec3 exact = gravitysim::ewald_correction(d);
+  DirectX::XMFLOAT3 corr;
+  DirectX::XMStoreFloat3(&corr, table.correction(DirectX::XMVectorSet(float(d.x), float(d.y), float(d.z), 0.0f)));
+  EXPECT_NEAR(corr.x, exact.x, 1e-3);
+  EXPECT_NEAR(corr.y, exact.y, 1e-3);
+  EXPECT_NEAR(corr.z, exact.z, 1e-3);
+  // half a box away the images pull equally from both sides
+  EXPECT_NEAR(gravitysim::ewald_correction({0.5, 0.0, 0.0}).x, -4.0, 1e-6);
+
+  // a pair half a box apart does not accelerate, a test particle wraps around the box
+  std::vector<float> masses = {1.0f, 1.0f, 0.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{2.5f, 5, 5}, {7.5f, 5, 5}, {9.9f, 1, 1}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 0, 0}, {0, 0, 0}, {1, 0, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-2f);
+  sim.set_G(1.0f);
+  EXPECT_TRUE(sim.set_periodic_box(10.0f));
+  // integrators with state of their own would not see the wrap
+  EXPECT_FALSE(sim.set_integrator(gravitysim::Integrator::IAS15));
+  EXPECT_EQ(sim.get_integrator(), gravitysim::Integrator::EULER_CROMER);
+  sim.step();
+  sim.set_COM_frame();
+
+  const auto &p = sim.get_positions();
+  const auto &v = sim.get_vels();
+  // open boundaries would give 0.04 * 0.1 = 4e-3
+  EXPECT_NEAR(v[0].x, 0.0f, 1e-5f);
+  EXPECT_NEAR(v[1].x, 0.0f, 1e-5f);
+  EXPECT_GE(p[2].x, 0.0f);
+  EXPECT_LT(p[2].x, 0.1f);
+
+  gravitysim::Simulation hermite(masses, positions, vels, 1e-2f);
+  hermite.set_integrator(gravitysim::Integrator::HERMITE);
+  EXPECT_FALSE(hermite.set_periodic_box(10.0f));
+  EXPECT_TRUE(hermite.set_integrator(gravitysim::Integrator::LEAPFROG));
+  EXPECT_TRUE(hermite.set_periodic_box(10.0f));
+}
+
+template <class Potential>
+static void expect_acc_is_minus_gradient(const Potential &potential) {
+  using namespace DirectX;
+  XMVECTOR r = XMVectorSet(0.7f, -0.4f, 0.3f, 0.0f);
+  XMFLOAT3 acc;
+  XMStoreFloat3(&acc, potential.acc(r));
+  const float h = 1e-2f;
+  float grad[3];
+  for (int k = 0; k < 3; k++) {
+    XMVECTOR step = XMVectorSetByIndex(XMVectorZero(), h, k);
+    grad[k] = (potential.potential(r + step) - potential.potential(r - step)) / (2.0f * h);
+  }
+  EXPECT_NEAR(acc.x, -grad[0], 2e-3f);
+  EXPECT_NEAR(acc.y, -grad[1], 2e-3f);
+  EXPECT_NEAR(acc.z, -grad[2], 2e-3f);
+}
+
+TEST(GravitySim, ExternalPotentialsHoldOrbits) {
+  expect_acc_is_minus_gradient(gravitysim::PointMassPotential{2.0f});
+  expect_acc_is_minus_gradient(gravitysim::NFWPotential{3.0f, 0.5f});
+  expect_acc_is_minus_gradient(gravitysim::MiyamotoNagaiPotential{1.0f, 0.6f, 0.2f});
+  expect_acc_is_minus_gradient(gravitysim::LogarithmicPotential{1.0f, 0.2f, 0.8f});
+
+  // a lone body on a circular orbit in a logarithmic halo
+  float v0 = 1.0f, core_radius = 0.1f;
+  float v_circ = v0 / std::sqrt(1.0f + core_radius * core_radius);
+  std::vector<float> masses = {1.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{1, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, v_circ, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-3f);
+  sim.set_G(1.0f);
+  sim.set_integrator(gravitysim::Integrator::LEAPFROG);
+  sim.add_external_potential(gravitysim::LogarithmicPotential{v0, core_radius});
+  float E0 = sim.get_KE() + sim.get_PE();
+
+  // about a quarter orbit
+  for (int i = 0; i < 160; i++) sim.step();
+  // synchronizes vels without moving to the COM frame of the lone body
+  sim.switch_method(gravitysim::SimulationMethod::CPU_PARTICLE_PARTICLE);
+  const auto &p = sim.get_positions()[0];
+  EXPECT_NEAR(std::sqrt(p.x * p.x + p.y * p.y), 1.0f, 1e-3f);
+  EXPECT_GT(p.y, 0.9f);
+  EXPECT_NEAR(sim.get_KE() + sim.get_PE(), E0, 1e-4f);
+}
+
+TEST(GravitySim, EnsembleMatchesSimulation) {
+  // six three-body systems, the second group of four is only half used
+  const size_t num_systems = 6, num_bodies = 3;
+  gravitysim::Ensemble ensemble(num_systems, num_bodies, 1e-3f);
+  ensemble.set_G(1.0f);
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<gravitysim::Simulation> sims;
+  for (size_t s = 0; s < num_systems; s++) {
+    std::vector<float> masses;
+    std::vector<DirectX::XMFLOAT3> positions, vels;
+    for (size_t b = 0; b < num_bodies; b++) {
+      masses.push_back(1.0f + 0.5f * dist(rng));
+      positions.push_back({2.0f * b + dist(rng), dist(rng), dist(rng)});
+      vels.push_back({0.1f * dist(rng), 0.1f * dist(rng), 0.1f * dist(rng)});
+      ensemble.set_body(s, b, masses.back(), positions.back(), vels.back());
+    }
+    sims.emplace_back(masses, positions, vels, 1e-3f);
+    sims.back().set_G(1.0f);
+    sims.back().set_integrator(gravitysim::Integrator::LEAPFROG);
+  }
+  double E0 = ensemble.get_energy(4);
+
+  // Simulation::step is ten leapfrog steps
+  ensemble.step(20);
+  for (auto &sim : sims) {
+    sim.step();
+    sim.step();
+  }
+  for (size_t s = 0; s < num_systems; s++) {
+    for (size_t b = 0; b < num_bodies; b++) {
+      DirectX::XMFLOAT3 p = ensemble.get_position(s, b);
+      const auto &q = sims[s].get_positions()[b];
+      EXPECT_NEAR(p.x, q.x, 1e-5f);
+      EXPECT_NEAR(p.y, q.y, 1e-5f);
+      EXPECT_NEAR(p.z, q.z, 1e-5f);
+    }
+  }
+  EXPECT_NEAR(ensemble.get_energy(4), E0, 1e-4 * std::abs(E0));
+}
+
+TEST(GravitySim, ThreadPoolCoversRanges) {
+  gravitysim::ThreadPool pool(4);
+  EXPECT_EQ(pool.size(), 4);
+
+  // nested calls run every index exactly once
+  std::vector<std::atomic<int>> hits(1000);
+  pool.parallel_for(10, [&](size_t begin, size_t end) {
+    for (size_t outer = begin; outer < end; outer++) {
+      pool.for_each(hits.begin() + outer * 100, hits.begin() + (outer + 1) * 100,
+        [](std::atomic<int> &h) { h++; });
+    }
+  });
+  for (auto &h : hits) EXPECT_EQ(h.load(), 1);
+
+  std::vector<uint32_t> values(100000);
+  std::mt19937 rng(3);
+  for (auto &v : values) v = rng() % 1000;
+  std::vector<uint32_t> expected = values;
+  std::sort(expected.begin(), expected.end());
+  std::vector<uint32_t> scratch(values.size());
+  pool.sort(values.begin(), values.end(), scratch.begin(), std::less<uint32_t>());
+  EXPECT_EQ(values, expected);
+  // 8 chunks, an odd number of merge rounds ends in scratch and is moved back
+  values.assign(expected.rbegin(), expected.rbegin() + 8500);
+  pool.sort(values.begin(), values.end(), scratch.begin(), std::less<uint32_t>());
+  EXPECT_TRUE(std::is_sorted(values.begin(), values.end()));
+  EXPECT_EQ(values.front(), expected[expected.size() - 8500]);
+
+  std::vector<uint32_t> ones(12345, 1);
+  pool.inclusive_scan(ones.begin(), ones.end(), ones.begin());
+  for (size_t i = 0; i < ones.size(); i++) ASSERT_EQ(ones[i], i + 1);
+
+  // a simulation with its own pinned pool steps like one on the shared pool
+  std::vector<float> masses(64, 1.0f);
+  std::vector<DirectX::XMFLOAT3> positions, vels(64, {0, 0, 0});
+  for (int i = 0; i < 64; i++) positions.push_back({float(i % 4), float(i / 4 % 4), float(i / 16)});
+  gravitysim::Simulation shared(masses, positions, vels, 1e-3f), owned(masses, positions, vels, 1e-3f);
+  owned.set_threads(3, true);
+  shared.step();
+  owned.step();
+  for (int i = 0; i < 64; i++) {
+    EXPECT_EQ(shared.get_positions()[i].x, owned.get_positions()[i].x);
+    EXPECT_EQ(shared.get_positions()[i].y, owned.get_positions()[i].y);
+  }
+}
+
+TEST(GravitySim, RunnerPublishesSnapshots) {
+  // the reader only ever sees the newest published value
+  gravitysim::TripleBuffer<int> buffer;
+  EXPECT_FALSE(buffer.has_fresh());
+  buffer.write_buffer() = 1;
+  buffer.publish();
+  buffer.write_buffer() = 2;
+  buffer.publish();
+  EXPECT_TRUE(buffer.has_fresh());
+  EXPECT_EQ(buffer.read(), 2);
+  EXPECT_EQ(buffer.read(), 2);
+
+  std::vector<float> masses = {1.0f, 1.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{-1, 0, 0}, {1, 0, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, -0.5f, 0}, {0, 0.5f, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-3f);
+  sim.set_G(1.0f);
+
+  gravitysim::SimulationRunner runner(sim);
+  runner.set_energy_interval(1);
+  auto channel = runner.subscribe();
+  EXPECT_EQ(channel->read().positions.size(), 2);
+  runner.start();
+  runner.set_running(true);
+  while (channel->read().step < 20) std::this_thread::yield();
+
+  // commands run between steps on the simulation thread
+  std::atomic<bool> ran = false;
+  runner.submit([&](gravitysim::Simulation &s) {
+    s.set_integrator(gravitysim::Integrator::LEAPFROG);
+    ran = true;
+  });
+  runner.set_running(false);
+  runner.stop();
+  EXPECT_TRUE(ran);
+  EXPECT_EQ(sim.get_integrator(), gravitysim::Integrator::LEAPFROG);
+
+  // a late snapshot matches the simulation once stopped
+  const auto &snapshot = channel->read();
+  EXPECT_GE(snapshot.step, 20);
+  EXPECT_EQ(snapshot.positions[0].x, sim.get_positions()[0].x);
+  EXPECT_NEAR(snapshot.KE + snapshot.PE, sim.get_KE() + sim.get_PE(), 1e-3f);
+}
+
+TEST(GravitySim, PositionViewsNeedNoCopies) {
+  std::vector<float> masses = {1.0f, 1.0f, 0.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{-1, 0, 0}, {1, 0, 0}, {0, 3, 0}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, -0.5f, 0}, {0, 0.5f, 0}, {0.2f, 0, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 1e-3f);
+  sim.set_G(1.0f);
+  sim.step();
+
+  // the CPU view reads the SIMD mirror in place
+  gravitysim::Vec3View view = sim.view_positions();
+  ASSERT_EQ(view.size(), 3);
+  EXPECT_EQ(view.stride(), 4);
+  std::vector<DirectX::XMFLOAT3> copied(view.begin(), view.end());
+
+  // AoS arrays, vels included, are materialized on request
+  const auto &p = sim.get_positions();
+  const auto &v = sim.get_vels();
+  gravitysim::Vec3View vel_view = sim.view_vels();
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(copied[i].x, p[i].x);
+    EXPECT_EQ(view[i].y, p[i].y);
+    EXPECT_EQ(vel_view[i].x, v[i].x);
+  }
+  EXPECT_NE(v[0].x, 0.0f);
+
+  sim.switch_method(gravitysim::SimulationMethod::GPU_PARTICLE_PARTICLE);
+  sim.step();
+  view = sim.view_positions();
+  EXPECT_EQ(view.stride(), 3);
+  EXPECT_EQ(view[2].x, sim.get_positions()[2].x);
+}
+
+TEST(GravitySim, ArenaSettlesToOneBlock) {
+  gravitysim::Arena arena(64);
+  auto small = arena.allocate_array<uint32_t>(8);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(small.data()) % alignof(uint32_t), 0);
+  // does not fit, comes from an overflow block
+  auto big = arena.allocate_array<double>(100);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(big.data()) % alignof(double), 0);
+  for (auto &d : big) d = 1.0;
+  size_t step_bytes = arena.used();
+
+  // the next step gets one block holding everything the last one used
+  arena.reset();
+  EXPECT_GE(arena.get_capacity(), step_bytes);
+  const void *block_start = arena.allocate(1, 1);
+  arena.reset();
+  {
+    gravitysim::Arena::Scope scope(arena);
+    arena.allocate_array<uint32_t>(8);
+    arena.allocate_array<double>(100);
+  }
+  EXPECT_EQ(arena.used(), 0);
+  EXPECT_EQ(arena.allocate(1, 1), block_start);
+}
+
+TEST(GravitySim, TrajectoryRoundTrip) {
+  std::mt19937 rng(7);
+  std::normal_distribution<float> start(0.0f, 100.0f), kick(0.0f, 0.005f);
+  std::vector<DirectX::XMFLOAT3> positions(3000);
+  for (auto &p : positions) p = {start(rng), start(rng), start(rng)};
+
+  const double precision = 1e-3;
+  std::string path = (std::filesystem::temp_directory_path() / "gravitysim_trajectory_test.gstraj").string();
+  std::vector<std::vector<DirectX::XMFLOAT3>> frames;
+  {
+    gravitysim::TrajectoryWriter writer(path, precision, 8);
+    ASSERT_TRUE(writer.is_open());
+    for (uint64_t step = 0; step < 20; step++) {
+      // the body count changes mid way, which forces a keyframe
+      if (step == 13) positions.resize(2500);
+      for (auto &p : positions) p = {p.x + kick(rng), p.y + kick(rng), p.z + kick(rng)};
+      frames.push_back(positions);
+      ASSERT_TRUE(writer.write_frame(step * 10, gravitysim::Vec3View(std::span<const DirectX::XMFLOAT3>(positions))));
+    }
+    ASSERT_TRUE(writer.close());
+  }
+  size_t raw_bytes = 0;
+  for (const auto &frame : frames) raw_bytes += frame.size() * sizeof(DirectX::XMFLOAT3);
+  EXPECT_LT(std::filesystem::file_size(path) * 3, raw_bytes);
+
+  gravitysim::TrajectoryReader reader(path);
+  ASSERT_TRUE(reader.is_open());
+  ASSERT_EQ(reader.num_frames(), frames.size());
+  EXPECT_EQ(reader.get_step(5), 50);
+  // float rounding of the reconstruction adds a little on top of half the quantum
+  auto check_frame = [&](size_t f) {
+    std::vector<DirectX::XMFLOAT3> decoded;
+    ASSERT_TRUE(reader.read_frame(f, decoded));
+    ASSERT_EQ(decoded.size(), frames[f].size());
+    for (size_t i = 0; i < decoded.size(); i++) {
+      EXPECT_NEAR(decoded[i].x, frames[f][i].x, precision * 0.5 + 1e-4);
+      EXPECT_NEAR(decoded[i].y, frames[f][i].y, precision * 0.5 + 1e-4);
+      EXPECT_NEAR(decoded[i].z, frames[f][i].z, precision * 0.5 + 1e-4);
+    }
+  };
+  // random access, then sequential, then backwards across keyframes
+  check_frame(11);
+  for (size_t f = 0; f < frames.size(); f++) check_frame(f);
+  check_frame(14);
+  check_frame(3);
+  std::remove(path.c_str());
+}
+
+TEST(GravitySim, SnapshotStoreQueriesChunks) {
+  // bodies laid out along x, so each chunk covers a slab
+  const size_t n = 1000;
+  std::vector<DirectX::XMFLOAT3> positions(n), vels(n);
+  std::vector<float> masses(n);
+  std::vector<uint32_t> ids(n);
+  for (size_t i = 0; i < n; i++) {
+    positions[i] = {float(i), float(i % 17), -float(i % 5)};
+    vels[i] = {1.0f, float(i) * 0.01f, 0.0f};
+    masses[i] = 1.0f + float(i % 3);
+    ids[i] = uint32_t(n - i);
+  }
+  gravitysim::SnapshotColumns columns = {gravitysim::Vec3View(std::span<const DirectX::XMFLOAT3>(positions)),
+                                         gravitysim::Vec3View(std::span<const DirectX::XMFLOAT3>(vels)), masses, ids};
+  std::string path = (std::filesystem::temp_directory_path() / "gravitysim_snapshot_test.gssnap").string();
+  ASSERT_TRUE(gravitysim::write_snapshot_store(path, 42, columns, 64));
+
+  {
+    gravitysim::SnapshotStoreReader reader(path);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.get_step(), 42);
+    EXPECT_EQ(reader.get_num_bodies(), n);
+    ASSERT_EQ(reader.get_chunks().size(), 16);
+    EXPECT_EQ(reader.get_chunks()[1].max_mass, 3.0f);
+
+    // stored in Morton order, the ids say where each body came from
+    std::vector<DirectX::XMFLOAT3> read_positions, read_vels;
+    std::vector<float> read_masses;
+    std::vector<uint32_t> read_ids;
+    ASSERT_TRUE(reader.read_positions(read_positions));
+    ASSERT_TRUE(reader.read_vels(read_vels));
+    ASSERT_TRUE(reader.read_masses(read_masses));
+    ASSERT_TRUE(reader.read_ids(read_ids));
+    std::vector<bool> seen(n, false);
+    for (size_t k = 0; k < n; k++) {
+      size_t i = n - read_ids[k];
+      ASSERT_LT(i, n);
+      seen[i] = true;
+      EXPECT_EQ(read_positions[k].x, positions[i].x);
+      EXPECT_EQ(read_vels[k].y, vels[i].y);
+      EXPECT_EQ(read_masses[k], masses[i]);
+    }
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), true), n);
+
+    DirectX::XMFLOAT3 lo = {100.0f, 0.0f, -2.0f}, hi = {200.0f, 8.0f, 0.0f};
+    EXPECT_LT(reader.chunks_in_box(lo, hi).size(), 16);
+    std::vector<uint32_t> found_ids;
+    std::vector<DirectX::XMFLOAT3> found;
+    ASSERT_TRUE(reader.query_box(lo, hi, found_ids, found));
+    size_t expected = 0;
+    for (const auto &p : positions) {
+      expected += p.x >= lo.x && p.x <= hi.x && p.y >= lo.y && p.y <= hi.y && p.z >= lo.z && p.z <= hi.z;
+    }
+    EXPECT_EQ(found.size(), expected);
+    for (size_t i = 0; i < found.size(); i++) EXPECT_EQ(found_ids[i], n - size_t(found[i].x));
+  }
+
+  // a damaged chunk fails its checksum
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(8 + 70 * sizeof(DirectX::XMFLOAT3));
+    file.put(0x7f);
+  }
+  gravitysim::SnapshotStoreReader reader(path);
+  std::vector<DirectX::XMFLOAT3> read_positions;
+  EXPECT_FALSE(reader.read_positions(read_positions));
+  reader.close();
+
+  // bodies scattered in a cube in no particular order still give compact chunks
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> coord(0.0f, 100.0f);
+  for (size_t i = 0; i < n; i++) positions[i] = {coord(rng), coord(rng), coord(rng)};
+  ASSERT_TRUE(gravitysim::write_snapshot_store(path, 43, columns, 50));
+  ASSERT_TRUE(reader.open(path));
+  ASSERT_EQ(reader.get_chunks().size(), 20);
+  DirectX::XMFLOAT3 lo = {0.0f, 0.0f, 0.0f}, hi = {20.0f, 20.0f, 20.0f};
+  EXPECT_LE(reader.chunks_in_box(lo, hi).size(), 5);
+  std::vector<uint32_t> found_ids;
+  std::vector<DirectX::XMFLOAT3> found;
+  ASSERT_TRUE(reader.query_box(lo, hi, found_ids, found));
+  size_t expected = 0;
+  for (const auto &p : positions) expected += p.x <= hi.x && p.y <= hi.y && p.z <= hi.z;
+  EXPECT_GT(expected, 0);
+  EXPECT_EQ(found.size(), expected);
+  for (size_t i = 0; i < found.size(); i++) EXPECT_EQ(found[i].x, positions[n - found_ids[i]].x);
+  reader.close();
+  std::remove(path.c_str());
+}
+
+TEST(GravitySim, CatalogLoaderParsesInParallel) {
+  // large enough to be split into several pieces
+  std::string text = "mass,x,y,z,vx,vy,vz\r\n# a comment\n\n";
+  const size_t n = 20000;
+  for (size_t i = 0; i < n; i++) {
+    text += std::to_string(i) + ", " + std::to_string(i) + ".5 -1e-3\t+2 0.25 " + std::to_string(i % 7) + ",-3\r\n";
+  }
+  gravitysim::ThreadPool pool(4);
+  gravitysim::InitialConditions ics;
+  ASSERT_TRUE(gravitysim::parse_catalog(text, ics, nullptr, pool));
+  ASSERT_EQ(ics.masses.size(), n);
+  for (size_t i = 0; i < n; i += 997) {
+    EXPECT_EQ(ics.masses[i], float(i));
+    EXPECT_EQ(ics.positions[i].x, float(i) + 0.5f);
+    EXPECT_EQ(ics.positions[i].y, -1e-3f);
+    EXPECT_EQ(ics.positions[i].z, 2.0f);
+    EXPECT_EQ(ics.vels[i].y, float(i % 7));
+    EXPECT_EQ(ics.vels[i].z, -3.0f);
+  }
+
+  // reports the first bad line even when later pieces fail too
+  std::string bad = text;
+  bad.replace(bad.find("\n100,"), 5, "\n1x0,");
+  bad.replace(bad.find("\n15000,"), 7, "\nmass, ");
+  size_t error_line = 0;
+  EXPECT_FALSE(gravitysim::parse_catalog(bad, ics, &error_line, pool));
+  EXPECT_EQ(error_line, 104);
+  EXPECT_TRUE(ics.masses.empty());
+
+  std::string path = (std::filesystem::temp_directory_path() / "gravitysim_catalog_test.csv").string();
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "1e6 0 0 0 0 0 0\n1 10 0 0 0 316.2 0";
+  }
+  ASSERT_TRUE(gravitysim::load_catalog(path, ics));
+  gravitysim::Simulation sim(std::move(ics.masses), std::move(ics.positions), std::move(ics.vels), 0.001f);
+  EXPECT_EQ(sim.get_num_bodies(), 2);
+  EXPECT_EQ(sim.get_positions()[1].x, 10.0f);
+  std::remove(path.c_str());
+  EXPECT_FALSE(gravitysim::load_catalog(path, ics, &error_line));
+  EXPECT_EQ(error_line, 0);
+}
+
+TEST(GravitySim, GadgetRoundTrip) {
+  std::vector<float> masses = {2.0f, 1.0f, 3.0f};
+  std::vector<DirectX::XMFLOAT3> positions = {{0, 0, 0}, {1, 2, 3}, {-4, 5, 6}};
+  std::vector<DirectX::XMFLOAT3> vels = {{0, 1, 0}, {0, 0, 1}, {1, 0, 0}};
+  gravitysim::Simulation sim(masses, positions, vels, 0.01f);
+  std::string path = (std::filesystem::temp_directory_path() / "gravitysim_gadget_test.dat").string();
+  ASSERT_TRUE(gravitysim::write_gadget(path, sim, 0.5));
+
+  gravitysim::InitialConditions ics;
+  std::vector<uint32_t> ids;
+  gravitysim::GadgetHeader header;
+  ASSERT_TRUE(gravitysim::read_gadget(path, ics, &ids, &header));
+  EXPECT_EQ(header.npart[1], 3);
+  EXPECT_EQ(header.time, 0.5);
+  ASSERT_EQ(ics.masses.size(), 3);
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(ics.masses[i], masses[ids[i]]);
+    EXPECT_EQ(ics.positions[i].y, positions[ids[i]].y);
+    EXPECT_EQ(ics.vels[i].z, vels[ids[i]].z);
+  }
+
+  // a file from another code: double precision, 64 bit ids, gas with a
+  // block we do not read, and a fixed mass for type 1
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    auto block = [&](const char *label, const void *data, uint32_t size) {
+      uint32_t eight = 8, next = size + 8;
+      file.write(reinterpret_cast<const char *>(&eight), 4);
+      file.write(label, 4);
+      file.write(reinterpret_cast<const char *>(&next), 4);
+      file.write(reinterpret_cast<const char *>(&eight), 4);
+      file.write(reinterpret_cast<const char *>(&size), 4);
+      file.write(static_cast<const char *>(data), size);
+      file.write(reinterpret_cast<const char *>(&size), 4);
+    };
+    uint8_t head[256] = {};
+    uint32_t npart[6] = {1, 2, 0, 0, 0, 0};
+    double type_mass[6] = {0.0, 7.0, 0, 0, 0, 0};
+    std::memcpy(head, npart, sizeof(npart));
+    std::memcpy(head + 24, type_mass, sizeof(type_mass));
+    block("HEAD", head, 256);
+    double pos[9] = {9, 9, 9, 1, 2, 3, 4, 5, 6};
+    block("POS ", pos, sizeof(pos));
+    double vel[9] = {0, 0, 0, 1, 1, 1, 2, 2, 2};
+    block("VEL ", vel, sizeof(vel));
+    uint64_t id64[3] = {100, 101, 102};
+    block("ID  ", id64, sizeof(id64));
+    double gas_mass = 0.5;
+    block("MASS", &gas_mass, sizeof(gas_mass));
+    float u = 1.0f;
+    block("U   ", &u, sizeof(u));
+  }
+  ASSERT_TRUE(gravitysim::read_gadget(path, ics, &ids, nullptr, 1 << 1));
+  ASSERT_EQ(ics.masses.size(), 2);
+  EXPECT_EQ(ics.masses[1], 7.0f);
+  EXPECT_EQ(ics.positions[1].z, 6.0f);
+  EXPECT_EQ(ics.vels[0].x, 1.0f);
+  EXPECT_EQ(ids[0], 101);
+  ASSERT_TRUE(gravitysim::read_gadget(path, ics));
+  EXPECT_EQ(ics.masses[0], 0.5f);
+  EXPECT_EQ(ics.positions[0].x, 9.0f);
+  std::remove(path.c_str());
+}
+
+TEST(GravitySim, RunConfigParsesKeys) {
+  gravitysim::RunConfig config;
+  std::string error;
+  ASSERT_TRUE(gravitysim::parse_run_config(
+    "# a run\n"
+    "ic = ics/plummer.csv\n"
+    "method = barnes_hut\r\n"
+    "integrator=yoshida4  # fourth order\n"
+    "\n"
+    "dt = 0.002\n"
+    "softening = 0.05\n"
+    "output_format = trajectory\n"
+    "threads = 8\n",
+    config, error)) << error;
+  EXPECT_EQ(config.ic, "ics/plummer.csv");
+  EXPECT_EQ(config.method, gravitysim::SimulationMethod::CPU_BARNES_HUT);
+  EXPECT_EQ(config.integrator, gravitysim::Integrator::YOSHIDA4);
+  EXPECT_EQ(config.dt, 0.002f);
+  EXPECT_EQ(config.output_format, gravitysim::OutputFormat::TRAJECTORY);
+  EXPECT_EQ(config.threads, 8);
+  ASSERT_TRUE(gravitysim::apply_run_config_line("end_time=3.5", config, error));
+  EXPECT_EQ(config.end_time, 3.5);
+
+  EXPECT_FALSE(gravitysim::parse_run_config("dt = 0.1\ndt = -1\n", config, error));
+  EXPECT_EQ(error, "line 2: bad value '-1' for dt");
+  EXPECT_FALSE(gravitysim::parse_run_config("time_step = 1\n", config, error));
+  EXPECT_FALSE(gravitysim::parse_run_config("method = cuda\n", config, error));
+  EXPECT_EQ(gravitysim::apply_run_config_line("method = gpu_pp", config, error), gravitysim::gpu_method_available());
+
+  // Hermite would drop the tree and the softening without a word
+  gravitysim::RunConfig hermite;
+  hermite.ic = "ics.csv";
+  hermite.integrator = gravitysim::Integrator::HERMITE;
+  EXPECT_TRUE(gravitysim::validate_run_config(hermite, error));
+  hermite.softening = 0.01f;
+  EXPECT_FALSE(gravitysim::validate_run_config(hermite, error));
+  hermite.softening = 0.0f;
+  hermite.method = gravitysim::SimulationMethod::CPU_BARNES_HUT;
+  EXPECT_FALSE(gravitysim::validate_run_config(hermite, error));
+
+  // the softening from a config reaches the forces and the potential
+  gravitysim::Simulation sim({1.0f, 1.0f}, {{0, 0, 0}, {1, 0, 0}}, {{0, 0, 0}, {0, 0, 0}}, 0.01f);
+  sim.set_G(1.0f);
+  sim.set_softening(config.softening);
+  EXPECT_NEAR(sim.get_PE(), -1.0f / std::sqrt(1.0f + 0.05f * 0.05f), 1e-6f);
+}
+
+TEST(GravitySim, ForceErrorAgainstExactSum) {
+  std::mt19937 rng(3);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::vector<float> masses(400, 1.0f / 400);
+  std::vector<DirectX::XMFLOAT3> positions(400), vels(400, {0, 0, 0});
+  for (auto &p : positions) p = {normal(rng), normal(rng), normal(rng)};
+  gravitysim::Simulation sim(masses, positions, vels, 0.01f);
+  sim.set_G(1.0f);
+  sim.set_softening(0.01f);
+
+  std::vector<gravitysim::dvec3> exact;
+  sim.get_exact_accelerations(exact);
+  auto max_error = [&] {
+    std::vector<gravitysim::vec3f> accs;
+    sim.get_accelerations(accs);
+    double worst = 0.0;
+    for (size_t i = 0; i < accs.size(); i++) {
+      gravitysim::dvec3 diff = {accs[i].x - exact[i].x, accs[i].y - exact[i].y, accs[i].z - exact[i].z};
+      worst = std::max(worst, std::sqrt(gravitysim::dot(diff, diff) / gravitysim::dot(exact[i], exact[i])));
+    }
+    return worst;
+  };
+
+  EXPECT_LT(max_error(), 1e-5);
+  sim.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+  sim.set_theta(0.8f);
+  double coarse = max_error();
+  sim.set_theta(0.3f);
+  double fine = max_error();
+  EXPECT_LT(fine, coarse);
+  EXPECT_LT(fine, 1e-2);
+  // measuring does not move anything
+  EXPECT_EQ(sim.get_positions()[7].x, positions[7].x);
+
+  // nor does it disturb the accelerations Hermite carries between steps
+  gravitysim::Simulation measured(masses, positions, vels, 0.01f), unmeasured(masses, positions, vels, 0.01f);
+  for (auto *s : {&measured, &unmeasured}) {
+    s->set_G(1.0f);
+    s->set_softening(0.01f);
+    s->set_integrator(gravitysim::Integrator::HERMITE);
+    s->step();
+  }
+  // the carried accelerations are from the predicted positions, these from the corrected ones
+  std::vector<gravitysim::vec3f> accs;
+  measured.get_accelerations(accs);
+  measured.step();
+  unmeasured.step();
+  for (size_t i = 0; i < accs.size(); i++) {
+    ASSERT_EQ(measured.get_vels()[i].x, unmeasured.get_vels()[i].x);
+  }
+}
+
+TEST(GravitySim, PhaseProfilerTimesStepPhases) {
+  std::mt19937 rng(4);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::vector<float> masses(300, 1.0f / 300);
+  std::vector<DirectX::XMFLOAT3> positions(300), vels(300, {0, 0, 0});
+  for (auto &p : positions) p = {normal(rng), normal(rng), normal(rng)};
+  gravitysim::Simulation sim(masses, positions, vels, 0.001f);
+  sim.set_G(1.0f);
+  sim.set_integrator(gravitysim::Integrator::LEAPFROG);
+  sim.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+  EXPECT_EQ(sim.get_profiler(), nullptr);
+  sim.set_profiling(true);
+  sim.step();
+  sim.step();
+
+  // force passes outside of step() are not timed
+  std::vector<gravitysim::vec3f> accs;
+  sim.get_accelerations(accs);
+
+  const auto &profiler = *sim.get_profiler();
+  using gravitysim::StepPhase;
+  EXPECT_EQ(profiler.get(StepPhase::STEP).calls, 2u);
+  // drift, kick, drift per leapfrog substep, ten substeps per step
+  EXPECT_EQ(profiler.get(StepPhase::TREE_BUILD).calls, 20u);
+  EXPECT_EQ(profiler.get(StepPhase::FORCES).calls, 20u);
+  EXPECT_EQ(profiler.get(StepPhase::INTEGRATION).calls, 60u);
+  EXPECT_EQ(profiler.get(StepPhase::COLLISIONS).calls, 0u);
+  EXPECT_GT(profiler.get(StepPhase::FORCES).seconds, 0.0);
+  EXPECT_LE(profiler.get(StepPhase::FORCES).seconds, profiler.get(StepPhase::STEP).seconds);
+  if (profiler.is_available(gravitysim::HardwareCounter::INSTRUCTIONS)) {
+    EXPECT_GT(profiler.get(StepPhase::FORCES).counts[size_t(gravitysim::HardwareCounter::INSTRUCTIONS)], 0u);
+  }
+
+  std::ostringstream report;
+  profiler.report(report);
+  EXPECT_NE(report.str().find("tree build"), std::string::npos);
+  EXPECT_NE(report.str().find("other"), std::string::npos);
+}
+
+TEST(GravitySim, EventTraceWritesChromeJson) {
+  std::mt19937 rng(5);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::vector<float> masses(2000, 1.0f / 2000);
+  std::vector<DirectX::XMFLOAT3> positions(2000), vels(2000, {0, 0, 0});
+  for (auto &p : positions) p = {normal(rng), normal(rng), normal(rng)};
+  gravitysim::Simulation sim(masses, positions, vels, 0.001f);
+  sim.set_G(1.0f);
+  sim.set_threads(3);
+  sim.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+
+  gravitysim::clear_trace();
+  gravitysim::set_tracing(true);
+  sim.step();
+  gravitysim::set_tracing(false);
+  // not recorded
+  sim.step();
+
+  std::ostringstream out;
+  gravitysim::write_chrome_trace(out);
+  std::string json = out.str();
+  auto count = [&](const std::string &s) {
+    size_t n = 0;
+    for (size_t at = json.find(s); at != std::string::npos; at = json.find(s, at + 1)) n++;
+    return n;
+  };
+  EXPECT_EQ(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0u);
+  EXPECT_EQ(count("\"name\":\"step\",\"cat\":\"step\",\"ph\":\"B\""), 1u);
+  EXPECT_EQ(count("\"name\":\"octree build\""), 20u);
+  EXPECT_GT(count("\"cat\":\"pool\""), 0u);
+  EXPECT_EQ(count("\"ph\":\"B\""), count("\"ph\":\"E\""));
+  EXPECT_NE(json.find("pool worker 1"), std::string::npos);
+
+  gravitysim::clear_trace();
+  std::ostringstream cleared;
+  gravitysim::write_chrome_trace(cleared);
+  EXPECT_EQ(cleared.str().find("\"ph\":\"B\""), std::string::npos);
+}
+
+TEST(GravitySim, MemoryTrackerCountsSubsystems) {
+  using gravitysim::MemorySubsystem;
+  size_t bodies_before = gravitysim::memory_usage(MemorySubsystem::BODIES).current;
+  size_t simd_before = gravitysim::memory_usage(MemorySubsystem::SIMD_MIRROR).current;
+  size_t tree_before = gravitysim::memory_usage(MemorySubsystem::TREE).current;
+  const size_t n = 1000;
+  {
+    std::mt19937 rng(6);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<float> masses(n, 1.0f / n);
+    std::vector<DirectX::XMFLOAT3> positions(n), vels(n, {0, 0, 0});
+    for (auto &p : positions) p = {normal(rng), normal(rng), normal(rng)};
+    gravitysim::Simulation sim(masses, positions, vels, 0.001f);
+    sim.set_G(1.0f);
+    sim.switch_method(gravitysim::SimulationMethod::CPU_BARNES_HUT);
+    sim.step();
+
+    // ids, masses, mus, inv_mu, positions and vels
+    size_t body_bytes = n * (4 * sizeof(float) + 2 * sizeof(gravitysim::vec3f));
+    EXPECT_GE(gravitysim::memory_usage(MemorySubsystem::BODIES).current - bodies_before, body_bytes);
+    EXPECT_GE(gravitysim::memory_usage(MemorySubsystem::SIMD_MIRROR).current - simd_before,
+              3 * n * sizeof(DirectX::XMVECTOR));
+    EXPECT_GT(gravitysim::memory_usage(MemorySubsystem::TREE).current, tree_before);
+    auto total = gravitysim::total_memory_usage();
+    EXPECT_GE(total.peak, total.current);
+
+    std::ostringstream report;
+    gravitysim::write_memory_report(report);
+    EXPECT_NE(report.str().find("simd mirror"), std::string::npos);
+  }
+  // everything the simulation owned is given back
+  EXPECT_EQ(gravitysim::memory_usage(MemorySubsystem::BODIES).current, bodies_before);
+  EXPECT_EQ(gravitysim::memory_usage(MemorySubsystem::SIMD_MIRROR).current, simd_before);
+  EXPECT_EQ(gravitysim::memory_usage(MemorySubsystem::TREE).current, tree_before);
+  EXPECT_GE(gravitysim::memory_usage(MemorySubsystem::BODIES).peak, bodies_before + n * sizeof(float));
+
+  gravitysim::reset_memory_peaks();
+  EXPECT_EQ(gravitysim::memory_usage(MemorySubsystem::BODIES).peak, bodies_before);
+}
@@ -0,0 +1,193 @@
+// Headless driver for batch runs, no window, D3D or ImGui.
+//
+//   gravitysim_cli run.cfg [key=value ...]
+//
+// Keys given after the config file override it. Loads the initial conditions,
+// steps to end_time writing outputs and diagnostics, then exits with one of
+// the codes below.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "catalog_loader.hpp"
+#include "event_trace.hpp"
+#include "gadget_io.hpp"
+#include "memory_tracker.hpp"
+#include "run_config.hpp"
+#include "simulation.hpp"
+#include "snapshot_store.hpp"
+#include "trajectory.hpp"
+
+namespace {
+
+enum ExitCode : int {
+  EXIT_OK = 0,
+  EXIT_BAD_CONFIG = 1,
+  EXIT_BAD_INITIAL_CONDITIONS = 2,
+  EXIT_OUTPUT_FAILED = 3,
+  // the total energy stopped being finite
+  EXIT_DIVERGED = 4,
+};
+
+bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string numbered_path(const std::string &prefix, uint64_t step, const char *extension) {
+  char number[32];
+  std::snprintf(number, sizeof(number), "_%08llu", static_cast<unsigned long long>(step));
+  return prefix + number + extension;
+}
+
+bool load_initial_conditions(const gravitysim::RunConfig &config, gravitysim::InitialConditions &ics) {
+  using gravitysim::InitialConditionFormat;
+  InitialConditionFormat format = config.ic_format;
+  if (format == InitialConditionFormat::AUTO) {
+    bool text = ends_with(config.ic, ".csv") || ends_with(config.ic, ".txt");
+    format = text ? InitialConditionFormat::CATALOG : InitialConditionFormat::GADGET;
+  }
+  if (format == InitialConditionFormat::CATALOG) {
+    size_t error_line = 0;
+    if (gravitysim::load_catalog(config.ic, ics, &error_line)) return true;
+    if (error_line > 0) std::cerr << config.ic << ":" << error_line << ": malformed line\n";
+    return false;
+  }
+  return gravitysim::read_gadget(config.ic, ics);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " run.cfg [key=value ...]\n";
+    return EXIT_BAD_CONFIG;
+  }
+  gravitysim::RunConfig config;
+  std::string error;
+  if (!gravitysim::load_run_config(argv[1], config, error)) {
+    std::cerr << error << "\n";
+    return EXIT_BAD_CONFIG;
+  }
+  for (int a = 2; a < argc; a++) {
+    if (!gravitysim::apply_run_config_line(argv[a], config, error)) {
+      std::cerr << argv[a] << ": " << error << "\n";
+      return EXIT_BAD_CONFIG;
+    }
+  }
+  if (!gravitysim::validate_run_config(config, error)) {
+    std::cerr << error << "\n";
+    return EXIT_BAD_CONFIG;
+  }
+
+  if (!config.trace.empty()) {
+    gravitysim::set_trace_thread_name("main");
+    gravitysim::set_tracing(true);
+  }
+
+  gravitysim::InitialConditions ics;
+  if (!load_initial_conditions(config, ics) || ics.masses.empty()) {
+    std::cerr << "cannot read initial conditions from " << config.ic << "\n";
+    return EXIT_BAD_INITIAL_CONDITIONS;
+  }
+
+  gravitysim::Simulation simulation(std::move(ics.masses), std::move(ics.positions), std::move(ics.vels), config.dt);
+  simulation.set_threads(config.threads, config.pin_threads);
+  simulation.set_G(config.G);
+  simulation.set_theta(config.theta);
+  simulation.set_softening(config.softening);
+  simulation.set_integrator(config.integrator);
+  simulation.switch_method(config.method);
+  // after set_threads, so the counters cover the workers
+  simulation.set_profiling(config.profile);
+
+  // every step is ten substeps of dt
+  double step_time = 10.0 * config.dt;
+  uint64_t num_steps = static_cast<uint64_t>(std::ceil(config.end_time / step_time - 1e-9));
+
+  gravitysim::TrajectoryWriter trajectory;
+  if (config.output_format == gravitysim::OutputFormat::TRAJECTORY &&
+      !trajectory.open(config.output + ".gstraj", config.trajectory_precision)) {
+    std::cerr << "cannot write " << config.output << ".gstraj\n";
+    return EXIT_OUTPUT_FAILED;
+  }
+  auto write_output = [&](uint64_t step) {
+    switch (config.output_format) {
+    case gravitysim::OutputFormat::NONE:
+      return true;
+    case gravitysim::OutputFormat::SNAPSHOT:
+      return gravitysim::write_snapshot_store(numbered_path(config.output, step, ".gssnap"), step, simulation);
+    case gravitysim::OutputFormat::GADGET:
+      return gravitysim::write_gadget(numbered_path(config.output, step, ".dat"), simulation, step * step_time);
+    case gravitysim::OutputFormat::TRAJECTORY:
+      return trajectory.write_frame(step, simulation.view_positions());
+    }
+    return false;
+  };
+
+  std::ofstream diagnostics;
+  double initial_energy = 0.0;
+  if (!config.diagnostics.empty()) {
+    diagnostics.open(config.diagnostics, std::ios::trunc);
+    if (!diagnostics) {
+      std::cerr << "cannot write " << config.diagnostics << "\n";
+      return EXIT_OUTPUT_FAILED;
+    }
+    diagnostics << "step,time,KE,PE,E,relative_dE,wall_seconds\n";
+    initial_energy = double(simulation.get_KE()) + simulation.get_PE();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto wall_seconds = [&] {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  if (!write_output(0)) {
+    std::cerr << "writing the output of step 0 failed\n";
+    return EXIT_OUTPUT_FAILED;
+  }
+  for (uint64_t step = 1; step <= num_steps; step++) {
+    simulation.step();
+    bool last = step == num_steps;
+
+    if (diagnostics.is_open() && (step % config.diagnostics_every == 0 || last)) {
+      double KE = simulation.get_KE(), PE = simulation.get_PE(), E = KE + PE;
+      double relative = initial_energy != 0.0 ? (E - initial_energy) / std::abs(initial_energy) : 0.0;
+      diagnostics << step << "," << step * step_time << "," << KE << "," << PE << "," << E << "," << relative << ","
+                  << wall_seconds() << "\n";
+      if (!std::isfinite(E)) {
+        std::cerr << "energy is not finite at step " << step << "\n";
+        return EXIT_DIVERGED;
+      }
+    }
+    if ((step % config.output_every == 0 || last) && !write_output(step)) {
+      std::cerr << "writing the output of step " << step << " failed\n";
+      return EXIT_OUTPUT_FAILED;
+    }
+  }
+  if (trajectory.is_open() && !trajectory.close()) {
+    std::cerr << "writing " << config.output << ".gstraj failed\n";
+    return EXIT_OUTPUT_FAILED;
+  }
+  if (diagnostics.is_open() && !diagnostics.flush()) {
+    std::cerr << "writing " << config.diagnostics << " failed\n";
+    return EXIT_OUTPUT_FAILED;
+  }
+  if (!config.trace.empty() && !gravitysim::write_chrome_trace(config.trace)) {
+    std::cerr << "writing " << config.trace << " failed\n";
+    return EXIT_OUTPUT_FAILED;
+  }
+
+  double seconds = wall_seconds();
+  std::cout << num_steps << " steps of " << simulation.get_num_bodies() << " bodies in " << seconds << " s ("
+            << (seconds > 0.0 ? num_steps / seconds : 0.0) << " steps/s)\n";
+  if (const auto *profiler = simulation.get_profiler()) {
+    if (!profiler->has_counters()) std::cout << "no hardware counters, perf_event_open is unavailable\n";
+    profiler->report(std::cout);
+  }
+  if (config.memory) gravitysim::write_memory_report(std::cout);
+  return EXIT_OK;
+}